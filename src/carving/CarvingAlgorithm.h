@@ -14,7 +14,8 @@
 
 #include "AbstractAlgorithm.h"
 #include "CellGrid.h"
-#include "Culvert.h"
+#include "CulvertSet.h"
+#include "DepressionHierarchy.h"
 
 
 template<typename T, typename U, typename V, typename C>
@@ -29,8 +30,9 @@ class CarvingAlgorithm: public AbstractAlgorithm
             CellGrid<U, C> & delta_dem,
             CellGrid<V, C> & flowdir,
             CellGrid<char, C> &,
-            std::vector<Culvert<U>> &,
-            bool fix_flow_directions = true);
+            const CulvertSet<U> &,
+            bool fix_flow_directions = true,
+            DepressionHierarchy<T, C> * depressions = nullptr);
 };
 
 #endif
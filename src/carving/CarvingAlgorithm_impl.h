@@ -29,8 +29,9 @@ void CarvingAlgorithm<T, U, V, C>::execute(
         CellGrid<U, C> & delta_dem,
         CellGrid<V, C> & flowdirs,
         CellGrid<char, C> & carved_cells,
-        std::vector<Culvert<U>> & culverts,
-        bool fix_flow_directions)
+        const CulvertSet<U> & culverts,
+        bool fix_flow_directions,
+        DepressionHierarchy<T, C> * depressions)
 {
     TimerController tc(timerTree);
     logging::pLog() << "[" << timerTree->descr() << "]";
@@ -38,10 +39,9 @@ void CarvingAlgorithm<T, U, V, C>::execute(
 
     // create a mapping from the culvert sources to the sinks
     std::map<C, C> raster_culverts;
-    const auto & area = dem.area();
     for (const auto & c: culverts) {
-        C sink {area.to_raster_coordinate(c.sink())};
-        C source {area.to_raster_coordinate(c.source())};
+        C sink {culverts.to_raster_coordinate(c.sink())};
+        C source {culverts.to_raster_coordinate(c.source())};
         raster_culverts.insert({source, sink});
         if (c.two_way()) {
             raster_culverts.insert({sink, source});
@@ -50,6 +50,7 @@ void CarvingAlgorithm<T, U, V, C>::execute(
     auto lc = create_linked_cells(delta_dem);
 
     CarvingEngineCPU<T, U, V, C> engine;
+    engine.record_depressions(depressions);
 
     engine.perform_carving(
         dem,
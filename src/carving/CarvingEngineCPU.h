@@ -19,10 +19,12 @@
 #include <chrono>
 
 #include "CarvingEngine.h"
+#include "DepressionHierarchy.h"
 #include "carving_help_CPU.h"
 
 #include "LinkedCells.h"
 #include "geo.h"
+#include "global_parameters.h"
 #include "system_utils.h"
 #include "coordinates.h"
 
@@ -39,11 +41,20 @@ class CarvingEngineCPU:
             const LinkedCells<C> &,
             const std::map<C, C> &);
 
+        /**
+         * \brief Record the depressions into \a h during the carving, or
+         * nothing if it is nullptr.
+         */
+        void record_depressions(DepressionHierarchy<T, C> * h) {
+            depressions_ = h; }
+
     protected:
         void level_linked_cells(
             CellGrid<T, C> &,
             const LinkedCells<C> &);
 
+    private:
+        DepressionHierarchy<T, C> * depressions_ {nullptr};
 };
 
 
@@ -65,6 +76,7 @@ level_linked_cells(
         }
         for (C c: group) {
             dem_data[dem.to_raster_index(c)] = h_min;
+            dem.mark_written(dem.to_raster_index(c));
             // FIXME should we bevel the neighboring cells?
         }
     }
@@ -90,6 +102,7 @@ void CarvingEngineCPU<T, U, V, C>::perform_carving(
 
     auto minima = find_minima(dem);
     std::vector<bool> inserted_(dem.px_size(), false);
+    if (depressions_) depressions_->reset(dem.px_size());
 
     T* dem_data = dem.data();
     V* fd_data = flowdirs.data();
@@ -100,9 +113,11 @@ void CarvingEngineCPU<T, U, V, C>::perform_carving(
     //std::multimap<T, CT> queue;
     // pq
     using P = std::pair<T, C>;
-    std::priority_queue<P, std::vector<P>, compare_pq<P>> queue;
+    std::priority_queue<P, std::vector<P>, compare_pq<P>> queue {
+        compare_pq<P> {global_parameters::reproducible}};
 
-    std::set<C> s_minima;
+    // the minima inside the raster, one bit per cell
+    std::vector<bool> is_minimum(dem.px_size(), false);
     T max_val {0};
     for (const auto &p: minima) {
         const C &c = p.first;
@@ -118,9 +133,10 @@ void CarvingEngineCPU<T, U, V, C>::perform_carving(
             ++n_inserted;
             inserted_[dem.to_raster_index(c)] = true;
         } else {
-            s_minima.insert(c);
+            is_minimum[dem.to_raster_index(c)] = true;
         }
     }
+    minima.clear();
 
     const int len {static_cast<int>(std::floor(std::log10(wpad * hpad) + 1))};
     while (queue.size() > 0) {
@@ -134,6 +150,7 @@ void CarvingEngineCPU<T, U, V, C>::perform_carving(
         T h_cur {queue.top().first};
         queue.pop();
 
+        auto ind = coordinates::to_raster_index(c, wpad);
         for (const auto &nc: get_neighbors(c, raster_culverts, wpad, hpad))
         {
             auto indn = coordinates::to_raster_index(nc, wpad);
@@ -141,9 +158,15 @@ void CarvingEngineCPU<T, U, V, C>::perform_carving(
                 fd_data[indn] =
                     {static_cast<short>(c.col() - nc.col()),
                      static_cast<short>(c.row() - nc.row())};
-                if (s_minima.count(nc)) {
-                    backtrack(nc, dem_data, fd_data, carved.data(),
-                        dem.px_width(), dem.px_height());
+                if (is_minimum[indn]) {
+                    T h_pit {dem_data[indn]};
+                    double cost {backtrack(nc, dem, fd_data, carved)};
+                    if (depressions_) {
+                        depressions_->add_depression(
+                            indn, nc, h_pit, ind, c, h_cur, cost);
+                    }
+                } else if (depressions_) {
+                    depressions_->flood(indn, ind);
                 }
                 T h {dem_data[indn]};
                 max_val = std::max(max_val, h);
@@ -12,33 +12,38 @@
 #ifndef CULVERT_H_
 #define CULVERT_H_
 
+#include <cstddef>
 #include <iostream>
 
+/**
+ * \brief A culvert between two cells of the raster.
+ *
+ * The sink and the source are stored as raster indices (row * nx + col),
+ * so that the carving and the culvert placing code can use them without
+ * coordinate conversions. The geographic coordinates are derived only for
+ * the output, see CulvertSet.
+ */
 template<typename T>
 class Culvert
 {
     public:
         Culvert(
-            const geo::PixelCenterCoordinate &sink,
-            const geo::PixelCenterCoordinate &source,
+            size_t sink,
+            size_t source,
             T id);//,
             //bool two_way = false);
 
-        geo::GeoCoordinate center() const {
-            return average(sink_, source_);
-        }
-
-        geo::PixelCenterCoordinate sink() const { return sink_; }
+        size_t sink() const { return sink_; }
 
-        geo::PixelCenterCoordinate source() const { return source_; }
+        size_t source() const { return source_; }
 
         T id() const { return id_; }
 
         bool two_way() const { return true; }
 
     private:
-        geo::PixelCenterCoordinate sink_;
-        geo::PixelCenterCoordinate source_;
+        size_t sink_;
+        size_t source_;
         T id_;
         //bool two_way_;
 };
@@ -47,7 +52,6 @@ template<typename T>
 std::ostream & operator<<(std::ostream &os, const Culvert<T> &c)
 {
     os << "Culvert(" << static_cast<int>(c.id()) << ")\n";
-    os << "  center: " << c.center() << std::endl;
     os << "  sink-source: " << c.sink() << " " << c.source() << std::endl;
     return os;
 }
@@ -55,8 +59,8 @@ std::ostream & operator<<(std::ostream &os, const Culvert<T> &c)
 
 template<typename T>
 Culvert<T>::Culvert(
-        const geo::PixelCenterCoordinate &sink,
-        const geo::PixelCenterCoordinate &source,
+        size_t sink,
+        size_t source,
         T id)://,
         //bool two_way):
     sink_ {sink},
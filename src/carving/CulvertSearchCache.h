@@ -0,0 +1,178 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef CULVERT_SEARCH_CACHE_H_
+#define CULVERT_SEARCH_CACHE_H_
+
+#include <map>
+#include <algorithm>
+
+/**
+ * \brief A cache for the results of the alternative carving search
+ * (InsertCulvertAlgorithm::find_alternative_carving_near_roads).
+ *
+ * The search reads only the original DEM and the road raster, so the result
+ * is determined by the start cell and the cost bound. The cache is kept over
+ * the culvert placing iterations. A failed search is reused also for smaller
+ * cost bounds, since lowering the bound can only shrink the set of the cells
+ * reached by the search.
+ *
+ * The entries whose search window may contain a newly inserted culvert are
+ * dropped with invalidate().
+ */
+template<typename T, typename C>
+class CulvertSearchCache
+{
+    public:
+        /**
+         * \brief Create an empty cache.
+         *
+         * \param search_radius The radius (in cells) of the search window
+         * around the start cell.
+         */
+        CulvertSearchCache(unsigned int search_radius);
+
+        /**
+         * \brief Return true and set the \a result if the search from
+         * \a start with the cost bound \a cost has been done already.
+         */
+        bool find(
+            const C & start,
+            T cost,
+            std::pair<C, bool> & result);
+
+        /**
+         * \brief As find(), but without counting the hit or the miss, so it
+         * can be called from several threads.
+         */
+        bool peek(
+            const C & start,
+            T cost,
+            std::pair<C, bool> & result) const;
+
+        void insert(
+            const C & start,
+            T cost,
+            const std::pair<C, bool> & result);
+
+        /**
+         * \brief Remove the entries whose search window contains the cell
+         * \a c.
+         */
+        void invalidate(const C & c);
+
+        void clear();
+
+        size_t size() const { return entries_.size(); }
+        size_t hits() const { return hits_; }
+        size_t misses() const { return misses_; }
+
+    private:
+        struct Entry {
+            bool has_failed {false};
+            // the largest cost bound with which the search failed
+            T failed_cost {0};
+            std::map<T, C> found;
+        };
+
+        unsigned int search_radius_;
+        std::map<C, Entry> entries_;
+        size_t hits_;
+        size_t misses_;
+};
+
+
+/* implementation */
+
+template<typename T, typename C>
+CulvertSearchCache<T, C>::CulvertSearchCache(unsigned int search_radius):
+    search_radius_ {search_radius},
+    hits_ {0},
+    misses_ {0}
+{
+}
+
+template<typename T, typename C>
+bool CulvertSearchCache<T, C>::find(
+    const C & start,
+    T cost,
+    std::pair<C, bool> & result)
+{
+    if (peek(start, cost, result)) {
+        ++hits_;
+        return true;
+    }
+    ++misses_;
+    return false;
+}
+
+template<typename T, typename C>
+bool CulvertSearchCache<T, C>::peek(
+    const C & start,
+    T cost,
+    std::pair<C, bool> & result) const
+{
+    auto it = entries_.find(start);
+    if (it != entries_.end()) {
+        const Entry & e {it->second};
+        auto jt = e.found.find(cost);
+        if (jt != e.found.end()) {
+            result = {jt->second, true};
+            return true;
+        }
+        if (e.has_failed && cost <= e.failed_cost) {
+            result = {start, false};
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename T, typename C>
+void CulvertSearchCache<T, C>::insert(
+    const C & start,
+    T cost,
+    const std::pair<C, bool> & result)
+{
+    Entry & e = entries_[start];
+    if (result.second) {
+        e.found[cost] = result.first;
+    } else if (!e.has_failed || e.failed_cost < cost) {
+        e.has_failed = true;
+        e.failed_cost = cost;
+    }
+}
+
+template<typename T, typename C>
+void CulvertSearchCache<T, C>::invalidate(const C & c)
+{
+    using ct = typename C::datatype;
+    // The entries are ordered row-wise, so remove the entries inside the
+    // window one row at a time.
+    ct r {static_cast<ct>(search_radius_)};
+    ct col_min {c.col() > r ? static_cast<ct>(c.col() - r) : static_cast<ct>(0)};
+    ct row_min {c.row() > r ? static_cast<ct>(c.row() - r) : static_cast<ct>(0)};
+    ct col_max {static_cast<ct>(c.col() + r)};
+    ct row_max {static_cast<ct>(c.row() + r)};
+    for (ct j = row_min; j <= row_max; ++j) {
+        auto it = entries_.lower_bound(C {col_min, j});
+        auto it_end = entries_.upper_bound(C {col_max, j});
+        entries_.erase(it, it_end);
+    }
+}
+
+template<typename T, typename C>
+void CulvertSearchCache<T, C>::clear()
+{
+    entries_.clear();
+}
+
+#endif
@@ -0,0 +1,162 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef CULVERT_SET_H_
+#define CULVERT_SET_H_
+
+#include <cmath>
+#include <vector>
+
+#include "Culvert.h"
+#include "RasterArea.h"
+#include "coordinates.h"
+#include "geometrics.h"
+
+/**
+ * \brief The culverts of a raster area.
+ *
+ * The culverts are stored with raster indices. The set knows the raster,
+ * so it converts the indices to the raster coordinates, measures the
+ * distances in the map units without going through the geographic
+ * coordinates, and gives the geographic coordinates for the output.
+ */
+template<typename T>
+class CulvertSet
+{
+    public:
+        using const_iterator = typename std::vector<Culvert<T>>::const_iterator;
+
+        explicit CulvertSet(const geo::RasterArea & area);
+
+        const geo::RasterArea & area() const { return area_; }
+
+        void push_back(const Culvert<T> & c) { culverts_.push_back(c); }
+        size_t size() const { return culverts_.size(); }
+        bool empty() const { return culverts_.empty(); }
+        const Culvert<T> & operator[](size_t i) const { return culverts_[i]; }
+        const_iterator begin() const { return culverts_.begin(); }
+        const_iterator end() const { return culverts_.end(); }
+        void clear() { culverts_.clear(); }
+        void swap(CulvertSet & other);
+
+        /**
+         * \brief Create a culvert between the raster coordinates.
+         */
+        template<typename C>
+        Culvert<T> make(const C & sink, const C & source, T id) const;
+
+        coordinates::RasterCoordinate to_raster_coordinate(size_t ind) const;
+
+        geo::PixelCenterCoordinate to_geocoordinate(size_t ind) const;
+
+        /**
+         * \brief The distance from the center of the culvert to the center
+         * of the cell \a ind.
+         */
+        double center_distance(const Culvert<T> & c, size_t ind) const;
+
+        /**
+         * \brief The distance between the centers of the culverts.
+         */
+        double center_distance(const Culvert<T> & a, const Culvert<T> & b) const;
+
+        /**
+         * \brief The distance from the culvert, as a line segment from the
+         * sink to the source, to the center of the cell \a ind.
+         */
+        double segment_distance(const Culvert<T> & c, size_t ind) const;
+
+    private:
+        geo::RasterArea area_;
+        size_t nx_;
+        double cell_size_;
+        std::vector<Culvert<T>> culverts_;
+
+        // the cell center in the map units, relative to the raster origin
+        geo::GeoCoordinate local_point(size_t ind) const;
+};
+
+
+/* implementation */
+
+template<typename T>
+CulvertSet<T>::CulvertSet(const geo::RasterArea & area):
+    area_ {area},
+    nx_ {area.pixel_width()},
+    cell_size_ {area.cell_size()}
+{
+}
+
+template<typename T>
+void CulvertSet<T>::swap(CulvertSet & other)
+{
+    std::swap(area_, other.area_);
+    std::swap(nx_, other.nx_);
+    std::swap(cell_size_, other.cell_size_);
+    culverts_.swap(other.culverts_);
+}
+
+template<typename T>
+template<typename C>
+Culvert<T> CulvertSet<T>::make(const C & sink, const C & source, T id) const
+{
+    return {coordinates::to_raster_index(sink.col(), sink.row(), nx_),
+            coordinates::to_raster_index(source.col(), source.row(), nx_),
+            id};
+}
+
+template<typename T>
+coordinates::RasterCoordinate CulvertSet<T>::to_raster_coordinate(
+    size_t ind) const
+{
+    using ct = coordinates::raster_coord_type;
+    return {static_cast<ct>(ind % nx_), static_cast<ct>(ind / nx_)};
+}
+
+template<typename T>
+geo::PixelCenterCoordinate CulvertSet<T>::to_geocoordinate(size_t ind) const
+{
+    return area_.to_geocoordinate(to_raster_coordinate(ind));
+}
+
+template<typename T>
+geo::GeoCoordinate CulvertSet<T>::local_point(size_t ind) const
+{
+    return {static_cast<double>(ind % nx_) * cell_size_,
+            static_cast<double>(ind / nx_) * cell_size_};
+}
+
+template<typename T>
+double CulvertSet<T>::center_distance(const Culvert<T> & c, size_t ind) const
+{
+    return distance(
+        average(local_point(c.sink()), local_point(c.source())),
+        local_point(ind));
+}
+
+template<typename T>
+double CulvertSet<T>::center_distance(
+    const Culvert<T> & a,
+    const Culvert<T> & b) const
+{
+    return distance(
+        average(local_point(a.sink()), local_point(a.source())),
+        average(local_point(b.sink()), local_point(b.source())));
+}
+
+template<typename T>
+double CulvertSet<T>::segment_distance(const Culvert<T> & c, size_t ind) const
+{
+    return distance_from_segment(
+        local_point(c.sink()), local_point(c.source()), local_point(ind));
+}
+
+#endif
@@ -0,0 +1,196 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef DEPRESSION_HIERARCHY_H_
+#define DEPRESSION_HIERARCHY_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "GridSpill.h"
+
+/**
+ * \brief The depressions met by the carving, and the cells flooded from
+ * each of them.
+ *
+ * The hierarchy is recorded by the carving engine (CarvingEngineCPU) while
+ * the priority flood proceeds. When the flood reaches an internal pit, the
+ * pit becomes a new depression whose parent is the depression from which
+ * the flood came, and the cells reached through the pit are labelled with
+ * it. The cells flooded directly from the raster border belong to the
+ * depression outside (id 0).
+ *
+ * The hierarchy is used to estimate the effect of a culvert without
+ * carving the DEM again.
+ */
+template<typename T, typename C>
+class DepressionHierarchy
+{
+    public:
+        struct Depression
+        {
+            C pit;
+            // the cell from which the flood reached the pit
+            C spill;
+            T pit_elevation;
+            T spill_elevation;
+            // the level to which the water rises without carving, i.e. the
+            // highest spill elevation on the way out
+            T water_level;
+            size_t parent;
+            // the carving done from the pit down to the flood
+            double carving_cost;
+        };
+
+        static const size_t outside {0};
+
+        /**
+         * \brief Remove the depressions and label all the n_cells cells to
+         * the outside.
+         */
+        void reset(size_t n_cells);
+
+        /**
+         * \brief Label the cell ind to the depression of the cell from.
+         */
+        void flood(size_t ind, size_t from)
+        {
+            labels_[ind] = labels_[from];
+        }
+
+        /**
+         * \brief Add a depression for the pit ind, reached from the cell
+         * spill_ind.
+         */
+        size_t add_depression(
+            size_t ind,
+            const C & pit,
+            T pit_elevation,
+            size_t spill_ind,
+            const C & spill,
+            T spill_elevation,
+            double carving_cost);
+
+        size_t size() const { return depressions_.size(); }
+
+        const Depression & operator[](size_t d) const { return depressions_[d]; }
+
+        size_t depression_of(size_t ind) const { return labels_[ind]; }
+
+        /**
+         * \brief The level of the water in the cell ind of the elevation h.
+         */
+        T fill_level(size_t ind, T h) const
+        {
+            return std::max(h, depressions_[labels_[ind]].water_level);
+        }
+
+        /**
+         * \brief Estimate the carving cost saved by a culvert that leads
+         * the water of the pit pit_ind into the cell target_ind.
+         *
+         * The water of the pit can leave through the culvert only if the
+         * target is filled to a lower level than the depression of the pit.
+         * In that case the carving downstream of the culvert,
+         * remaining_cost, is saved, otherwise nothing is.
+         */
+        double estimate_saving(
+            size_t pit_ind,
+            size_t target_ind,
+            T target_elevation,
+            double remaining_cost) const;
+
+        /**
+         * \brief Keep the labels of the cells in a run-length form until
+         * restore(), if it is smaller. The labels must not be read in
+         * between.
+         */
+        void spill();
+        void restore();
+
+    private:
+        std::vector<std::uint32_t> labels_;
+        std::vector<Depression> depressions_;
+        GridSpill<std::uint32_t> spilled_labels_;
+};
+
+
+/* implementation */
+
+template<typename T, typename C>
+void DepressionHierarchy<T, C>::reset(size_t n_cells)
+{
+    spilled_labels_.clear();
+    labels_.assign(n_cells, static_cast<std::uint32_t>(outside));
+    depressions_.clear();
+    T lowest {std::numeric_limits<T>::lowest()};
+    depressions_.push_back({C {}, C {}, lowest, lowest, lowest, outside, 0.0});
+}
+
+template<typename T, typename C>
+size_t DepressionHierarchy<T, C>::add_depression(
+    size_t ind,
+    const C & pit,
+    T pit_elevation,
+    size_t spill_ind,
+    const C & spill,
+    T spill_elevation,
+    double carving_cost)
+{
+    size_t d {depressions_.size()};
+    if (d > std::numeric_limits<std::uint32_t>::max()) {
+        throw std::runtime_error("Too many depressions.");
+    }
+    size_t parent {labels_[spill_ind]};
+    depressions_.push_back({pit, spill, pit_elevation, spill_elevation,
+        std::max(spill_elevation, depressions_[parent].water_level),
+        parent, carving_cost});
+    labels_[ind] = static_cast<std::uint32_t>(d);
+    return d;
+}
+
+template<typename T, typename C>
+double DepressionHierarchy<T, C>::estimate_saving(
+    size_t pit_ind,
+    size_t target_ind,
+    T target_elevation,
+    double remaining_cost) const
+{
+    size_t d {labels_[pit_ind]};
+    if (d == outside) return 0.0;
+    if (fill_level(target_ind, target_elevation) < depressions_[d].water_level) {
+        return remaining_cost;
+    }
+    return 0.0;
+}
+
+template<typename T, typename C>
+void DepressionHierarchy<T, C>::spill()
+{
+    if (spilled_labels_.stored()) return;
+    if (spilled_labels_.store(labels_.data(), labels_.size())) {
+        std::vector<std::uint32_t>().swap(labels_);
+    }
+}
+
+template<typename T, typename C>
+void DepressionHierarchy<T, C>::restore()
+{
+    if (!spilled_labels_.stored()) return;
+    labels_.resize(spilled_labels_.size());
+    spilled_labels_.load(labels_.data());
+    spilled_labels_.clear();
+}
+
+#endif
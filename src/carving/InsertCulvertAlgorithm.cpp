@@ -20,3 +20,17 @@ InsertCulvertAlgorithm::InsertCulvertAlgorithm():
 InsertCulvertAlgorithm::~InsertCulvertAlgorithm()
 {
 }
+
+void InsertCulvertAlgorithm::collect_errors(std::vector<std::string> * errors)
+{
+    errors_ = errors;
+}
+
+void InsertCulvertAlgorithm::report_error(const std::string & msg)
+{
+    if (errors_) {
+        errors_->push_back(msg);
+    } else {
+        logging::pErr() << msg;
+    }
+}
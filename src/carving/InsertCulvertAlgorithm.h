@@ -15,11 +15,19 @@
 #include <tuple>
 #include <list>
 #include <map>
+#include <sstream>
+#include <string>
+#include <vector>
 
 #include "AbstractAlgorithm.h"
 #include "CellGrid.h"
-#include "Culvert.h"
+#include "CulvertSet.h"
+#include "connected_components.h"
+#include "distance_transform.h"
 #include "geometrics.h"
+#include "parallel.h"
+#include "RoadIndex.h"
+#include "WindowBFS.h"
 #include "system_utils.h"
 
 /**
@@ -104,10 +112,10 @@ class InsertCulvertAlgorithm: public AbstractAlgorithm
         template<typename T, typename U, typename V,
                  typename X, typename C>
         std::pair<Culvert<X>, bool> insert_culvert_pit_fill_upstream(
-            CellGrid<T, C> & dem,
+            const CellGrid<T, C> & dem,
             CellGrid<U, C> & roads,
+            const CellGrid<U, C> & road_sides,
             CellGrid<V, C> & flowdir,
-            CellGrid<T, C> & filled_dem,
             const geo::RasterArea & insert_area,
             const std::pair<double, double> & culvert_len_lims,
             X id,
@@ -161,24 +169,74 @@ class InsertCulvertAlgorithm: public AbstractAlgorithm
             T no_data_value,
             T id);
 
+        /**
+         * \brief Give each 4-connected area of the value to_be_replaced
+         * an own id, starting from first_free_id in the row-major order of
+         * the areas.
+         *
+         * Throws std::runtime_error if the ids do not fit into T.
+         */
         template<typename T, typename C>
         void fill_areas_with_unique_id(
             CellGrid<T, C> & cg,
             T to_be_replaced,
             T first_free_id);
 
+        /**
+         * \brief As above, but only the buffer cells of the road index are
+         * visited.
+         */
+        template<typename T, typename C>
+        void fill_areas_with_unique_id(
+            CellGrid<T, C> & cg,
+            const RoadIndex & index,
+            T to_be_replaced,
+            T first_free_id);
+
+        /**
+         * \brief Label the sides of the roads in the road buffer regions.
+         *
+         * The buffer segments (see RoadIndex::index_segments) are split into
+         * the 4-connected areas separated by the road cells. The buffer
+         * around the road ends, within width + 1 of a road cell with at most
+         * one road neighbour, is left out so that the areas on the different
+         * sides of a road do not join there. An area that still reaches
+         * across a road (e.g. at the end of a thick road) is discarded. The
+         * other cells get the label zero.
+         */
+        template<typename T, typename C>
+        void label_road_sides(
+            const CellGrid<T, C> & roads,
+            const RoadIndex & index,
+            T road_value,
+            double width,
+            CellGrid<T, C> & sides);
+
         template<typename T, typename C>
         void burn_culverts(
             CellGrid<T, C> & delta_dem,
-            std::vector<Culvert<T>> &);
+            const CulvertSet<T> &);
 
         template<typename T, typename C>
         void burn_culvert(
             CellGrid<T, C> & cg,
-            Culvert<T> & c);
-
+            const Culvert<T> & c);
+
+        /**
+         * \brief Find the carved paths that match the given criteria.
+         *
+         * A carved path starts from a pit cell of the original DEM, and
+         * it is followed downstream along the flow directions while the
+         * cells are carved. The cost of the path is the sum of the carving
+         * depths. The rows are scanned in parallel.
+         *
+         * \return The paths as (cost, (pit cell, downstream end, maximum
+         * height difference)), in the ascending order of the cost. Equal
+         * costs are ordered by the height of the pit cell and then by the
+         * row-major order of the first carved cell.
+         */
         template<typename T, typename U, typename C>
-        std::multimap<T, std::tuple<C, C, double>> find_expensive_carvings(
+        std::vector<std::pair<T, std::tuple<C, C, double>>> find_expensive_carvings(
             const CellGrid<T, C> & dem_orig,
             const CellGrid<T, C> & dem_carved,
             const CellGrid<U, C> & flowdirs,
@@ -186,25 +244,11 @@ class InsertCulvertAlgorithm: public AbstractAlgorithm
             double min_hdiff,
             double min_culvert_length);
 
-        template<typename T, typename U, typename C>
-        std::multimap<T, std::tuple<C, C, double>> find_expensive_carvings_(
-            const CellGrid<T, C> & dem_orig,
-            const CellGrid<T, C> & dem_carved,
-            const CellGrid<U, C> & flowdirs,
-            double min_cost,
-            double min_hdiff,
-            double min_culvert_length);
-
-        template<typename T, typename U, typename C>
-        std::multimap<T, C> find_expensive_carvings_upstream_points(
-            const CellGrid<T, C> & dem_carved,
-            const T * diff,
-            const CellGrid<U, C> & flowdirs);
-
         template<typename T, typename U, typename C>
         std::pair<C, bool> find_alternative_carving_near_roads(
             const CellGrid<T, C> & dem,
             const CellGrid<U, C> & roads,
+            const CellGrid<U, C> & road_sides,
             const geo::RasterArea & insert_area,
             const C & start,
             T cost,
@@ -212,6 +256,20 @@ class InsertCulvertAlgorithm: public AbstractAlgorithm
             std::unique_ptr<T> &,
             C &,
             C &);
+
+        /**
+         * \brief Collect the error messages into \a errors instead of
+         * printing them, for an instance used on a worker thread. The
+         * caller prints them afterwards. nullptr prints them again.
+         */
+        void collect_errors(std::vector<std::string> * errors);
+
+    private:
+        void report_error(const std::string & msg);
+
+        // the search engine shared by the culvert placing methods
+        WindowBFS bfs_;
+        std::vector<std::string> * errors_ {nullptr};
 };
 
 
@@ -247,10 +305,12 @@ bool InsertCulvertAlgorithm::crosses_road(
             c = move_coord(c, {1, 0}, nx, ny);
         } else {
             // move either to the right or up/down, depending on which of
-            // the cells is closer to the line from a to b.
-            double dist_i = distance_from_line(a, b, coordinates::move_coord(
+            // the cells is closer to the line from a to b. The distances
+            // have the same denominator, so only the numerators are
+            // compared.
+            auto dist_i = twice_area(a, b, coordinates::move_coord(
                 c, {1, 0}, nx, ny));
-            double dist_j = distance_from_line(a, b, coordinates::move_coord(
+            auto dist_j = twice_area(a, b, coordinates::move_coord(
                 c, {0, dj}, nx, ny));
             if (dist_i < dist_j) {
                 c = move_coord(c, {1, 0}, nx, ny);
@@ -283,19 +343,19 @@ std::vector<T> d8_neighbors(
 template<typename T, typename U, typename V,
          typename X, typename C>
 std::pair<Culvert<X>, bool> InsertCulvertAlgorithm::insert_culvert_pit_fill_upstream(
-    CellGrid<T, C> & dem,
+    const CellGrid<T, C> & dem,
     CellGrid<U, C> & roads,
+    const CellGrid<U, C> & road_sides,
     CellGrid<V, C> & flowdirs,
-    CellGrid<T, C> & filled_dem,
     const geo::RasterArea & insert_area,
     const std::pair<double, double> & culvert_len_lims,
     X id,
     const C & start)
 {
-    const std::pair<Culvert<X>, bool> return_fail {{{0, 0}, {0, 0}, 0}, false};
+    const std::pair<Culvert<X>, bool> return_fail {{0, 0, 0}, false};
 
     logging::LogIndent li;
-    T * dem_data {dem.data()};
+    const T * dem_data {dem.data()};
     U * road_data {roads.data()};
 
     unsigned int nx {dem.px_width()};
@@ -315,27 +375,26 @@ std::pair<Culvert<X>, bool> InsertCulvertAlgorithm::insert_culvert_pit_fill_upst
     C c_up {start};
     T h_start {dem_data[to_raster_index(start, nx)]};
     {
-        std::list<C> queue;
-        queue.push_back(start);
-        while (queue.size() > 0) {
-            C c_t {queue.front()};
-            queue.pop_front();
-            size_t ind {to_raster_index(c_t, nx)};
-            if (road_data[ind] > 1) {
-                if (dem_data[ind] < h_start) {
-                    c_up = c_t;
-                    break;
-                }
-            }
-            for (const C & cn: d8_neighbors(c_t, nx, ny)) {
+        const double r2 {pow(culvert_len_lims.second / 2, 2)};
+        auto lims = create_window_limits(nx, ny, start, start,
+            static_cast<unsigned int>(culvert_len_lims.second / 2) + 1);
+        bfs_.reset(lims.first, lims.second);
+        bfs_.run(start, nx, ny,
+            [&](const C & c_t, const C & cn) {
                 size_t nind {to_raster_index(cn, nx)};
                 V fd {flowdirs.data()[nind]};
-                if (move_coord(cn, {fd.x, fd.y}, nx, ny) != c_t) continue;
-                if (static_cast<double>((cn - start).norm_squared()) > pow(culvert_len_lims.second / 2, 2)) continue;
-                if (road_data[nind] == 0) continue;
-                queue.push_back(cn);
-            }
-        }
+                if (move_coord(cn, {fd.x, fd.y}, nx, ny) != c_t) return false;
+                if (static_cast<double>((cn - start).norm_squared()) > r2) return false;
+                return road_data[nind] != 0;
+            },
+            [&](const C & c_t) {
+                size_t ind {to_raster_index(c_t, nx)};
+                if (road_data[ind] > 1 && dem_data[ind] < h_start) {
+                    c_up = c_t;
+                    return false;
+                }
+                return true;
+            });
     }
     if (c_up == start) {
         return return_fail;
@@ -345,36 +404,31 @@ std::pair<Culvert<X>, bool> InsertCulvertAlgorithm::insert_culvert_pit_fill_upst
     // perform "pit filling"
     std::pair<C, T> lowest {c_up, h_up};
     {
-        std::set<C> flooded_cells;
-        std::list<C> queue;
-        queue.push_back(c_up);
-        while (queue.size() > 0) {
-            C c = queue.front();
-            size_t ind {to_raster_index(c, nx)};
-            queue.pop_front();
-            if (flooded_cells.find(c) == flooded_cells.end() &&
-                dem_data[ind] < h_start &&
-                road_data[ind] > static_cast<U>(1))
-            {
-                flooded_cells.insert(c);
-                if (flooded_cells.size() == 1) {
-                    filled_dem.data()[ind] = 99999; // for debugging
-                } else {
-                    filled_dem.data()[ind] = h_start; // for debugging
-                }
-                T h {dem_data[ind]};
-                if (h < lowest.second) {
-                    lowest = std::make_pair(c, h);
-                }
-                for (const C & cn: d8_neighbors(c, nx, ny)) {
-                    if (flooded_cells.find(cn) == flooded_cells.end()) {
-                        queue.push_back(cn);
+        // The flooded area is not limited, so the window is grown until
+        // the flood does not reach its border.
+        unsigned int radius {static_cast<unsigned int>(culvert_len_lims.second) + 1};
+        while (true) {
+            auto lims = create_window_limits(nx, ny, c_up, c_up, radius);
+            bfs_.reset(lims.first, lims.second);
+            lowest = {c_up, h_up};
+            bool inside {bfs_.run(c_up, nx, ny,
+                [&](const C &, const C & cn) {
+                    size_t nind {to_raster_index(cn, nx)};
+                    return dem_data[nind] < h_start &&
+                        road_data[nind] > static_cast<U>(1);
+                },
+                [&](const C & c) {
+                    T h {dem_data[to_raster_index(c, nx)]};
+                    if (h < lowest.second) {
+                        lowest = std::make_pair(c, h);
                     }
-                }
-            }
+                    return true;
+                })};
+            if (inside || (lims.first == C {0, 0} &&
+                           lims.second == C {nx - 1, ny - 1}))
+                break;
+            radius *= 2;
         }
-        auto l = lowest.first;
-        filled_dem.data()[to_raster_index(l, nx)] = 99998;
     }
     c_up = lowest.first;
 
@@ -384,15 +438,17 @@ std::pair<Culvert<X>, bool> InsertCulvertAlgorithm::insert_culvert_pit_fill_upst
     auto ret = find_alternative_carving_near_roads(
         dem,
         roads,
+        road_sides,
         insert_area,
         c_up,
         std::numeric_limits<T>::max(),
         culvert_len_lims,
         cost_window, c_min, c_max);
 
-    geo::PixelCenterCoordinate g_up {dem.to_geocoordinate(c_up)};
-    geo::PixelCenterCoordinate g_down {dem.to_geocoordinate(ret.first)};
-    return {{g_up, g_down, id}, ret.second};
+    return {{coordinates::to_raster_index(c_up, dem.px_width()),
+             coordinates::to_raster_index(ret.first, dem.px_width()),
+             id},
+            ret.second};
 }
 
 template<typename T, typename U, typename C>
@@ -468,23 +524,223 @@ void InsertCulvertAlgorithm::fill_areas_with_unique_id(
     T to_be_replaced,
     T first_free_id)
 {
-    using ct = typename C::datatype;
     T * data {cg.data()};
-    for (ct j = 0; j < cg.px_height(); ++j) {
-        for (ct i = 0; i < cg.px_width(); ++i) {
-            if (data[to_raster_index(C {i, j}, cg.px_width())] == to_be_replaced) {
-                fill_area_with_id(
-                    cg, {i, j}, to_be_replaced,
-                    first_free_id++);
+    std::vector<std::uint32_t> labels;
+    size_t n_areas {connected_components::label_4_connected(
+        [data, to_be_replaced](size_t ind) {
+            return data[ind] == to_be_replaced;
+        },
+        cg.px_width(), cg.px_height(), labels)};
+    if (n_areas > 0 && n_areas - 1 > static_cast<size_t>(
+        std::numeric_limits<T>::max() - first_free_id))
+    {
+        std::stringstream ss;
+        ss << "fill_areas_with_unique_id: " << n_areas << " areas do not "
+            "fit into the id type starting from " << first_free_id << ".";
+        throw std::runtime_error(ss.str());
+    }
+    parallel::for_blocks(labels.size(), [&](size_t begin, size_t end)
+    {
+        for (size_t ind = begin; ind < end; ++ind) {
+            if (labels[ind] != 0) {
+                data[ind] = static_cast<T>(first_free_id + (labels[ind] - 1));
             }
         }
+    });
+}
+
+template<typename T, typename C>
+void InsertCulvertAlgorithm::fill_areas_with_unique_id(
+    CellGrid<T, C> & cg,
+    const RoadIndex & index,
+    T to_be_replaced,
+    T first_free_id)
+{
+    T * data {cg.data()};
+    const std::vector<size_t> & cells {index.buffer_cells()};
+    std::vector<std::uint32_t> labels;
+    size_t n_areas {connected_components::label_4_connected_sparse(
+        cells.data(), cells.size(), cg.px_width(),
+        [&](size_t k) {
+            return data[cells[k]] == to_be_replaced;
+        },
+        labels)};
+    if (n_areas > 0 && n_areas - 1 > static_cast<size_t>(
+        std::numeric_limits<T>::max() - first_free_id))
+    {
+        std::stringstream ss;
+        ss << "fill_areas_with_unique_id: " << n_areas << " areas do not "
+            "fit into the id type starting from " << first_free_id << ".";
+        throw std::runtime_error(ss.str());
     }
+    parallel::for_blocks(cells.size(), [&](size_t begin, size_t end)
+    {
+        for (size_t k = begin; k < end; ++k) {
+            if (labels[k] != 0) {
+                data[cells[k]] = static_cast<T>(first_free_id + (labels[k] - 1));
+            }
+        }
+    });
+}
+
+template<typename T, typename C>
+void InsertCulvertAlgorithm::label_road_sides(
+    const CellGrid<T, C> & roads,
+    const RoadIndex & index,
+    T road_value,
+    double width,
+    CellGrid<T, C> & sides)
+{
+    const T * data {roads.data()};
+    size_t nx {roads.px_width()};
+    size_t ny {roads.px_height()};
+    const std::vector<size_t> & road_cells {index.road_cells()};
+    const std::vector<size_t> & buffer_cells {index.buffer_cells()};
+    // the position of a cell in buffer_cells, or buffer_cells.size()
+    auto buffer_pos = [&](size_t ind)
+    {
+        auto it = std::lower_bound(buffer_cells.begin(), buffer_cells.end(), ind);
+        return it != buffer_cells.end() && *it == ind ?
+            static_cast<size_t>(it - buffer_cells.begin()) : buffer_cells.size();
+    };
+
+    // the road ends
+    std::vector<size_t> ends;
+    for (size_t ind: road_cells) {
+        size_t i {ind % nx};
+        size_t j {ind / nx};
+        unsigned int n {0};
+        for (size_t jj = (j > 0 ? j - 1 : 0); jj <= std::min(j + 1, ny - 1); ++jj) {
+            for (size_t ii = (i > 0 ? i - 1 : 0); ii <= std::min(i + 1, nx - 1); ++ii) {
+                if (data[jj * nx + ii] == road_value) ++n;
+            }
+        }
+        // the cell itself is counted too
+        if (n <= 2) ends.push_back(ind);
+    }
+
+    // Mark the buffer cells around the road ends, one row of the disk at a
+    // time.
+    std::vector<char> cap(buffer_cells.size(), 0);
+    double max_d2 {std::floor((width + 1) * (width + 1))};
+    long r {static_cast<long>(std::floor(std::sqrt(max_d2)))};
+    for (size_t ind: ends) {
+        long i {static_cast<long>(ind % nx)};
+        long j {static_cast<long>(ind / nx)};
+        for (long jj = std::max(j - r, 0l);
+             jj <= std::min(j + r, static_cast<long>(ny) - 1); ++jj)
+        {
+            size_t row {static_cast<size_t>(jj) * nx};
+            auto it = std::lower_bound(buffer_cells.begin(), buffer_cells.end(),
+                row + static_cast<size_t>(std::max(i - r, 0l)));
+            auto it_end = std::upper_bound(it, buffer_cells.end(),
+                row + static_cast<size_t>(
+                    std::min(i + r, static_cast<long>(nx) - 1)));
+            for (; it != it_end; ++it) {
+                long di {static_cast<long>(*it - row) - i};
+                if (static_cast<double>(di * di + (jj - j) * (jj - j)) <= max_d2) {
+                    cap[static_cast<size_t>(it - buffer_cells.begin())] = 1;
+                }
+            }
+        }
+    }
+
+    // The areas are inside the buffer segments, so each segment is
+    // labelled separately.
+    size_t n_segs {index.n_segments()};
+    std::vector<std::uint32_t> labels(buffer_cells.size(), 0);
+    std::vector<size_t> label_offsets(n_segs + 1, 0);
+    parallel::for_blocks(n_segs, [&](size_t s_begin, size_t s_end)
+    {
+        std::vector<size_t> cells;
+        std::vector<std::uint32_t> seg_labels;
+        for (size_t s = s_begin; s < s_end; ++s) {
+            const size_t * pos {index.segment_begin(s)};
+            size_t n {static_cast<size_t>(index.segment_end(s) - pos)};
+            cells.resize(n);
+            for (size_t k = 0; k < n; ++k) cells[k] = buffer_cells[pos[k]];
+            label_offsets[s + 1] = connected_components::label_4_connected_sparse(
+                cells.data(), n, nx,
+                [&](size_t k) { return !cap[pos[k]]; },
+                seg_labels, 1);
+            for (size_t k = 0; k < n; ++k) labels[pos[k]] = seg_labels[k];
+        }
+    });
+    for (size_t s = 0; s < n_segs; ++s) {
+        label_offsets[s + 1] += label_offsets[s];
+    }
+    if (label_offsets[n_segs] > static_cast<size_t>(std::numeric_limits<T>::max())) {
+        throw std::runtime_error(
+            "label_road_sides: too many road sides for the label type.");
+    }
+    parallel::for_blocks(n_segs, [&](size_t s_begin, size_t s_end)
+    {
+        for (size_t s = s_begin; s < s_end; ++s) {
+            for (const size_t * pos = index.segment_begin(s);
+                 pos != index.segment_end(s); ++pos)
+            {
+                if (labels[*pos] != 0) {
+                    labels[*pos] += static_cast<std::uint32_t>(label_offsets[s]);
+                }
+            }
+        }
+    });
+
+    // Discard the areas that are found on both sides of a horizontal or a
+    // vertical run of road cells. The runs are taken from the road cells
+    // in the row-major and in the column-major order.
+    std::vector<char> discarded(label_offsets[n_segs] + 1, 0);
+    auto label_at = [&](size_t ind)
+    {
+        size_t p {buffer_pos(ind)};
+        return p < buffer_cells.size() ? labels[p] : 0;
+    };
+    auto check_runs = [&](const std::vector<size_t> & cells, bool columns)
+    {
+        size_t step {columns ? nx : 1};
+        size_t line_len {columns ? ny : nx};
+        auto line = [&](size_t ind) { return columns ? ind % nx : ind / nx; };
+        auto pos = [&](size_t ind) { return columns ? ind / nx : ind % nx; };
+        size_t k {0};
+        while (k < cells.size()) {
+            size_t k_end {k + 1};
+            while (k_end < cells.size() &&
+                   cells[k_end] == cells[k_end - 1] + step &&
+                   line(cells[k_end]) == line(cells[k]))
+            {
+                ++k_end;
+            }
+            if (pos(cells[k]) > 0 && pos(cells[k_end - 1]) + 1 < line_len) {
+                std::uint32_t a {label_at(cells[k] - step)};
+                std::uint32_t b {label_at(cells[k_end - 1] + step)};
+                if (a != 0 && a == b) discarded[a] = 1;
+            }
+            k = k_end;
+        }
+    };
+    check_runs(road_cells, false);
+    std::vector<size_t> road_cols(road_cells);
+    std::sort(road_cols.begin(), road_cols.end(), [nx](size_t a, size_t b) {
+        return std::make_pair(a % nx, a / nx) < std::make_pair(b % nx, b / nx);
+    });
+    check_runs(road_cols, true);
+
+    sides.format(0);
+    T * sides_data {sides.data()};
+    parallel::for_blocks(buffer_cells.size(), [&](size_t begin, size_t end)
+    {
+        for (size_t k = begin; k < end; ++k) {
+            if (!discarded[labels[k]]) {
+                sides_data[buffer_cells[k]] = static_cast<T>(labels[k]);
+            }
+        }
+    });
 }
 
 template<typename T, typename C>
 void InsertCulvertAlgorithm::burn_culverts(
     CellGrid<T, C> & delta_dem,
-    std::vector<Culvert<T>> &culverts)
+    const CulvertSet<T> &culverts)
 {
     for (auto &c: culverts)
     {
@@ -495,14 +751,13 @@ void InsertCulvertAlgorithm::burn_culverts(
 template<typename T, typename C>
 void InsertCulvertAlgorithm::burn_culvert(
     CellGrid<T, C> & cg,
-    Culvert<T> & c)
+    const Culvert<T> & c)
 {
     T * data {cg.data()};
-    unsigned int nx {static_cast<unsigned int>(cg.px_width())};
-    auto c_sink = cg.area().to_raster_coordinate(c.sink());
-    auto c_source = cg.area().to_raster_coordinate(c.source());
-    data[to_raster_index(c_sink, nx)] = c.id();
-    data[to_raster_index(c_source, nx)] = c.id();
+    data[c.sink()] = c.id();
+    data[c.source()] = c.id();
+    cg.mark_written(c.sink());
+    cg.mark_written(c.source());
 }
 
 template<typename T, typename V, typename X, typename Y, typename C>
@@ -515,7 +770,7 @@ std::pair<Culvert<X>, bool> InsertCulvertAlgorithm::insert_culvert_along_flow_ro
     const C & start,
     X id)
 {
-    std::pair<Culvert<X>, bool> return_fail {{{0, 0}, {0, 0}, 0}, false};
+    std::pair<Culvert<X>, bool> return_fail {{0, 0, 0}, false};
 
     try {
         //logging::pLog() << "insert_culvert_along_flow_route " << start;
@@ -529,52 +784,46 @@ std::pair<Culvert<X>, bool> InsertCulvertAlgorithm::insert_culvert_along_flow_ro
         C c_sink {start};
         T h_start {dem_data[to_raster_index(start, nx)]};
         {
-            std::list<C> queue;
-            queue.push_back(start);
-            std::set<C> upstream_cells;
             // Find all the cells that flow to the start cell and that are
             // further than min_culvert_length / 2 but closer than
-            // max_culvert_length / 2 to the start.
-            while (queue.size() > 0) {
-                C c_t {queue.front()};
-                queue.pop_front();
-                size_t ind {to_raster_index(c_t, nx)};
-                if (static_cast<double>((c_t - start).norm_squared()) >= pow(culvert_len_lims.first, 2) &&
-                        road_data[ind] > 1) {
-                    upstream_cells.insert(c_t);
-                }
-                for (const C & cn: d8_neighbors(c_t, nx, ny)) {
+            // max_culvert_length / 2 to the start. From the found cells
+            // choose the lowest (the first one in the row-major order if
+            // there are several).
+            const double r2 {pow(culvert_len_lims.second / 2, 2)};
+            const double min_r2 {pow(culvert_len_lims.first, 2)};
+            bool found {false};
+            T hmin {std::numeric_limits<T>::max()};
+            auto lims = create_window_limits(nx, ny, start, start,
+                static_cast<unsigned int>(culvert_len_lims.second / 2) + 1);
+            bfs_.reset(lims.first, lims.second);
+            bfs_.run(start, nx, ny,
+                [&](const C & c_t, const C & cn) {
                     size_t nind {to_raster_index(cn, nx)};
                     V fd {flowdirs.data()[nind]};
                     // check if the cell flows out of the area
-                    if (move_coord(cn, {fd.x, fd.y}, nx, ny) != c_t) continue;
-                    if (static_cast<double>((cn - start).norm_squared()) > pow(culvert_len_lims.second / 2, 2)) continue;
-                    if (delta_dem.data()[nind] != 0) {
-                        continue;
-                        // FIXME at least continue if the cell is sink.
-                        // If the cell is source, perhaps something else
-                        // could be done.
+                    if (move_coord(cn, {fd.x, fd.y}, nx, ny) != c_t) return false;
+                    if (static_cast<double>((cn - start).norm_squared()) > r2) return false;
+                    // FIXME at least continue if the cell is sink.
+                    // If the cell is source, perhaps something else
+                    // could be done.
+                    return delta_dem.data()[nind] == 0;
+                },
+                [&](const C & c_t) {
+                    size_t ind {to_raster_index(c_t, nx)};
+                    if (static_cast<double>((c_t - start).norm_squared()) >= min_r2 &&
+                            road_data[ind] > 1) {
+                        T h {dem_data[ind]};
+                        if (!found || h < hmin || (h == hmin && c_t < c_sink)) {
+                            hmin = h;
+                            c_sink = c_t;
+                            found = true;
+                        }
                     }
-                    queue.push_back(cn);
-                }
-            }
-            // From the found cells choose the lowest.
-            if (upstream_cells.size() == 0) {
+                    return true;
+                });
+            if (!found) {
                 return return_fail;
             }
-            c_sink = [&]() {
-                T hmin {std::numeric_limits<T>::max()};
-                C c_ret {*(upstream_cells.begin())};
-                for (const C & c: upstream_cells) {
-                    size_t ind {to_raster_index(c, nx)};
-                    T h {dem_data[ind]};
-                    if (h < hmin) {
-                        hmin = h;
-                        c_ret = c;
-                    }
-                }
-                return c_ret;
-            }();
         }
 
         // Follow the flow directions to the first non-road cell from
@@ -593,45 +842,44 @@ std::pair<Culvert<X>, bool> InsertCulvertAlgorithm::insert_culvert_along_flow_ro
             // Find all the cells on the downstream side that are lower
             // than the found c_src and that are connected to the c_src
             // (within the max_culvert_length).
-            std::set<C> visited_cells;
-            std::list<C> queue;
-            std::multimap<double, C> connected_cells;
-            visited_cells.insert(c_src);
-            connected_cells.insert({static_cast<double>((c_src - c_sink).norm_squared()), c_src});
-            queue.push_back(c_src);
-            while (queue.size() > 0) {
-                C c {queue.front()};
-                queue.pop_front();
-                for (const C & cn: d8_neighbors(c, nx, ny)) {
-                    if (visited_cells.find(cn) != visited_cells.end()) continue;
-                    visited_cells.insert(cn);
-                    double dist2 {static_cast<double>((cn - c_sink).norm_squared())};
-                    if (dist2 > pow(culvert_len_lims.second, 2)) continue;
+            // Of the connected cells, choose the closest one to the sink
+            // that is lower than the sink, or the closest one if there are
+            // no such cells. The ties are resolved by the search order.
+            const double r2 {pow(culvert_len_lims.second, 2)};
+            T h_sink {dem_data[to_raster_index(c_sink, nx)]};
+            bool found_lower {false};
+            double dist2_lower {0};
+            C c_lower {c_src};
+            double dist2_any {static_cast<double>((c_src - c_sink).norm_squared())};
+            C c_any {c_src};
+            auto lims = create_window_limits(nx, ny, c_sink, c_src,
+                static_cast<unsigned int>(culvert_len_lims.second) + 1);
+            bfs_.reset(lims.first, lims.second);
+            bfs_.run(c_src, nx, ny,
+                [&](const C &, const C & cn) {
+                    if (static_cast<double>((cn - c_sink).norm_squared()) > r2) return false;
                     size_t ind {to_raster_index(cn, nx)};
-                    if (road_data[ind] < 2) continue;
-                    T h {dem_data[ind]};
-                    if (h <= h_start) {
-                        connected_cells.insert({dist2, cn});
-                        queue.push_back(cn);
+                    if (road_data[ind] < 2) return false;
+                    return dem_data[ind] <= h_start;
+                },
+                [&](const C & c) {
+                    double dist2 {static_cast<double>((c - c_sink).norm_squared())};
+                    if (dist2 < dist2_any) {
+                        dist2_any = dist2;
+                        c_any = c;
                     }
-                }
-            }
-            T h_sink {dem_data[to_raster_index(c_sink, nx)]};
-            bool found {false};
-            for (const auto &c: connected_cells) {
-                T h {dem_data[to_raster_index(c.second, nx)]};
-                if (h < h_sink) {
-                    c_src = c.second;
-                    found = true;
-                    break;
-                }
-            }
-            if (!found) {
-                c_src = connected_cells.begin()->second;
-            }
+                    if (dem_data[to_raster_index(c, nx)] < h_sink &&
+                        (!found_lower || dist2 < dist2_lower)) {
+                        dist2_lower = dist2;
+                        c_lower = c;
+                        found_lower = true;
+                    }
+                    return true;
+                });
+            c_src = found_lower ? c_lower : c_any;
         }
         if (c_src.col() > nx || c_src.row() > ny) {
-            logging::pErr() << "c_src out of the area.";
+            report_error("c_src out of the area.");
             return return_fail;
         }
 
@@ -641,18 +889,18 @@ std::pair<Culvert<X>, bool> InsertCulvertAlgorithm::insert_culvert_along_flow_ro
         if (encountered_ids.size() == 1) {
             id = *(encountered_ids.begin());
         }
-        return {{delta_dem.to_geocoordinate(c_sink),
-                 delta_dem.to_geocoordinate(c_src),
+        return {{coordinates::to_raster_index(c_sink, delta_dem.px_width()),
+                 coordinates::to_raster_index(c_src, delta_dem.px_width()),
                  id},
                 true};
     } catch (std::runtime_error & e) {
-        logging::pErr() << e.what();
+        report_error(e.what());
         return return_fail;
     }
 }
 
 template<typename T, typename U, typename C>
-std::multimap<T, std::tuple<C, C, double>> InsertCulvertAlgorithm::find_expensive_carvings(
+std::vector<std::pair<T, std::tuple<C, C, double>>> InsertCulvertAlgorithm::find_expensive_carvings(
     const CellGrid<T, C> & dem_orig,
     const CellGrid<T, C> & dem_carved,
     const CellGrid<U, C> & flowdirs,
@@ -660,139 +908,121 @@ std::multimap<T, std::tuple<C, C, double>> InsertCulvertAlgorithm::find_expensiv
     double min_hdiff,
     double min_culvert_length)
 {
-    std::multimap<T, std::tuple<C, C, double>> ret;
-    auto tmp = find_expensive_carvings_(
-        dem_orig,
-        dem_carved,
-        flowdirs,
-        min_cost,
-        min_hdiff,
-        min_culvert_length);
-    ret.insert(tmp.begin(), tmp.end());
-    return ret;
-}
-
-template<typename T, typename U, typename C>
-std::multimap<T, C> InsertCulvertAlgorithm::find_expensive_carvings_upstream_points(
-    const CellGrid<T, C> & dem_carved,
-    const T * diff,
-    const CellGrid<U, C> & flowdirs)
-{
-    // FIXME it would be easier to store the backtrack calls from the
-    // carving and check which pits to include/exclude.
     using ct = typename C::datatype;
-    ct nx {static_cast<ct>(dem_carved.px_width())};
-    ct ny {static_cast<ct>(dem_carved.px_height())};
+    struct Carving {
+        T cost;
+        T pit_h;
+        size_t scan_ind;
+        C upstream;
+        C downstream;
+        double max_hdiff;
+    };
+    static const int di[8] {-1, 0, 1, -1, 1, -1, 0, 1};
+    static const int dj[8] {-1, -1, -1, 0, 0, 1, 1, 1};
 
-    // The points where the carving starts (i.e. upstream end of the carved path)
-    std::multimap<T, C> upstream_points;
-    for (ct j = 0; j < ny; ++j)
+    ct nx {static_cast<ct>(dem_orig.px_width())};
+    ct ny {static_cast<ct>(dem_orig.px_height())};
+    const T * orig {dem_orig.data()};
+    const T * carved {dem_carved.data()};
+    const U * fds {flowdirs.data()};
+    auto diff = [orig, carved](size_t ind) { return orig[ind] - carved[ind]; };
+    auto flows_to = [fds](size_t i_n, ct i, ct j, const C & c) {
+        U fd {fds[i_n]};
+        return static_cast<int>(i) + fd.x == static_cast<int>(c.col()) &&
+            static_cast<int>(j) + fd.y == static_cast<int>(c.row());
+    };
+
+    std::vector<std::vector<Carving>> found(ny);
+    parallel::for_blocks(ny, [&](size_t j_begin, size_t j_end)
     {
-        for (ct i = 0; i < nx; ++i)
-        {
-            C c_tmp {i, j};
-            if (system_utils::compare_exact(
-                diff[to_raster_index(c_tmp, nx)], static_cast<T>(0)))
-                continue;
-            C upstream {i, j};
-
-            bool skip {false};
-            // check if the cell is a starting point of a carving (i.e. if
-            // the cell was previously a spurious pit). The cell must be
-            // carved and it must not have a carved neighbour that flows
-            // back to this cell.
-            for (const C & cn: d8_neighbors(upstream, nx, ny)) {
-                if (diff[to_raster_index(cn, nx)] > 0) {
-                    U fd {flowdirs.data()[to_raster_index(cn, nx)]};
-                    if (move_coord(cn, {fd.x, fd.y}, nx, ny) == upstream) {
-                        skip = true;
-                        break;
-                    }
+        std::vector<Carving> & block_found {found[j_begin]};
+        for (ct j = static_cast<ct>(j_begin); j < j_end; ++j) {
+            for (ct i = 0; i < nx; ++i) {
+                size_t ind {coordinates::to_raster_index(i, j, nx)};
+                if (system_utils::compare_exact(diff(ind), static_cast<T>(0)))
+                    continue;
+                C c_carved {i, j};
+
+                // Check if the cell is a starting point of a carving (i.e.
+                // if the cell was previously a spurious pit). The cell must
+                // not have a carved neighbour that flows back to this cell.
+                bool skip {false};
+                for (int n = 0; n < 8 && !skip; ++n) {
+                    if ((di[n] < 0 && i == 0) || (dj[n] < 0 && j == 0) ||
+                        (di[n] > 0 && i + 1 >= nx) || (dj[n] > 0 && j + 1 >= ny))
+                        continue;
+                    ct i_ {static_cast<ct>(static_cast<int>(i) + di[n])};
+                    ct j_ {static_cast<ct>(static_cast<int>(j) + dj[n])};
+                    size_t i_n {coordinates::to_raster_index(i_, j_, nx)};
+                    skip = diff(i_n) > 0 && flows_to(i_n, i_, j_, c_carved);
                 }
-                if (skip) break;
-            }
-            if (skip) continue;
-
-            // do not add the found cells, but one cell upstream so that
-            // the actual pit cell is added.
-            bool added {false};
-            for (const C & cn: d8_neighbors(upstream, nx, ny)) {
-                if (added) break;
-                auto i_n = to_raster_index(cn, nx);
-                U fd {flowdirs.data()[i_n]};
-                if (system_utils::compare_exact(diff[i_n], static_cast<T>(0)) &&
-                    system_utils::compare_exact(
-                            dem_carved.data()[i_n],
-                            dem_carved.data()[to_raster_index(upstream, nx)]) &&
-                    move_coord(cn, {fd.x, fd.y}, nx, ny) == upstream)
-                {
-                    upstream_points.insert(
-                        {dem_carved.data()[i_n], cn});
-                    added = true;
+                if (skip) continue;
+
+                // The carving starts from the non-carved neighbour at the
+                // same height that flows to the cell, i.e. the pit cell.
+                for (int n = 0; n < 8; ++n) {
+                    if ((di[n] < 0 && i == 0) || (dj[n] < 0 && j == 0) ||
+                        (di[n] > 0 && i + 1 >= nx) || (dj[n] > 0 && j + 1 >= ny))
+                        continue;
+                    ct i_ {static_cast<ct>(static_cast<int>(i) + di[n])};
+                    ct j_ {static_cast<ct>(static_cast<int>(j) + dj[n])};
+                    size_t i_n {coordinates::to_raster_index(i_, j_, nx)};
+                    if (!system_utils::compare_exact(diff(i_n), static_cast<T>(0)) ||
+                        !system_utils::compare_exact(carved[i_n], carved[ind]) ||
+                        !flows_to(i_n, i_, j_, c_carved))
+                        continue;
+
+                    // Follow the carving downstream until a non-carved
+                    // cell is found to determine the cost of the carving.
+                    C upstream {i_, j_};
+                    C downstream {upstream};
+                    T cost {diff(i_n)};
+                    T hmax {orig[i_n]};
+                    double dist {0};
+                    while (true) {
+                        U fd {fds[to_raster_index(downstream, nx)]};
+                        auto tmp = move_coord(downstream, {fd.x, fd.y}, nx, ny);
+                        if (tmp == downstream) break;
+                        T cost_ {diff(to_raster_index(tmp, nx))};
+                        if (system_utils::compare_exact(cost_, static_cast<T>(0))) break;
+                        cost += cost_;
+                        dist += (downstream - tmp).norm();
+                        downstream = tmp;
+                        hmax = std::max(hmax, orig[to_raster_index(downstream, nx)]);
+                    }
+                    T h {orig[to_raster_index(downstream, nx)]};
+                    double max_hdiff {static_cast<double>(hmax - h)};
+                    if (max_hdiff >= min_hdiff &&
+                        dist >= min_culvert_length &&
+                        static_cast<double>(cost) >= min_cost) {
+                        block_found.push_back({cost, carved[i_n], ind,
+                            upstream, downstream, max_hdiff});
+                    }
                     break;
                 }
             }
         }
-    }
-    return upstream_points;
-}
+    }, 16);
 
-template<typename T, typename U, typename C>
-std::multimap<T, std::tuple<C, C, double>> InsertCulvertAlgorithm::find_expensive_carvings_(
-    const CellGrid<T, C> & dem_orig,
-    const CellGrid<T, C> & dem_carved,
-    const CellGrid<U, C> & flowdirs,
-    double min_cost,
-    double min_hdiff,
-    double min_culvert_length)
-{
-    using ct = typename C::datatype;
-    std::multimap<T, std::tuple<C, C, double>> ret;
-
-    ct nx {static_cast<ct>(dem_orig.px_width())};
-    ct ny {static_cast<ct>(dem_orig.px_height())};
-    std::unique_ptr<T> diff_ptr {new T[dem_orig.px_size()]};
-    T * diff {diff_ptr.get()};
-    for (size_t i = 0; i < dem_orig.px_size(); ++i)
-    {
-        diff[i] = dem_orig.data()[i] - dem_carved.data()[i];
+    std::vector<Carving> carvings;
+    for (auto & f: found) {
+        carvings.insert(carvings.end(), f.begin(), f.end());
+        std::vector<Carving>().swap(f);
     }
-
-    // The points where the carving starts (i.e. upstream end of the
-    // carved path)
-    std::multimap<T, C> upstream_points = find_expensive_carvings_upstream_points(
-        dem_carved, diff, flowdirs);
-
-    for (auto it = upstream_points.begin(); it != upstream_points.end(); ++it)
-    {
-        // The cell upstream is a starting point of a carving. Follow it
-        // downstream until a non-carved cell is found to determine the
-        // cost of the carving.
-        C upstream {it->second};
-        C downstream {upstream};
-        T cost {diff[to_raster_index(upstream, nx)]};
-        T hmax {dem_orig.data()[to_raster_index(upstream, nx)]};
-        double dist {0};
-        while (true) {
-            U fd {flowdirs.data()[to_raster_index(downstream, nx)]};
-            auto tmp = move_coord(downstream, {fd.x, fd.y}, nx, ny);
-            if (tmp == downstream) break;
-            T cost_ {diff[dem_orig.to_raster_index(tmp)]};
-            if (system_utils::compare_exact(cost_, static_cast<T>(0))) break;
-            cost += cost_;
-            dist += (downstream - tmp).norm();
-            downstream = tmp;
-            hmax = std::max(hmax, dem_orig.data()[
-                to_raster_index(downstream, nx)]);
-        }
-        size_t ind = to_raster_index(downstream, nx);
-        T h {dem_orig.data()[ind]};
-        double max_hdiff {static_cast<double>(hmax - h)};
-        if (static_cast<double>(hmax - h) >= min_hdiff &&
-            dist >= min_culvert_length &&
-            static_cast<double>(cost) >= min_cost) {
-            ret.insert({cost, std::make_tuple(upstream, downstream, max_hdiff)});
-        }
+    std::sort(carvings.begin(), carvings.end(),
+        [](const Carving & a, const Carving & b) {
+            if (a.cost < b.cost) return true;
+            if (b.cost < a.cost) return false;
+            if (a.pit_h < b.pit_h) return true;
+            if (b.pit_h < a.pit_h) return false;
+            return a.scan_ind < b.scan_ind;
+        });
+
+    std::vector<std::pair<T, std::tuple<C, C, double>>> ret;
+    ret.reserve(carvings.size());
+    for (const auto & c: carvings) {
+        ret.push_back({c.cost,
+            std::make_tuple(c.upstream, c.downstream, c.max_hdiff)});
     }
     return ret;
 }
@@ -804,6 +1034,7 @@ template<typename T, typename U, typename C>
 std::pair<C, bool> InsertCulvertAlgorithm::find_alternative_carving_near_roads(
     const CellGrid<T, C> & dem,
     const CellGrid<U, C> & roads,
+    const CellGrid<U, C> & road_sides,
     const geo::RasterArea & insert_area,
     const C & start, // the upstream end of the carving
     T orig_cost,
@@ -820,7 +1051,9 @@ std::pair<C, bool> InsertCulvertAlgorithm::find_alternative_carving_near_roads(
 
     unsigned int r2 {max_radius * max_radius};
     if (roads.data()[to_raster_index(start, nx)] == 1) {
-        logging::pErr() << "find_alternative_carving_near_roads " << start << " " << dem.to_geocoordinate(start);
+        std::ostringstream msg;
+        msg << "find_alternative_carving_near_roads " << start << " " << dem.to_geocoordinate(start);
+        report_error(msg.str());
         return {start, false};
     }
     if (!insert_area.contains_point(dem.to_geocoordinate(start))) {
@@ -854,7 +1087,7 @@ std::pair<C, bool> InsertCulvertAlgorithm::find_alternative_carving_near_roads(
     std::multimap<T, C> queue;
     queue.insert({0.0, start});
     cost_[to_raster_index(start_, nx_)] = 0.0;
-    std::set<C> potential_cells;
+    std::vector<C> potential_cells;
 
     const T out_val {static_cast<T>(99999.0)};
     const T real_edge_val {static_cast<T>(99997.0)};
@@ -889,19 +1122,35 @@ std::pair<C, bool> InsertCulvertAlgorithm::find_alternative_carving_near_roads(
                     cost_[indn_] = new_cost;
                     queue.insert({new_cost, cn});
                     if (hn < h) {
-                        potential_cells.insert(cn);
+                        potential_cells.push_back(cn);
                     }
                 }
             }
         }
     }
+    std::sort(potential_cells.begin(), potential_cells.end());
+    potential_cells.erase(
+        std::unique(potential_cells.begin(), potential_cells.end()),
+        potential_cells.end());
+
+    // The same non-zero side label means the same side of the road, so
+    // those cells can not be sources. A different label does not prove a
+    // road in between: a side can be split by the cut-outs around a road
+    // end, and the buffers of different roads have different labels. The
+    // other cells go through the staircase test of crosses_road.
+    const U * sides_data {road_sides.data()};
+    const U start_side {sides_data[to_raster_index(start, nx)]};
     // Pick all the sources s_i for which the line (s_i, start) crosses a
     // road.
     // FIXME the source is selected even if the line simply touches a road
     // without crossing it
     std::vector<std::pair<C, double>> proper_sources;
     for (const auto &c: potential_cells) {
-        if (crosses_road(roads, start, c)) {
+        const U side {sides_data[to_raster_index(c, nx)]};
+        const bool same_side {start_side != static_cast<U>(0) &&
+            side == start_side};
+        const bool across {!same_side && crosses_road(roads, start, c)};
+        if (across) {
             C c_ {to_window_c(c)};
             proper_sources.push_back({c, (start - c).norm_squared()});
             cost_[to_raster_index(c_, nx_)] = real_edge_val;
@@ -954,37 +1203,30 @@ void InsertCulvertAlgorithm::extend_roads_with_buffer_region(
     double width)
 {
     if (width <= 0) return;
-    unsigned int uwidth {static_cast<unsigned int>(std::ceil(width))};
-    int iwidth {static_cast<int>(uwidth)};
-    for (unsigned int j = 0; j < ny; ++j)
-    {
-        unsigned int jj_min {static_cast<unsigned int>(
-            std::max(0, static_cast<int>(j) - iwidth))};
-        unsigned int jj_max {static_cast<unsigned int>(
-            std::min(static_cast<int>(ny), static_cast<int>(j) + iwidth + 1))};
-        for (unsigned int i = 0; i < nx; ++i)
+    // A cell belongs to the buffer if its squared distance to the closest
+    // road cell is at most width^2. The distances are integers, so the
+    // limit can be rounded down.
+    double max_d2_ {std::floor(width * width)};
+    std::uint32_t max_d2 {max_d2_ < static_cast<double>(distance_transform::infinity) ?
+        static_cast<std::uint32_t>(max_d2_) : distance_transform::infinity - 1};
+    std::vector<std::uint32_t> d2;
+    distance_transform::squared_edt(
+        [road_data, road_value](size_t ind) {
+            return road_data[ind] == road_value;
+        },
+        nx, ny, max_d2, d2);
+
+    parallel::for_blocks(static_cast<size_t>(nx) * ny,
+        [&](size_t begin, size_t end)
         {
-            unsigned int ii_min {static_cast<unsigned int>(
-                std::max(0, static_cast<int>(i) - iwidth))};
-            unsigned int ii_max {static_cast<unsigned int>(
-                std::min(static_cast<int>(nx), static_cast<int>(i) + iwidth + 1))};
-            if (road_data[to_raster_index(C {i, j}, nx)] == road_value)
-            {
-                for (unsigned int jj = jj_min; jj < jj_max; ++jj) {
-                    for (unsigned int ii = ii_min; ii < ii_max; ++ii) {
-                        if ((pow(static_cast<int>(ii) - static_cast<int>(i), 2) + pow(static_cast<int>(jj) - static_cast<int>(j), 2)) <= (width * width))
-                        {
-                            auto ind = to_raster_index(C {ii, jj}, nx);
-                            if (road_data[ind] != road_value)
-                            {
-                                road_data[ind] = buffer_value;
-                            }
-                        }
-                    }
+            for (size_t ind = begin; ind < end; ++ind) {
+                if (d2[ind] != distance_transform::infinity &&
+                    road_data[ind] != road_value)
+                {
+                    road_data[ind] = buffer_value;
                 }
             }
-        }
-    }
+        });
 }
 
 #endif
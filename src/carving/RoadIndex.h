@@ -0,0 +1,148 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef ROAD_INDEX_H_
+#define ROAD_INDEX_H_
+
+#include <algorithm>
+#include <vector>
+
+#include "CellGrid.h"
+#include "parallel.h"
+
+/**
+ * \brief The cells of the road raster, listed as raster indices.
+ *
+ * The roads cover only a small part of the raster, so the road related
+ * scans iterate over the index instead of the whole raster. The index is
+ * built once after the road buffer has been added
+ * (InsertCulvertAlgorithm::extend_roads_with_buffer_region), and the buffer
+ * cells are grouped by the segment ids after the buffer areas have got
+ * their ids (InsertCulvertAlgorithm::fill_areas_with_unique_id).
+ *
+ * All the lists are in the row-major order.
+ */
+class RoadIndex
+{
+    public:
+        /**
+         * \brief List the road cells (road_value) and the buffer cells (the
+         * other non-zero values) of the road raster.
+         */
+        template<typename T, typename C>
+        void build(const CellGrid<T, C> & roads, T road_value);
+
+        /**
+         * \brief Group the buffer cells by their ids, starting from
+         * first_id. The cells whose value is smaller than first_id do not
+         * belong to any segment.
+         */
+        template<typename T, typename C>
+        void index_segments(const CellGrid<T, C> & roads, T first_id);
+
+        const std::vector<size_t> & road_cells() const { return road_cells_; }
+        const std::vector<size_t> & buffer_cells() const { return buffer_cells_; }
+
+        size_t n_segments() const { return segment_offsets_.size() - 1; }
+
+        /**
+         * \brief The positions (in buffer_cells()) of the cells of the
+         * segment s, i.e. the segment with the id first_id + s.
+         */
+        const size_t * segment_begin(size_t s) const
+        {
+            return segment_cells_.data() + segment_offsets_[s];
+        }
+
+        const size_t * segment_end(size_t s) const
+        {
+            return segment_cells_.data() + segment_offsets_[s + 1];
+        }
+
+    private:
+        std::vector<size_t> road_cells_;
+        std::vector<size_t> buffer_cells_;
+        std::vector<size_t> segment_offsets_ {0};
+        std::vector<size_t> segment_cells_;
+};
+
+
+/* implementation */
+
+template<typename T, typename C>
+void RoadIndex::build(const CellGrid<T, C> & roads, T road_value)
+{
+    const T * data {roads.data()};
+    size_t n {roads.px_size()};
+
+    // Each block lists its own cells, and the lists are then concatenated
+    // in the block order.
+    size_t n_blocks {std::max(static_cast<size_t>(1),
+        static_cast<size_t>(parallel::n_threads()))};
+    std::vector<std::vector<size_t>> road_blocks(n_blocks);
+    std::vector<std::vector<size_t>> buffer_blocks(n_blocks);
+    parallel::for_blocks(n_blocks, [&](size_t b_begin, size_t b_end)
+    {
+        for (size_t b = b_begin; b < b_end; ++b) {
+            for (size_t ind = (n * b) / n_blocks;
+                 ind < (n * (b + 1)) / n_blocks; ++ind)
+            {
+                if (data[ind] == road_value) {
+                    road_blocks[b].push_back(ind);
+                } else if (data[ind] != static_cast<T>(0)) {
+                    buffer_blocks[b].push_back(ind);
+                }
+            }
+        }
+    });
+
+    road_cells_.clear();
+    buffer_cells_.clear();
+    for (size_t b = 0; b < n_blocks; ++b) {
+        road_cells_.insert(road_cells_.end(),
+            road_blocks[b].begin(), road_blocks[b].end());
+        buffer_cells_.insert(buffer_cells_.end(),
+            buffer_blocks[b].begin(), buffer_blocks[b].end());
+    }
+    segment_offsets_.assign(1, 0);
+    segment_cells_.clear();
+}
+
+template<typename T, typename C>
+void RoadIndex::index_segments(const CellGrid<T, C> & roads, T first_id)
+{
+    const T * data {roads.data()};
+
+    // A counting sort by the segment id keeps the row-major order inside
+    // the segments.
+    size_t n_segs {0};
+    for (size_t ind: buffer_cells_) {
+        if (data[ind] >= first_id) {
+            n_segs = std::max(n_segs,
+                static_cast<size_t>(data[ind] - first_id) + 1);
+        }
+    }
+    segment_offsets_.assign(n_segs + 1, 0);
+    for (size_t ind: buffer_cells_) {
+        if (data[ind] >= first_id) ++segment_offsets_[data[ind] - first_id + 1];
+    }
+    for (size_t s = 0; s < n_segs; ++s) {
+        segment_offsets_[s + 1] += segment_offsets_[s];
+    }
+    segment_cells_.resize(segment_offsets_.back());
+    std::vector<size_t> next(segment_offsets_.begin(), segment_offsets_.end() - 1);
+    for (size_t k = 0; k < buffer_cells_.size(); ++k) {
+        T v {data[buffer_cells_[k]]};
+        if (v >= first_id) segment_cells_[next[v - first_id]++] = k;
+    }
+}
+
+#endif
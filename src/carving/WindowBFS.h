@@ -0,0 +1,125 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef WINDOW_BFS_H_
+#define WINDOW_BFS_H_
+
+#include <vector>
+
+/**
+ * \brief A breadth first search restricted to a rectangular window of the
+ * raster.
+ *
+ * The visited cells are kept in a window-local bitmap and the frontier in
+ * a flat buffer of window indices. Every cell is queued at most once, so
+ * the buffer never wraps. Both are kept between the searches, so a
+ * search does not allocate once the buffers are large enough.
+ */
+class WindowBFS
+{
+    public:
+        /**
+         * \brief Set the window to the rectangle [min_c, max_c] (inclusive)
+         * and clear the visited cells.
+         */
+        template<typename C>
+        void reset(const C & min_c, const C & max_c);
+
+        /**
+         * \brief Run the search from the cell start, which must be inside the
+         * window.
+         *
+         * The neighbours of a cell are handled in the order of
+         * coordinates::get_neig_circular. An unvisited neighbour cn of the
+         * cell c is marked visited and queued if accept(c, cn) returns true.
+         * The cells are passed to process(c) in the order they are taken
+         * from the queue, and the search stops if it returns false.
+         *
+         * \return False if some neighbour outside the window was accepted.
+         * Such neighbours are not queued.
+         */
+        template<typename C, typename A, typename P>
+        bool run(
+            const C & start,
+            typename C::datatype nx,
+            typename C::datatype ny,
+            A accept,
+            P process);
+
+    private:
+        size_t i0_ {0};
+        size_t j0_ {0};
+        size_t wnx_ {0};
+        size_t wny_ {0};
+        std::vector<char> visited_;
+        std::vector<size_t> queue_;
+};
+
+
+/* implementation */
+
+template<typename C>
+void WindowBFS::reset(const C & min_c, const C & max_c)
+{
+    i0_ = min_c.col();
+    j0_ = min_c.row();
+    wnx_ = static_cast<size_t>(max_c.col() - min_c.col()) + 1;
+    wny_ = static_cast<size_t>(max_c.row() - min_c.row()) + 1;
+    visited_.assign(wnx_ * wny_, 0);
+}
+
+template<typename C, typename A, typename P>
+bool WindowBFS::run(
+    const C & start,
+    typename C::datatype nx,
+    typename C::datatype ny,
+    A accept,
+    P process)
+{
+    using ct = typename C::datatype;
+    static const int di[8] {-1, 0, 1, -1, 1, -1, 0, 1};
+    static const int dj[8] {-1, -1, -1, 0, 0, 1, 1, 1};
+
+    bool inside {true};
+    queue_.clear();
+    size_t ind_start {(start.row() - j0_) * wnx_ + (start.col() - i0_)};
+    visited_[ind_start] = 1;
+    queue_.push_back(ind_start);
+    for (size_t head = 0; head < queue_.size(); ++head) {
+        size_t i_ {queue_[head] % wnx_};
+        size_t j_ {queue_[head] / wnx_};
+        C c {static_cast<ct>(i0_ + i_), static_cast<ct>(j0_ + j_)};
+        if (!process(c)) break;
+        for (int n = 0; n < 8; ++n) {
+            if ((di[n] < 0 && c.col() == 0) || (dj[n] < 0 && c.row() == 0) ||
+                (di[n] > 0 && c.col() + 1 >= nx) ||
+                (dj[n] > 0 && c.row() + 1 >= ny))
+                continue;
+            C cn {static_cast<ct>(static_cast<int>(c.col()) + di[n]),
+                  static_cast<ct>(static_cast<int>(c.row()) + dj[n])};
+            if (cn.col() < i0_ || cn.row() < j0_ ||
+                cn.col() >= i0_ + wnx_ || cn.row() >= j0_ + wny_)
+            {
+                if (inside && accept(c, cn)) inside = false;
+                continue;
+            }
+            size_t indn {(cn.row() - j0_) * wnx_ + (cn.col() - i0_)};
+            if (visited_[indn]) continue;
+            if (accept(c, cn)) {
+                visited_[indn] = 1;
+                queue_.push_back(indn);
+            }
+        }
+    }
+    return inside;
+}
+
+#endif
@@ -95,17 +95,26 @@ std::list<std::pair<C, T>> find_minima(
     return minima;
 }
 
+/**
+ * \brief Carve the path from the pit c along the flow directions down to the
+ * elevation of the pit. The carved cells are marked written in both grids.
+ *
+ * \return The sum of the lowerings of the cells.
+ */
 template<typename T, typename U, typename V, typename C>
-void backtrack(
+double backtrack(
     C c,
-    T* dem_data,
+    CellGrid<T, C> & dem,
     const U* fd_data,
-    V* carved_data,
-    typename C::datatype wpad,
-    typename C::datatype hpad)
+    CellGrid<V, C> & carved)
 {
+    auto wpad = dem.px_width();
+    auto hpad = dem.px_height();
+    T * dem_data {dem.data()};
+    V * carved_data {carved.data()};
     auto ind = coordinates::to_raster_index(c, wpad);
     T h {dem_data[ind]};
+    double cost {0.0};
     while (true) {
         const U &f = fd_data[ind];
         C cn = coordinates::move_coord(c, {f.x, f.y}, wpad, hpad);
@@ -113,16 +122,28 @@ void backtrack(
         c = cn;
         ind = coordinates::to_raster_index(c, wpad);
         if (dem_data[ind] <= h) break;
+        cost += static_cast<double>(dem_data[ind] - h);
         dem_data[ind] = h;
         carved_data[ind] = true;
+        dem.mark_written(ind);
+        carved.mark_written(ind);
     }
+    return cost;
 }
 
+/**
+ * \brief The order of the carving queue, the lowest cell first. With
+ * by_position, the cells of the same height are taken in the row-major
+ * order instead of the order of the heap.
+ */
 template<typename T>
 struct compare_pq
 {
+    bool by_position {false};
+
     bool operator()(const T &a, const T &b)
     {
+        if (by_position && a.first == b.first) return b.second < a.second;
         return a.first > b.first;
     }
 };
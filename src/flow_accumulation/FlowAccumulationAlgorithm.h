@@ -28,11 +28,20 @@ class FlowAccumulationAlgorithm: public AbstractAlgorithm
             const CellGrid<T, C> & flowdir,
             CellGrid<U, C> & accum);
 
+        /**
+         * \brief Take the scratch grid of the accumulation from the pool
+         * instead of allocating it on each call.
+         */
+        void scratch_pool(GridPool * pool) { scratch_pool_ = pool; }
+
     protected:
         void perform_flow_accumulation(
             const CellGrid<T, C> & flowdir,
             CellGrid<U, C> & accum,
             CellGrid<char, C> & n_neighs);
+
+    private:
+        GridPool * scratch_pool_ {nullptr};
 };
 
 
@@ -70,9 +79,12 @@ void FlowAccumulationAlgorithm<T, U, C>::execute(
 
     accumulated.format(1);
 
+    // without a pool of the caller, the array is freed with the local one
+    GridPool local_pool;
     CellGrid<char, C> n_neighbours {
         flowdirs,
-        "flow_accum_n_neighs" };
+        "flow_accum_n_neighs",
+        scratch_pool_ != nullptr ? *scratch_pool_ : local_pool };
 
     perform_flow_accumulation(
         flowdirs,
@@ -107,34 +119,36 @@ void FlowAccumulationAlgorithm<T, U, C>::perform_flow_accumulation(
             n_neighs_data[ind] = static_cast<char>(static_cast<int>(n_neighs_data[ind]) + 1);
         }
     }
-    std::list<C> process_next;
+    // The cells without upstream neighbours start walks downstream. A walk
+    // passes the accumulation of a cell to the next one, and continues
+    // from it when all its upstream neighbours are done, so no queue of
+    // the cells is kept. The cells done are marked with -1.
+    size_t n_cells {flowdir.px_size()};
+    size_t counter {0};
+    size_t print_counter {0};
     for (ct j = 0; j < ny; ++j) {
         for (ct i = 0; i < nx; ++i) {
             C c {i, j};
-            if (n_neighs_data[coordinates::to_raster_index(c, nx)] == 0) {
-                process_next.push_back(c);
+            if (n_neighs_data[coordinates::to_raster_index(c, nx)] != 0) {
+                continue;
+            }
+            while (true) {
+                ++counter;
+                if (static_cast<size_t>(std::floor((counter * 10)/ n_cells)) > print_counter)
+                {
+                    logging::pLog() << "processed " << (10 * ++print_counter) << " %";
+                }
+                auto ind_c = coordinates::to_raster_index(c, nx);
+                n_neighs_data[ind_c] = static_cast<char>(-1);
+                const T &fd {flowdir_data[ind_c]};
+                C cn {coordinates::move_coord(c, {fd.x, fd.y}, nx, ny)};
+                if (c == cn) break;
+                auto ind = coordinates::to_raster_index(cn, nx);
+                acc_data[ind] += acc_data[ind_c];
+                n_neighs_data[ind] = static_cast<char>(static_cast<int>(n_neighs_data[ind] - 1));
+                if (n_neighs_data[ind] != 0) break;
+                c = cn;
             }
-        }
-    }
-    size_t n_cells {flowdir.px_size()};
-    size_t counter {0};
-    size_t print_counter {0};
-    while (process_next.size() > 0) {
-        C c {process_next.front()};
-        process_next.pop_front();
-        ++counter;
-        const T &fd {flowdir_data[coordinates::to_raster_index(c, nx)]};
-        C cn {coordinates::move_coord(c, {fd.x, fd.y}, nx, ny)};
-        if (c == cn) continue;
-        auto ind = coordinates::to_raster_index(cn, nx);
-        acc_data[ind] += acc_data[coordinates::to_raster_index(c, nx)];
-        n_neighs_data[ind] = static_cast<char>(static_cast<int>(n_neighs_data[ind] - 1));
-        if (n_neighs_data[ind] == 0) {
-            process_next.push_back(cn);
-        }
-        if (static_cast<size_t>(std::floor((counter * 10)/ n_cells)) > print_counter)
-        {
-            logging::pLog() << "processed " << (10 * ++print_counter) << " %";
         }
     }
     logging::pLog() << "processed 100 %";
@@ -0,0 +1,232 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef DRAINAGE_BASINS_H_
+#define DRAINAGE_BASINS_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "CellGrid.h"
+#include "parallel.h"
+
+/**
+ * \brief Drainage basins of a D8 flow direction raster.
+ */
+namespace drainage_basins {
+
+    /**
+     * \brief Label each cell with the raster index of its outlet, i.e. the
+     * cell reached by following the flow directions until they point out
+     * of the raster or to the cell itself.
+     *
+     * The labels are resolved by pointer jumping: in each parallel round,
+     * every cell takes the downstream pointer of its downstream cell, so
+     * the labels propagate from the outlets upstream and a flow path of
+     * length L is resolved in log2(L) rounds. The pointers are replaced in
+     * place, 4 bytes per cell. A pointer read while another thread
+     * replaces it is still a cell downstream, so the rounds only get
+     * shorter.
+     *
+     * The raster must have fewer cells than the labels can index.
+     */
+    template<typename V, typename C>
+    void label_outlets(
+        const CellGrid<V, C> & flowdirs,
+        std::vector<std::atomic<std::uint32_t>> & outlets);
+
+    /**
+     * \brief Group the items by the basins of their cells.
+     *
+     * \param cells The raster index of each item.
+     * \return The positions of the items in each basin, the items in the
+     * same order as in \a cells. The largest groups come first.
+     */
+    std::vector<std::vector<size_t>> group_by_basin(
+        const std::vector<std::atomic<std::uint32_t>> & outlets,
+        const std::vector<size_t> & cells);
+
+    /**
+     * \brief Group the cells (raster indices) by their basins, as
+     * group_by_basin() after label_outlets().
+     *
+     * The flow path of each cell is followed to its outlet, which needs no
+     * memory per raster cell. Only if the paths together are longer than
+     * the raster has cells, the whole raster is labelled instead. A raster
+     * with more cells than the labels can index is then not labelled, and
+     * all the cells are returned as a single group.
+     */
+    template<typename V, typename C>
+    std::vector<std::vector<size_t>> group_cells_by_basin(
+        const CellGrid<V, C> & flowdirs,
+        const std::vector<size_t> & cells);
+
+    /* implementation */
+
+    namespace detail {
+
+        /* the cell the flow direction of cell ind points to, or ind if
+         * it points out of the raster */
+        template<typename V>
+        size_t downstream(const V * fd, size_t nx, size_t ny, size_t ind)
+        {
+            long i {static_cast<long>(ind % nx) + fd[ind].x};
+            long j {static_cast<long>(ind / nx) + fd[ind].y};
+            if (i < 0 || j < 0 ||
+                i >= static_cast<long>(nx) || j >= static_cast<long>(ny))
+            {
+                return ind;
+            }
+            return static_cast<size_t>(j) * nx + static_cast<size_t>(i);
+        }
+
+        /* the positions of the (basin, position) pairs grouped by basin,
+         * the largest groups first */
+        inline std::vector<std::vector<size_t>> group_keyed(
+            std::vector<std::pair<size_t, size_t>> & keyed)
+        {
+            std::sort(keyed.begin(), keyed.end());
+
+            std::vector<std::vector<size_t>> groups;
+            for (size_t k = 0; k < keyed.size(); ++k) {
+                if (k == 0 || keyed[k].first != keyed[k - 1].first) {
+                    groups.emplace_back();
+                }
+                groups.back().push_back(keyed[k].second);
+            }
+            std::stable_sort(groups.begin(), groups.end(),
+                [](const std::vector<size_t> & a, const std::vector<size_t> & b) {
+                    return a.size() > b.size();
+                });
+            return groups;
+        }
+
+    }
+
+    template<typename V, typename C>
+    void label_outlets(
+        const CellGrid<V, C> & flowdirs,
+        std::vector<std::atomic<std::uint32_t>> & outlets)
+    {
+        const V * fd {flowdirs.data()};
+        size_t nx {flowdirs.px_width()};
+        size_t ny {flowdirs.px_height()};
+        size_t n {nx * ny};
+        std::vector<std::atomic<std::uint32_t>>(n).swap(outlets);
+        parallel::for_blocks(n, [&](size_t begin, size_t end)
+        {
+            for (size_t ind = begin; ind < end; ++ind) {
+                outlets[ind].store(
+                    static_cast<std::uint32_t>(
+                        detail::downstream(fd, nx, ny, ind)),
+                    std::memory_order_relaxed);
+            }
+        });
+
+        // A cycle in the flow directions would never settle, so the number
+        // of rounds is bounded by the longest possible path.
+        for (size_t reach = 1; reach < n; reach *= 2) {
+            std::vector<char> changed(parallel::n_threads(), 0);
+            size_t n_blocks {changed.size()};
+            parallel::for_blocks(n_blocks, [&](size_t b_begin, size_t b_end)
+            {
+                for (size_t b = b_begin; b < b_end; ++b) {
+                    for (size_t ind = (n * b) / n_blocks;
+                         ind < (n * (b + 1)) / n_blocks; ++ind)
+                    {
+                        std::uint32_t o {outlets[ind].load(
+                            std::memory_order_relaxed)};
+                        std::uint32_t next {outlets[o].load(
+                            std::memory_order_relaxed)};
+                        if (next != o) {
+                            outlets[ind].store(next, std::memory_order_relaxed);
+                            changed[b] = 1;
+                        }
+                    }
+                }
+            });
+            if (std::find(changed.begin(), changed.end(), 1) == changed.end()) {
+                break;
+            }
+        }
+    }
+
+    inline std::vector<std::vector<size_t>> group_by_basin(
+        const std::vector<std::atomic<std::uint32_t>> & outlets,
+        const std::vector<size_t> & cells)
+    {
+        std::vector<std::pair<size_t, size_t>> keyed(cells.size());
+        for (size_t k = 0; k < cells.size(); ++k) {
+            keyed[k] = {outlets[cells[k]].load(std::memory_order_relaxed), k};
+        }
+        return detail::group_keyed(keyed);
+    }
+
+    template<typename V, typename C>
+    std::vector<std::vector<size_t>> group_cells_by_basin(
+        const CellGrid<V, C> & flowdirs,
+        const std::vector<size_t> & cells)
+    {
+        const V * fd {flowdirs.data()};
+        size_t nx {flowdirs.px_width()};
+        size_t ny {flowdirs.px_height()};
+        size_t n {flowdirs.px_size()};
+
+        // The steps are counted in batches. A cycle in the flow directions
+        // also exhausts the budget.
+        const size_t batch {1024};
+        std::atomic<size_t> steps {0};
+        std::atomic<bool> too_long {false};
+        std::vector<std::pair<size_t, size_t>> keyed(cells.size());
+        parallel::for_blocks(cells.size(), [&](size_t begin, size_t end)
+        {
+            size_t taken {0};
+            for (size_t k = begin; k < end; ++k) {
+                size_t ind {cells[k]};
+                for (size_t next = detail::downstream(fd, nx, ny, ind);
+                     next != ind;
+                     next = detail::downstream(fd, nx, ny, ind))
+                {
+                    ind = next;
+                    if (++taken == batch) {
+                        taken = 0;
+                        if (too_long.load(std::memory_order_relaxed) ||
+                            steps.fetch_add(batch) + batch > n)
+                        {
+                            too_long.store(true, std::memory_order_relaxed);
+                            return;
+                        }
+                    }
+                }
+                keyed[k] = {ind, k};
+            }
+        });
+        if (!too_long.load()) return detail::group_keyed(keyed);
+        std::vector<std::pair<size_t, size_t>>().swap(keyed);
+
+        if (n > std::numeric_limits<std::uint32_t>::max()) {
+            std::vector<std::vector<size_t>> groups(cells.empty() ? 0 : 1);
+            for (size_t k = 0; k < cells.size(); ++k) {
+                groups.front().push_back(k);
+            }
+            return groups;
+        }
+        std::vector<std::atomic<std::uint32_t>> outlets;
+        label_outlets(flowdirs, outlets);
+        return group_by_basin(outlets, cells);
+    }
+
+}
+
+#endif
@@ -18,9 +18,12 @@
 #include <cstdlib>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 #include <assert.h>
 
 #include "CellGridFrame.h"
+#include "DirtyTiles.h"
+#include "GridPool.h"
 #include "global_parameters.h"
 #include "system_utils.h"
 #include "logging.h"
@@ -49,6 +52,33 @@ public:
             const geo::RasterArea & area__,
             const std::string &name);
 
+    /**
+     * \brief Constructors taking the data array from \a pool. The array is
+     * given back to the pool when the grid is destroyed.
+     *
+     * If \a allocate is false, the array is taken only by allocate_data().
+     */
+    CellGrid(
+            const CellGridFrame &model,
+            const std::string &name,
+            GridPool & pool,
+            bool allocate = true);
+    CellGrid(
+            const geo::RasterArea & area__,
+            const std::string &name,
+            GridPool & pool,
+            bool allocate = true);
+
+    /**
+     * \brief A constructor viewing the caller's array of px_size() cells
+     * instead of allocating one. The array is never freed by the grid, so
+     * it must outlive the grid.
+     */
+    CellGrid(
+            const geo::RasterArea & area__,
+            const std::string &name,
+            T * view);
+
     virtual ~CellGrid();
 
     /**
@@ -64,6 +94,18 @@ public:
     bool is_allocated() const override;
     bool is_formatted() const;
 
+    /**
+     * \brief Allocate the array if it is not. The new array is zero
+     * (value-initialized) and all its tiles are marked written.
+     */
+    void allocate_data();
+
+    /**
+     * \brief Free the array. The memory is released at once, also when
+     * the grid was taken from a pool. A view keeps the caller's array.
+     */
+    void release_data();
+
     /**
      * \brief Set all the data values to \a val.
      *
@@ -75,6 +117,35 @@ public:
 
     void copy_data_from(const CellGrid<T, C> &);
 
+    /**
+     * \brief Start tracking the tiles written with format(),
+     * copy_data_from() and mark_written().
+     *
+     * The writes through data() are not seen, so the algorithms writing
+     * only a few cells call mark_written() for them.
+     */
+    void track_dirty_tiles(size_t tile_size);
+    const DirtyTiles & dirty_tiles() const;
+    void mark_written(size_t ind);
+
+    /**
+     * \brief Set the cells of the tiles written after the version \a since
+     * to \a val. Format the whole grid if the tiles are not tracked.
+     */
+    void format_written(T val, DirtyTiles::version_type since);
+
+    /**
+     * \brief Copy from \a other the cells of the tiles written after the
+     * version \a since, i.e. restore a working copy of \a other. Copy all
+     * the data if the tiles are not tracked.
+     *
+     * The grids must have been equal at the version \a since, and
+     * the special values are not copied.
+     */
+    void copy_written_from(
+        const CellGrid<T, C> & other,
+        DirtyTiles::version_type since);
+
     void no_data_value(value_type value);
     void unset_no_data_value();
     bool has_no_data_value() const;
@@ -92,6 +163,9 @@ private:
     std::map<std::string, value_type> special_values_;
     std::vector<T> data_;
     bool is_formatted_;
+    T * view_ {nullptr};
+    DirtyTiles dirty_tiles_;
+    GridPool * pool_ {nullptr};
 };
 
 
@@ -120,16 +194,54 @@ CellGrid<T, coord_type>::CellGrid(
 {
 }
 
+template<typename T, typename coord_type>
+CellGrid<T, coord_type>::CellGrid(
+        const geo::RasterArea & area__,
+        const std::string &name__,
+        GridPool & pool,
+        bool allocate):
+            CellGridFrame(area__, name__),
+            data_(allocate ? pool.acquire<T>(px_size()) : std::vector<T>()),
+            is_formatted_ {false},
+            pool_ {&pool}
+{
+}
+
+template<typename T, typename coord_type>
+CellGrid<T, coord_type>::CellGrid(
+        const CellGridFrame & model,
+        const std::string &name__,
+        GridPool & pool,
+        bool allocate):
+            CellGridFrame(model, name__),
+            data_(allocate ? pool.acquire<T>(px_size()) : std::vector<T>()),
+            is_formatted_ {false},
+            pool_ {&pool}
+{
+}
+
+template<typename T, typename coord_type>
+CellGrid<T, coord_type>::CellGrid(
+        const geo::RasterArea & area__,
+        const std::string &name__,
+        T * view):
+            CellGridFrame(area__, name__),
+            is_formatted_ {false},
+            view_ {view}
+{
+}
+
 template<typename T, typename coord_type>
 CellGrid<T, coord_type>::~CellGrid()
 {
+    if (pool_ != nullptr) pool_->release(data_);
 }
 
 
 template<typename T, typename coord_type>
 bool CellGrid<T, coord_type>::is_allocated() const
 {
-    return data_.size() > 0;
+    return view_ != nullptr || data_.size() > 0;
 }
 
 template<typename T, typename coord_type>
@@ -138,16 +250,36 @@ bool CellGrid<T, coord_type>::is_formatted() const
     return is_formatted_;
 }
 
+template<typename T, typename C>
+void CellGrid<T, C>::allocate_data()
+{
+    if (is_allocated()) return;
+    if (pool_ != nullptr) {
+        data_ = pool_->acquire<T>(px_size());
+    } else {
+        data_.assign(px_size(), T());
+    }
+    dirty_tiles_.mark_all();
+}
+
+template<typename T, typename C>
+void CellGrid<T, C>::release_data()
+{
+    if (view_ != nullptr) return;
+    std::vector<T>().swap(data_);
+    is_formatted_ = false;
+}
+
 template<typename T, typename coord_type>
 T* CellGrid<T, coord_type>::data()
 {
-    return data_.data();
+    return view_ != nullptr ? view_ : data_.data();
 }
 
 template<typename T, typename C>
 T const * CellGrid<T, C>::data() const
 {
-    return data_.data();
+    return view_ != nullptr ? view_ : data_.data();
 }
 
 template<typename T, typename C>
@@ -160,10 +292,9 @@ T CellGrid<T, C>::value_at(const geo::PixelCenterCoordinate &gc) const
 template<typename T, typename coord_type>
 void CellGrid<T, coord_type>::format(T val)
 {
-    for (auto it = data_.begin(); it != data_.end(); ++it) {
-        *it = val;
-    }
+    if (is_allocated()) std::fill(data(), data() + px_size(), val);
     is_formatted_ = true;
+    dirty_tiles_.mark_all();
 }
 
 template<typename T, typename coord_type>
@@ -181,9 +312,82 @@ void CellGrid<T, coord_type>::format()
 template<typename T, typename C>
 void CellGrid<T, C>::copy_data_from(const CellGrid<T, C> &other)
 {
-    data_ = std::vector<T>(other.data_);
+    // reuse the allocated array
+    if (view_ != nullptr || (is_allocated() && px_size() == other.px_size())) {
+        if (px_size() != other.px_size()) {
+            throw std::runtime_error("The size of the CellGrid '" + name_ +
+                "' viewing an array cannot be changed.");
+        }
+        std::copy(other.data(), other.data() + other.px_size(), data());
+    } else {
+        data_.assign(other.data(), other.data() + other.px_size());
+    }
     is_formatted_ = true;
     special_values_ = std::map<std::string, T>(other.special_values_);
+    dirty_tiles_.mark_all();
+}
+
+template<typename T, typename C>
+void CellGrid<T, C>::track_dirty_tiles(size_t tile_size)
+{
+    dirty_tiles_.enable(px_width(), px_height(), tile_size);
+}
+
+template<typename T, typename C>
+const DirtyTiles & CellGrid<T, C>::dirty_tiles() const
+{
+    return dirty_tiles_;
+}
+
+template<typename T, typename C>
+void CellGrid<T, C>::mark_written(size_t ind)
+{
+    dirty_tiles_.mark(ind);
+}
+
+template<typename T, typename C>
+void CellGrid<T, C>::format_written(T val, DirtyTiles::version_type since)
+{
+    if (!dirty_tiles_.enabled()) {
+        format(val);
+        return;
+    }
+    size_t nx {px_width()};
+    auto tiles = dirty_tiles_.written_since(since);
+    for (auto t: tiles) {
+        auto b = dirty_tiles_.bounds(t);
+        for (size_t j = b.row_begin; j < b.row_end; ++j) {
+            std::fill(data() + j * nx + b.col_begin,
+                data() + j * nx + b.col_end, val);
+        }
+        dirty_tiles_.mark(b);
+    }
+}
+
+template<typename T, typename C>
+void CellGrid<T, C>::copy_written_from(
+    const CellGrid<T, C> & other,
+    DirtyTiles::version_type since)
+{
+    if (!dirty_tiles_.enabled() || !is_allocated() ||
+        px_size() != other.px_size())
+    {
+        copy_data_from(other);
+        return;
+    }
+    size_t nx {px_width()};
+    auto tiles = dirty_tiles_.written_since(since);
+    for (auto t: tiles) {
+        auto b = dirty_tiles_.bounds(t);
+        for (size_t j = b.row_begin; j < b.row_end; ++j) {
+            std::copy(
+                other.data() + j * nx + b.col_begin,
+                other.data() + j * nx + b.col_end,
+                data() + j * nx + b.col_begin);
+        }
+        dirty_tiles_.mark(b);
+    }
+    is_formatted_ = true;
 }
 
 template<typename T, typename C>
@@ -0,0 +1,80 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "DirtyTiles.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+void DirtyTiles::enable(size_t nx, size_t ny, size_t tile_size)
+{
+    if (tile_size == 0) {
+        throw std::runtime_error("The size of the dirty tiles must be positive.");
+    }
+    nx_ = nx;
+    ny_ = ny;
+    tile_size_ = tile_size;
+    tiles_x_ = (nx + tile_size - 1) / tile_size;
+    stamps_.assign(tiles_x_ * ((ny + tile_size - 1) / tile_size), 0);
+    mark_all();
+}
+
+void DirtyTiles::disable()
+{
+    tile_size_ = 0;
+    tiles_x_ = 0;
+    std::vector<version_type>().swap(stamps_);
+}
+
+void DirtyTiles::mark(const Bounds & cells)
+{
+    if (tile_size_ == 0 || cells.col_begin >= cells.col_end ||
+        cells.row_begin >= cells.row_end)
+    {
+        return;
+    }
+    ++version_;
+    for (size_t tj = cells.row_begin / tile_size_;
+         tj <= (cells.row_end - 1) / tile_size_; ++tj)
+    {
+        for (size_t ti = cells.col_begin / tile_size_;
+             ti <= (cells.col_end - 1) / tile_size_; ++ti)
+        {
+            stamps_[tj * tiles_x_ + ti] = version_;
+        }
+    }
+}
+
+void DirtyTiles::mark_all()
+{
+    if (tile_size_ == 0) return;
+    ++version_;
+    std::fill(stamps_.begin(), stamps_.end(), version_);
+}
+
+std::vector<size_t> DirtyTiles::written_since(version_type since) const
+{
+    std::vector<size_t> tiles;
+    for (size_t t = 0; t < stamps_.size(); ++t) {
+        if (stamps_[t] > since) tiles.push_back(t);
+    }
+    return tiles;
+}
+
+DirtyTiles::Bounds DirtyTiles::bounds(size_t tile, size_t halo) const
+{
+    size_t col {(tile % tiles_x_) * tile_size_};
+    size_t row {(tile / tiles_x_) * tile_size_};
+    return {col > halo ? col - halo : 0,
+            row > halo ? row - halo : 0,
+            std::min(nx_, col + tile_size_ + halo),
+            std::min(ny_, row + tile_size_ + halo)};
+}
@@ -0,0 +1,104 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef DIRTY_TILES_H_
+#define DIRTY_TILES_H_
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * \brief Tracking of the square tiles of a raster that have been written.
+ *
+ * Each write marks its tile with a new version, so the tiles written after
+ * the version v are the tiles whose version is greater than v. The
+ * algorithms remember the version() at which they processed the raster,
+ * and later restrict themselves to the tiles written since (plus a halo).
+ *
+ * The tracking is off until enable() is called, and then marking is a
+ * no-op. The marking is not thread safe.
+ */
+class DirtyTiles
+{
+    public:
+        using version_type = unsigned long;
+
+        /**
+         * \brief The cell range [col_begin, col_end) x [row_begin, row_end).
+         */
+        struct Bounds
+        {
+            size_t col_begin;
+            size_t row_begin;
+            size_t col_end;
+            size_t row_end;
+        };
+
+        /**
+         * \brief Start tracking a raster of nx * ny cells with tiles of
+         * tile_size * tile_size cells. All the tiles are marked written.
+         */
+        void enable(size_t nx, size_t ny, size_t tile_size);
+        void disable();
+        bool enabled() const { return tile_size_ > 0; }
+
+        /**
+         * \brief The version of the latest write.
+         */
+        version_type version() const { return version_; }
+
+        size_t tile_size() const { return tile_size_; }
+        size_t n_tiles() const { return stamps_.size(); }
+
+        /**
+         * \brief Mark the tile of the raster index \a ind written.
+         */
+        void mark(size_t ind)
+        {
+            if (tile_size_ == 0) return;
+            stamps_[tile_of(ind)] = ++version_;
+        }
+
+        /**
+         * \brief Mark the tiles overlapping the cell range written.
+         */
+        void mark(const Bounds & cells);
+
+        void mark_all();
+
+        /**
+         * \brief The tiles written after the version \a since, in the
+         * row-major order.
+         */
+        std::vector<size_t> written_since(version_type since) const;
+
+        /**
+         * \brief The cells of the tile, extended with \a halo cells to each
+         * direction and clipped to the raster.
+         */
+        Bounds bounds(size_t tile, size_t halo = 0) const;
+
+    private:
+        size_t nx_ {0};
+        size_t ny_ {0};
+        size_t tile_size_ {0};
+        size_t tiles_x_ {0};
+        version_type version_ {0};
+        std::vector<version_type> stamps_;
+
+        size_t tile_of(size_t ind) const
+        {
+            return ((ind / nx_) / tile_size_) * tiles_x_ +
+                (ind % nx_) / tile_size_;
+        }
+};
+
+#endif
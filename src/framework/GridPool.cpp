@@ -0,0 +1,52 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "GridPool.h"
+
+std::shared_ptr<void> GridPool::take(std::type_index type, size_t n)
+{
+    std::lock_guard<std::mutex> lock {mutex_};
+    auto best = free_.end();
+    for (auto it = free_.begin(); it != free_.end(); ++it) {
+        if (it->type == type && it->capacity >= n &&
+            (best == free_.end() || it->capacity < best->capacity))
+        {
+            best = it;
+        }
+    }
+    if (best == free_.end()) return nullptr;
+    std::shared_ptr<void> storage {std::move(best->storage)};
+    free_.erase(best);
+    return storage;
+}
+
+void GridPool::put(Buffer b)
+{
+    std::lock_guard<std::mutex> lock {mutex_};
+    free_.push_back(std::move(b));
+}
+
+void GridPool::clear()
+{
+    std::vector<Buffer> freed;
+    {
+        std::lock_guard<std::mutex> lock {mutex_};
+        freed.swap(free_);
+    }
+}
+
+size_t GridPool::bytes() const
+{
+    std::lock_guard<std::mutex> lock {mutex_};
+    size_t n {0};
+    for (const auto & b: free_) n += b.bytes;
+    return n;
+}
@@ -0,0 +1,103 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef GRID_POOL_H_
+#define GRID_POOL_H_
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <typeindex>
+#include <typeinfo>
+#include <vector>
+
+/**
+ * \brief The storage of the released grids, kept for the grids created
+ * later.
+ *
+ * A grid created from a pool takes the smallest free array of its value
+ * type that is large enough, and gives the array back to the pool when it
+ * is destroyed. Thus the grids of a run, or of a sequence of runs, are
+ * allocated once at the size of the largest raster instead of at each
+ * creation.
+ *
+ * The pool is thread safe.
+ */
+class GridPool
+{
+    public:
+        /**
+         * \brief An array of n value-initialized elements.
+         */
+        template<typename T>
+        std::vector<T> acquire(size_t n);
+
+        /**
+         * \brief Take the storage of the array into the pool. The array is
+         * left empty.
+         */
+        template<typename T>
+        void release(std::vector<T> & v);
+
+        /**
+         * \brief Free the arrays of the pool.
+         */
+        void clear();
+
+        /**
+         * \brief The number of bytes in the free arrays of the pool.
+         */
+        size_t bytes() const;
+
+    private:
+        struct Buffer
+        {
+            std::type_index type;
+            size_t capacity;
+            size_t bytes;
+            std::shared_ptr<void> storage;
+        };
+
+        // the smallest free array of the type with at least n elements,
+        // or null
+        std::shared_ptr<void> take(std::type_index type, size_t n);
+        void put(Buffer b);
+
+        mutable std::mutex mutex_;
+        std::vector<Buffer> free_;
+};
+
+
+/* implementation */
+
+template<typename T>
+std::vector<T> GridPool::acquire(size_t n)
+{
+    std::vector<T> v;
+    auto storage = take(typeid(T), n);
+    if (storage) {
+        v.swap(*static_cast<std::vector<T> *>(storage.get()));
+    }
+    v.assign(n, T());
+    return v;
+}
+
+template<typename T>
+void GridPool::release(std::vector<T> & v)
+{
+    if (v.capacity() == 0) return;
+    auto storage = std::make_shared<std::vector<T>>();
+    storage->swap(v);
+    size_t capacity {storage->capacity()};
+    put({typeid(T), capacity, capacity * sizeof(T), storage});
+}
+
+#endif
@@ -0,0 +1,136 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef GRID_SPILL_H_
+#define GRID_SPILL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+/**
+ * \brief A grid kept in a run-length form while it is not needed.
+ *
+ * Only the cells that differ from a base are stored, as runs of equal
+ * values. The base is either another array of the same size (e.g. the
+ * original DEM for a carved copy of it) or the zero value, so the sparse
+ * grids (roads, culverts) and the grids close to their base take a small
+ * fraction of their full size.
+ */
+template<typename T>
+class GridSpill
+{
+    public:
+        /**
+         * \brief Store the n values of data, compared to base (or to the
+         * zero value if base is null).
+         *
+         * \return False, and nothing is stored, if the runs would take
+         * more memory than the values.
+         */
+        bool store(const T * data, size_t n, const T * base = nullptr);
+
+        /**
+         * \brief Write the stored values into data, which has the stored
+         * number of values. The base must be the same as in store().
+         */
+        void load(T * data, const T * base = nullptr) const;
+
+        bool stored() const { return stored_; }
+
+        /**
+         * \brief The number of the stored values.
+         */
+        size_t size() const { return n_; }
+
+        void clear();
+
+    private:
+        struct Run
+        {
+            size_t start;
+            std::uint32_t length;
+            T value;
+        };
+
+        std::vector<Run> runs_;
+        size_t n_ {0};
+        bool stored_ {false};
+};
+
+
+/* implementation */
+
+template<typename T>
+bool GridSpill<T>::store(const T * data, size_t n, const T * base)
+{
+    clear();
+    auto base_at = [base](size_t ind) { return base ? base[ind] : T(); };
+    const size_t max_runs {n * sizeof(T) / sizeof(Run)};
+    const size_t max_length {std::numeric_limits<std::uint32_t>::max()};
+
+    // The runs are counted first, stopping as soon as there are too many,
+    // so that the array of the runs is allocated once at its final size.
+    auto for_each_run = [&](auto f)
+    {
+        size_t ind {0};
+        while (ind < n) {
+            if (data[ind] == base_at(ind)) {
+                ++ind;
+                continue;
+            }
+            Run r {ind, 1, data[ind]};
+            ++ind;
+            while (ind < n && r.length < max_length && data[ind] == r.value &&
+                !(data[ind] == base_at(ind)))
+            {
+                ++r.length;
+                ++ind;
+            }
+            if (!f(r)) return false;
+        }
+        return true;
+    };
+
+    size_t n_runs {0};
+    if (!for_each_run([&](const Run &) { return ++n_runs <= max_runs; })) {
+        return false;
+    }
+    runs_.reserve(n_runs);
+    for_each_run([this](const Run & r) { runs_.push_back(r); return true; });
+    n_ = n;
+    stored_ = true;
+    return true;
+}
+
+template<typename T>
+void GridSpill<T>::load(T * data, const T * base) const
+{
+    for (size_t ind = 0; ind < n_; ++ind) {
+        data[ind] = base ? base[ind] : T();
+    }
+    for (const auto & r: runs_) {
+        for (size_t k = 0; k < r.length; ++k) {
+            data[r.start + k] = r.value;
+        }
+    }
+}
+
+template<typename T>
+void GridSpill<T>::clear()
+{
+    std::vector<Run>().swap(runs_);
+    n_ = 0;
+    stored_ = false;
+}
+
+#endif
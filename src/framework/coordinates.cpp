@@ -37,6 +37,11 @@ namespace coordinates {
         return y_;
     }
 
+    GlobalDataCoords::GlobalDataCoords():
+        x_ {0}, y_ {0}
+    {
+    }
+
     GlobalDataCoords::GlobalDataCoords(
             raster_coord_type x,
             raster_coord_type y):
@@ -66,6 +71,40 @@ namespace coordinates {
                 static_cast<raster_coord_type>(y)};
     }
 
+    PartitionCoordinate::PartitionCoordinate():
+        x_ {0}, y_ {0}
+    {
+    }
+
+    PartitionCoordinate::PartitionCoordinate(
+            partition_coord_type x,
+            partition_coord_type y):
+        x_ {x}, y_ {y}
+    {
+    }
+
+    partition_coord_type PartitionCoordinate::col() const
+    {
+        return x_;
+    }
+
+    partition_coord_type PartitionCoordinate::row() const
+    {
+        return y_;
+    }
+
+    PartitionCoordinate PartitionCoordinate::create(size_t x, size_t y)
+    {
+        if (x > std::numeric_limits<partition_coord_type>::max()) {
+            throw std::runtime_error("PartitionCoordinate col too large.");
+        }
+        if (y > std::numeric_limits<partition_coord_type>::max()) {
+            throw std::runtime_error("PartitionCoordinate row too large.");
+        }
+        return {static_cast<partition_coord_type>(x),
+                static_cast<partition_coord_type>(y)};
+    }
+
 
     raster_coord_diff_type RasterCoordinateDiff::dx() const
     {
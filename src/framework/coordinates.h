@@ -36,6 +36,7 @@ namespace coordinates {
     class RasterCoordinateDiff;
     class RasterDims;
     class GlobalDataCoords;
+    class PartitionCoordinate;
 
     template<typename T>
     typename std::enable_if<std::is_base_of<CoordinateType, typename T::coordinate_type>::value, bool>::type
@@ -143,6 +144,7 @@ namespace coordinates {
             friend bool operator< <GlobalDataCoords>(const GlobalDataCoords &, const GlobalDataCoords &);
             friend std::ostream & operator<< <GlobalDataCoords>(std::ostream &, const GlobalDataCoords &);
 
+            GlobalDataCoords();
             GlobalDataCoords(raster_coord_type, raster_coord_type);
 
             static GlobalDataCoords create(size_t, size_t);
@@ -155,6 +157,32 @@ namespace coordinates {
             raster_coord_type y_;
     };
 
+    /**
+     * \brief The column and the row of a partition (tile) in the grid of
+     * the partitions of a raster.
+     */
+    class PartitionCoordinate {
+        public:
+            using coordinate_type = TypePartition;
+            using datatype = partition_coord_type;
+
+            friend bool operator==<PartitionCoordinate>(const PartitionCoordinate &, const PartitionCoordinate &);
+            friend bool operator< <PartitionCoordinate>(const PartitionCoordinate &, const PartitionCoordinate &);
+            friend std::ostream & operator<< <PartitionCoordinate>(std::ostream &, const PartitionCoordinate &);
+
+            PartitionCoordinate();
+            PartitionCoordinate(partition_coord_type, partition_coord_type);
+
+            static PartitionCoordinate create(size_t, size_t);
+
+            partition_coord_type col() const;
+            partition_coord_type row() const;
+
+        private:
+            partition_coord_type x_;
+            partition_coord_type y_;
+    };
+
     template<typename C>
     typename C::base_type operator+(
         const typename C::base_type &p,
@@ -18,4 +18,8 @@ namespace global_parameters {
 
     bool dryRun = false;
 
+    bool reproducible = false;
+
+    unsigned int n_threads = 0;
+
 }
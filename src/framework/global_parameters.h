@@ -29,6 +29,19 @@ namespace global_parameters {
      */
     extern bool dryRun;
 
+    /**
+     * \brief The reproducible mode: the ties are broken by the position of
+     * the cells, so that the results do not depend on the order the cells
+     * are met.
+     */
+    extern bool reproducible;
+
+    /**
+     * \brief The number of worker threads. Zero means the number of
+     * hardware threads.
+     */
+    extern unsigned int n_threads;
+
 }
 
 
@@ -38,6 +38,10 @@ BaseCmdOpts::BaseCmdOpts():
         ("log-timestamps",
                 po::value<bool>(&log_timestamps_)->default_value(false)->implicit_value(true),
                 "Prefix log entries with time")
+        ("threads",
+                po::value<unsigned int>(&global_parameters::n_threads)->default_value(0),
+                "The number of worker threads\n"
+                    "0 = the number of hardware threads (default)")
         ;
 }
 
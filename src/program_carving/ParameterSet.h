@@ -0,0 +1,36 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef PARAMETER_SET_H_
+#define PARAMETER_SET_H_
+
+#include <string>
+
+/**
+ * \brief The thresholds of the culvert placing iterations.
+ *
+ * The thresholds do not affect the carving of the DEM without culverts,
+ * so the runs with different thresholds share everything up to the first
+ * culvert placing.
+ */
+struct ParameterSet
+{
+    // used in the names of the output files
+    std::string name;
+    double min_carving_cost;
+    double min_culvert_saving;
+    double min_carving_single;
+    double min_flow_accum;
+    double ignore_dist_same_iter;
+    double ignore_dist;
+};
+
+#endif
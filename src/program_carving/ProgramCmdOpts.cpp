@@ -11,7 +11,10 @@
 
 #include "ProgramCmdOpts.h"
 
+#include <limits>
+
 #include "CmdError.h"
+#include "global_parameters.h"
 
 ProgramCmdOpts::ProgramCmdOpts():
     BaseCmdOpts()
@@ -24,8 +27,9 @@ ProgramCmdOpts::ProgramCmdOpts():
                 "file:data/DEM")->required(),
             "Specify a string identifying the DEM files")
         ("roads",
-            po::value<std::string>(&road_data_str_)->required(),
-            "Specify a string identifying the roads raster")
+            po::value<std::string>(&road_data_str_),
+            "Specify a string identifying the roads raster (required "
+            "without --batch)")
         ("halo",
             po::value<double>(&halo_width_)->default_value(0.0),
             "Specify the width of the halo region (in meters).")
@@ -52,6 +56,95 @@ ProgramCmdOpts::ProgramCmdOpts():
             po::value<double>(&min_flow_accum_)->required(),
             "The minimum flow accumulation value of a cell before it is "
             "considered to belong to a stream.")
+        ("min-culvert-saving",
+            po::value<double>(&min_culvert_saving_)->default_value(0.0),
+            "The minimum carving cost that a culvert on an expensive "
+            "carving is estimated to save, based on the depressions of the "
+            "carving. Zero accepts all the culverts found.")
+        ("tile-size",
+            po::value<double>(&tile_size_)->default_value(0.0),
+            "Process the DEM in square tiles of this size (in meters) "
+            "instead of at once. Zero processes the DEM at once.")
+        ("tile-halo",
+            po::value<double>(&tile_halo_)->default_value(1000.0),
+            "The width of the overlap around each tile (in meters). Only "
+            "the culverts and streams of the tile without the halo are "
+            "kept, and the flow accumulation of the streams is joined "
+            "across the tiles.")
+        ("memory-budget",
+            po::value<double>(&memory_budget_)->default_value(0.0),
+            "The memory (in megabytes) for the tiles processed at the same "
+            "time. Zero means no limit, i.e. one tile per thread.")
+        ("processes",
+            po::value<unsigned int>(&processes_)->default_value(1),
+            "The number of worker processes sharing the tiles, e.g. one "
+            "per memory node. The results and the flow along the tile "
+            "boundaries come back through shared memory. Used with "
+            "--tile-size.")
+        ("checkpoint",
+            po::value<std::string>(&checkpoint_)->default_value(""),
+            "Save the culvert placing state into this file after each "
+            "iteration (one file per tile with --tile-size).")
+        ("resume",
+            po::value<bool>(&resume_)->default_value(false)->implicit_value(true),
+            "Continue from the state saved with --checkpoint, if the file "
+            "exists.")
+        ("sweep",
+            po::value<std::string>(&sweep_)->default_value(""),
+            "Run the culvert placing with each parameter set listed in "
+            "this file, one set per line: a name and the thresholds as "
+            "key=value pairs, e.g. \"a min-carving-cost=5\". The inputs "
+            "are loaded and carved once, and the outputs of each set are "
+            "named after it.")
+        ("batch",
+            po::value<std::string>(&batch_)->default_value(""),
+            "Process each area listed in this manifest file, one per line: "
+            "the DEM, the roads, the output prefix and optionally the "
+            "thresholds as key=value pairs. The areas are processed on the "
+            "worker threads within --memory-budget, and a summary is "
+            "written into <manifest>.summary.")
+        ("memory-lean",
+            po::value<bool>(&memory_lean_)->default_value(false)->implicit_value(true),
+            "Keep only the grids needed by the current phase in memory, "
+            "and the others freed or in a compact form. Lowers the peak "
+            "memory use at the cost of some recomputation.")
+        ("serve",
+            po::value<bool>(&serve_)->default_value(false)->implicit_value(true),
+            "Keep the DEM and the roads in memory and process jobs read "
+            "from stdin, one per line: the output prefix, the area as "
+            "\"left bottom right top\" and optionally the thresholds as "
+            "key=value pairs. The area is processed with a halo of "
+            "--tile-halo, and a reply line \"ok <prefix> <culverts> "
+            "<streams> <seconds>\" or \"failed <prefix> <error>\" is "
+            "written into stdout for each job. Requires --log other than "
+            "stdout.")
+        ("multires-factor",
+            po::value<unsigned int>(&multires_factor_)->default_value(1),
+            "Place the culverts first on the DEM and the roads downsampled "
+            "by this factor (2 to 4), and use them as the first culverts "
+            "of the full resolution, which then only refines them and "
+            "finds the smaller streams. One places the culverts on the "
+            "full resolution only.")
+        ("reproducible",
+            po::value<bool>(&global_parameters::reproducible)->default_value(false)->implicit_value(true),
+            "Break the ties of the carving by the position of the cells, "
+            "so that the results do not depend on the order the cells are "
+            "met, e.g. by different numbers of threads.")
+        ("hash-log",
+            po::value<std::string>(&hash_log_)->default_value(""),
+            "Write the hashes of the carved DEM, the flow directions, the "
+            "flow accumulation and the culverts after each culvert placing "
+            "iteration into this file.")
+        ("verify-hashes",
+            po::value<std::string>(&verify_hashes_)->default_value(""),
+            "Compare the hashes of each iteration with this file written "
+            "by --hash-log in an earlier run, and stop with an error at "
+            "the first difference.")
+        ("dry-run",
+            po::value<bool>(&global_parameters::dryRun)->default_value(false)->implicit_value(true),
+            "Do not carve, but read a sample of the inputs and print the "
+            "estimated peak memory of each stage, the I/O volume and the "
+            "runtime per iteration.")
         ;
 }
 
@@ -62,6 +155,9 @@ void ProgramCmdOpts::parse(int argc, char** argv)
     try {
         BaseCmdOpts::parse(argc, argv);
 
+        if (road_data_str_.empty() && batch_.empty()) {
+            throw std::runtime_error("The param \"roads\" is required.");
+        }
         if (halo_width_ < 0) {
             throw std::runtime_error("The width of the halo region must be positive.");
         }
@@ -83,6 +179,56 @@ void ProgramCmdOpts::parse(int argc, char** argv)
         if (min_flow_accum_ < 0) {
             throw std::runtime_error("The param \"min-flow-accumulation\" must be positive.");
         }
+        if (min_culvert_saving_ < 0) {
+            throw std::runtime_error("The param \"min-culvert-saving\" must be positive.");
+        }
+        if (tile_size_ < 0) {
+            throw std::runtime_error("The param \"tile-size\" must be positive.");
+        }
+        if (tile_halo_ < 0) {
+            throw std::runtime_error("The param \"tile-halo\" must be positive.");
+        }
+        if (tile_size_ > 0 && tile_halo_ < halo_width_) {
+            throw std::runtime_error("The param \"tile-halo\" must be at least \"halo\", or the culverts near the tile boundaries are lost.");
+        }
+        if (memory_budget_ < 0) {
+            throw std::runtime_error("The param \"memory-budget\" must be positive.");
+        }
+        if (resume_ && checkpoint_.empty()) {
+            throw std::runtime_error("The param \"resume\" requires \"checkpoint\".");
+        }
+        if (!batch_.empty() && (!sweep_.empty() || tile_size_ > 0)) {
+            throw std::runtime_error("The param \"batch\" cannot be used with \"sweep\" or \"tile-size\".");
+        }
+        if (global_parameters::dryRun && !batch_.empty()) {
+            throw std::runtime_error("The param \"dry-run\" cannot be used with \"batch\".");
+        }
+        if (serve_ && (!batch_.empty() || !sweep_.empty() ||
+            tile_size_ > 0 || !checkpoint_.empty() ||
+            global_parameters::dryRun))
+        {
+            throw std::runtime_error("The param \"serve\" cannot be used with \"batch\", \"sweep\", \"tile-size\", \"checkpoint\" or \"dry-run\".");
+        }
+        if (serve_ && vm["log"].as<std::string>() == "-") {
+            throw std::runtime_error("The param \"serve\" replies to stdout, so it requires \"log\" to be a file or null.");
+        }
+        if (!sweep_.empty() && tile_size_ > 0) {
+            throw std::runtime_error("The param \"sweep\" cannot be used with \"tile-size\".");
+        }
+        if ((!hash_log_.empty() || !verify_hashes_.empty()) &&
+            (!batch_.empty() || !sweep_.empty() || tile_size_ > 0 ||
+             serve_ || global_parameters::dryRun))
+        {
+            throw std::runtime_error("The params \"hash-log\" and \"verify-hashes\" cannot be used with \"batch\", \"sweep\", \"tile-size\", \"serve\" or \"dry-run\".");
+        }
+        if (multires_factor_ == 0 || multires_factor_ > 4) {
+            throw std::runtime_error("The param \"multires-factor\" must be from 1 to 4.");
+        }
+        if (processes_ == 0 || processes_ >
+            std::numeric_limits<coordinates::partition_coord_type>::max())
+        {
+            throw std::runtime_error("The param \"processes\" is out of range.");
+        }
     } catch (po::error &e) {
         throw errors::CmdError(e.what());
     }
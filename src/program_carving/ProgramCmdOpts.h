@@ -41,6 +41,34 @@ class ProgramCmdOpts: BaseCmdOpts {
             return min_carving_single_; }
         double min_flow_accum() const {
             return min_flow_accum_; }
+        double min_culvert_saving() const {
+            return min_culvert_saving_; }
+        double tile_size() const {
+            return tile_size_; }
+        double tile_halo() const {
+            return tile_halo_; }
+        double memory_budget() const {
+            return memory_budget_; }
+        unsigned int processes() const {
+            return processes_; }
+        std::string checkpoint() const {
+            return checkpoint_; }
+        bool resume() const {
+            return resume_; }
+        std::string sweep() const {
+            return sweep_; }
+        std::string batch() const {
+            return batch_; }
+        bool memory_lean() const {
+            return memory_lean_; }
+        bool serve() const {
+            return serve_; }
+        unsigned int multires_factor() const {
+            return multires_factor_; }
+        std::string hash_log() const {
+            return hash_log_; }
+        std::string verify_hashes() const {
+            return verify_hashes_; }
 
         void parse(int argc, char** argv);
 
@@ -54,6 +82,20 @@ class ProgramCmdOpts: BaseCmdOpts {
         double min_carving_cost_;
         double min_carving_single_;
         double min_flow_accum_;
+        double min_culvert_saving_;
+        double tile_size_;
+        double tile_halo_;
+        double memory_budget_;
+        unsigned int processes_;
+        std::string checkpoint_;
+        bool resume_;
+        std::string sweep_;
+        std::string batch_;
+        bool memory_lean_;
+        bool serve_;
+        unsigned int multires_factor_;
+        std::string hash_log_;
+        std::string verify_hashes_;
 };
 
 #endif
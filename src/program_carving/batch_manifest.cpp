@@ -0,0 +1,68 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "batch_manifest.h"
+
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+namespace batch_manifest {
+
+    std::vector<Entry> read(
+        const std::string & file,
+        const ParameterSet & defaults)
+    {
+        std::ifstream in(file);
+        if (!in) {
+            throw std::runtime_error("Could not read " + file + ".");
+        }
+
+        std::vector<Entry> entries;
+        std::set<std::string> prefixes;
+        std::string line;
+        for (size_t line_no = 1; std::getline(in, line); ++line_no) {
+            std::istringstream words {line};
+            Entry e {"", "", "", defaults};
+            if (!(words >> e.dem_data_str) || e.dem_data_str[0] == '#') {
+                continue;
+            }
+
+            auto error = [&](const std::string & what) {
+                return std::runtime_error(file + ":" +
+                    std::to_string(line_no) + ": " + what);
+            };
+            if (!(words >> e.road_data_str >> e.output_prefix)) {
+                throw error("Expected the DEM, the roads and the output "
+                    "prefix.");
+            }
+            if (!prefixes.insert(e.output_prefix).second) {
+                throw error("The output prefix \"" + e.output_prefix +
+                    "\" is used twice.");
+            }
+            std::string word;
+            while (words >> word) {
+                try {
+                    parameter_sets::assign(e.parameters, word);
+                } catch (std::runtime_error & err) {
+                    throw error(err.what());
+                }
+            }
+            entries.push_back(std::move(e));
+        }
+        if (entries.empty()) {
+            throw std::runtime_error("No entries in " + file + ".");
+        }
+        return entries;
+    }
+
+}
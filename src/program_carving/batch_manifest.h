@@ -0,0 +1,51 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef BATCH_MANIFEST_H_
+#define BATCH_MANIFEST_H_
+
+#include <string>
+#include <vector>
+
+#include "parameter_sets.h"
+
+/**
+ * \brief The areas processed in one run of the batch mode.
+ */
+namespace batch_manifest {
+
+    struct Entry
+    {
+        std::string dem_data_str;
+        std::string road_data_str;
+        // prepended to the names of the output files
+        std::string output_prefix;
+        ParameterSet parameters;
+    };
+
+    /**
+     * \brief Read the entries from the manifest file.
+     *
+     * Each non-empty line that does not start with '#' is an entry: the
+     * DEM, the roads and the output prefix, followed by the thresholds of
+     * the entry as key=value pairs (see parameter_sets::assign). The
+     * thresholds not given are taken from \a defaults.
+     *
+     * \throw std::runtime_error if the file cannot be read, a line is
+     * malformed or the output prefixes are not unique.
+     */
+    std::vector<Entry> read(
+        const std::string & file,
+        const ParameterSet & defaults);
+
+}
+
+#endif
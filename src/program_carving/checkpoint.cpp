@@ -0,0 +1,167 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "checkpoint.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace checkpoint {
+
+    namespace {
+
+        const char magic[8] {'C', 'U', 'L', 'V', 'C', 'K', 'P', '2'};
+
+        struct Header
+        {
+            char magic[8];
+            std::uint64_t inputs;
+            std::uint64_t nx;
+            std::uint64_t ny;
+            std::uint64_t n_culverts;
+            std::uint32_t iteration;
+            std::uint32_t next_free_culvert_id;
+        };
+
+        struct Record
+        {
+            std::uint64_t sink;
+            std::uint64_t source;
+            std::uint32_t id;
+            std::uint32_t flow;
+        };
+
+    }
+
+    void write(
+        const std::string & file,
+        std::uint64_t inputs,
+        const CulvertSet<DeltaDemDatatype> & culverts,
+        const std::map<DeltaDemDatatype, cprops> & culvert_props,
+        DeltaDemDatatype next_free_culvert_id,
+        unsigned int iteration)
+    {
+        Header h;
+        std::memcpy(h.magic, magic, sizeof(magic));
+        h.inputs = inputs;
+        h.nx = culverts.area().pixel_width();
+        h.ny = culverts.area().pixel_height();
+        h.n_culverts = culverts.size();
+        h.iteration = iteration;
+        h.next_free_culvert_id = next_free_culvert_id;
+
+        std::vector<Record> records;
+        records.reserve(culverts.size());
+        for (const auto & c: culverts) {
+            records.push_back({c.sink(), c.source(), c.id(),
+                std::get<1>(culvert_props.at(c.id()))});
+        }
+
+        std::string tmp {file + ".tmp"};
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+            out.write(reinterpret_cast<const char *>(records.data()),
+                static_cast<std::streamsize>(records.size() * sizeof(Record)));
+            if (!out) {
+                throw std::runtime_error(
+                    "Could not write the checkpoint " + tmp + ".");
+            }
+        }
+        if (std::rename(tmp.c_str(), file.c_str()) != 0) {
+            throw std::runtime_error(
+                "Could not replace the checkpoint " + file + ".");
+        }
+    }
+
+    bool read(
+        const std::string & file,
+        std::uint64_t inputs,
+        CulvertSet<DeltaDemDatatype> & culverts,
+        std::map<DeltaDemDatatype, cprops> & culvert_props,
+        DeltaDemDatatype & next_free_culvert_id,
+        unsigned int & iteration)
+    {
+        std::ifstream in(file, std::ios::binary);
+        if (!in) return false;
+
+        Header h;
+        in.read(reinterpret_cast<char *>(&h), sizeof(h));
+        if (!in || std::memcmp(h.magic, magic, sizeof(magic)) != 0) {
+            throw std::runtime_error(file + " is not a checkpoint file.");
+        }
+        if (h.nx != culverts.area().pixel_width() ||
+            h.ny != culverts.area().pixel_height())
+        {
+            throw std::runtime_error("The checkpoint " + file +
+                " was written for a raster of a different size.");
+        }
+        if (h.inputs != inputs) {
+            throw std::runtime_error("The checkpoint " + file +
+                " was written with other input rasters or parameters.");
+        }
+        // the size is checked before the records are allocated
+        const std::streamoff begin {in.tellg()};
+        in.seekg(0, std::ios::end);
+        const std::streamoff end {in.tellg()};
+        in.seekg(begin);
+        if (static_cast<std::uint64_t>(end - begin) !=
+            h.n_culverts * sizeof(Record))
+        {
+            throw std::runtime_error("The checkpoint " + file +
+                " has a wrong size.");
+        }
+        std::vector<Record> records(h.n_culverts);
+        in.read(reinterpret_cast<char *>(records.data()),
+            static_cast<std::streamsize>(records.size() * sizeof(Record)));
+        if (!in) {
+            throw std::runtime_error("The checkpoint " + file + " is truncated.");
+        }
+
+        const std::uint64_t n_cells {h.nx * h.ny};
+        std::vector<std::uint32_t> ids;
+        ids.reserve(records.size());
+        for (const auto & r: records) {
+            if (r.sink >= n_cells || r.source >= n_cells) {
+                throw std::runtime_error("The checkpoint " + file +
+                    " has a culvert outside the raster.");
+            }
+            if (r.id == 0 || r.id >= h.next_free_culvert_id) {
+                throw std::runtime_error("The checkpoint " + file +
+                    " has a culvert id " + std::to_string(r.id) +
+                    " that is not below the next free id.");
+            }
+            ids.push_back(r.id);
+        }
+        std::sort(ids.begin(), ids.end());
+        if (std::adjacent_find(ids.begin(), ids.end()) != ids.end()) {
+            throw std::runtime_error("The checkpoint " + file +
+                " has several culverts with the same id.");
+        }
+
+        culverts.clear();
+        culvert_props.clear();
+        for (const auto & r: records) {
+            culverts.push_back({r.sink, r.source, r.id});
+            culvert_props[r.id] = cprops {r.id, r.flow};
+        }
+        next_free_culvert_id = h.next_free_culvert_id;
+        iteration = h.iteration;
+        return true;
+    }
+
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "defs.h"
+#include "CulvertSet.h"
+
+/**
+ * \brief The state of the culvert placing iterations, saved between the
+ * iterations so that an interrupted run can be resumed.
+ *
+ * The file has a fixed header followed by one fixed size record per
+ * culvert, so it can be memory mapped as such. The grids are not saved:
+ * they are derived from the input rasters and the culverts, and are
+ * computed again on resume.
+ */
+namespace checkpoint {
+
+    /**
+     * \brief Write the state into the file. The file is replaced
+     * atomically, so an interrupted write leaves the previous checkpoint.
+     *
+     * \param inputs A hash of the input rasters and the parameters the
+     * state was computed from.
+     */
+    void write(
+        const std::string & file,
+        std::uint64_t inputs,
+        const CulvertSet<DeltaDemDatatype> & culverts,
+        const std::map<DeltaDemDatatype, cprops> & culvert_props,
+        DeltaDemDatatype next_free_culvert_id,
+        unsigned int iteration);
+
+    /**
+     * \brief Read the state written by write(), replacing the culverts
+     * and their properties.
+     *
+     * \return false if the file does not exist.
+     * \throw std::runtime_error if the file is not a checkpoint of a
+     * raster of the same size, it was written with other inputs, or its
+     * culverts are not valid (cells outside the raster, ids not below
+     * the next free id or repeated).
+     */
+    bool read(
+        const std::string & file,
+        std::uint64_t inputs,
+        CulvertSet<DeltaDemDatatype> & culverts,
+        std::map<DeltaDemDatatype, cprops> & culvert_props,
+        DeltaDemDatatype & next_free_culvert_id,
+        unsigned int & iteration);
+
+}
+
+#endif
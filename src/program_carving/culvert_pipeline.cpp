@@ -0,0 +1,633 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "culvert_pipeline.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <list>
+#include <memory>
+#include <stdexcept>
+
+#include "checkpoint.h"
+#include "insert_culverts_to_expensive_carvings.h"
+#include "insert_culverts_to_road_stream_intersections.h"
+#include "logging.h"
+#include "multires.h"
+
+namespace {
+
+    /*
+     * Keep the grid in the spill while it is not needed, if that takes
+     * less memory. The base is passed to GridSpill::store().
+     */
+    template<typename T>
+    void spill(
+        CellGrid<T, ct> & grid,
+        GridSpill<T> & s,
+        const T * base = nullptr)
+    {
+        if (!grid.is_allocated() || s.stored()) return;
+        if (s.store(grid.data(), grid.px_size(), base)) grid.release_data();
+    }
+
+    /*
+     * Make the grid readable again: allocate it if it was freed, and load
+     * it from the spill if it was spilled.
+     */
+    template<typename T>
+    void restore(
+        CellGrid<T, ct> & grid,
+        GridSpill<T> & s,
+        const T * base = nullptr)
+    {
+        grid.allocate_data();
+        if (s.stored()) {
+            s.load(grid.data(), base);
+            s.clear();
+        }
+    }
+
+}
+
+CulvertPipeline::CulvertPipeline(
+    const DemClass_t & dem,
+    CellGrid<road_id_type, ct> & roads,
+    DemClass_t & dem_wrk,
+    CellGrid<acc_type, ct> & accumulated,
+    GridPool & pool,
+    const geo::RasterArea & culvert_insert_area,
+    double road_buffer_width,
+    bool memory_lean):
+        dem_orig_ (dem),
+        roads_ (roads),
+        dem_wrk_ (dem_wrk),
+        accumulated_ (accumulated),
+        pool_ (pool),
+        culvert_insert_area_ {culvert_insert_area},
+        road_buffer_width_ {road_buffer_width},
+        culvert_len_lims_ {3.0, 2 * road_buffer_width},
+        lean_ {memory_lean},
+        delta_dem_ {dem, "d-DEM", pool, !memory_lean},
+        flowdirs_ {dem, "flowdirs", pool, !memory_lean},
+        carved_cells_ {dem, "carved_cells", pool, !memory_lean},
+        road_sides_ {dem, "road_sides", pool, !memory_lean},
+        culverts_ {dem.area()},
+        search_cache_ {static_cast<unsigned int>(std::floor(
+            culvert_len_lims_.second / dem.area().cell_size())) + 1}
+{
+    if (dem_wrk_.px_size() != dem_orig_.px_size() ||
+        accumulated_.px_size() != dem_orig_.px_size() ||
+        roads_.px_size() != dem_orig_.px_size())
+    {
+        throw std::runtime_error("The grids of the pipeline must have the "
+            "size of the DEM.");
+    }
+
+    // the carving changes only a part of the tiles, and the first carving
+    // copies the whole DEM, as all the tiles are marked written
+    dem_wrk_.track_dirty_tiles(256);
+
+    delta_dem_.no_data_value(0);
+    if (!lean_) delta_dem_.format(0);
+    // the culverts touch only a few tiles
+    delta_dem_.track_dirty_tiles(256);
+
+    carved_cells_.no_data_value(0);
+    if (!lean_) carved_cells_.format();
+    carved_cells_.track_dirty_tiles(256);
+
+    accumulated_.no_data_value(0);
+    road_sides_.no_data_value(0);
+
+    road_stage_ = stages_.add_stage("road preparation",
+        {}, [this]() { prepare_roads(); });
+    culverts_changed_ = stages_.add_source("culverts");
+    depression_tracking_ = stages_.add_source("depression tracking");
+    burn_stage_ = stages_.add_stage("culvert burning",
+        {culverts_changed_}, [this]() { burn(); });
+    // In the memory-lean mode, the carving spills the roads, so they are
+    // prepared first.
+    std::vector<StageRunner::stage_id> carving_depends_on {
+        burn_stage_, depression_tracking_};
+    if (lean_) carving_depends_on.push_back(road_stage_);
+    carving_stage_ = stages_.add_stage("carving",
+        carving_depends_on, [this]() { carve(); });
+    accumulation_stage_ = stages_.add_stage("flow accumulation",
+        {carving_stage_}, [this]() { accumulate(); });
+}
+
+std::vector<TaskGraph::task_id> CulvertPipeline::add_preparation(
+    TaskGraph & graph,
+    const std::vector<TaskGraph::task_id> & dem_filled,
+    const std::vector<TaskGraph::task_id> & roads_filled)
+{
+    auto roads_prepared = graph.add("road preparation", roads_filled,
+        [this]() { stages_.require(road_stage_); });
+    std::vector<TaskGraph::task_id> carving_after {dem_filled};
+    if (lean_) carving_after.push_back(roads_prepared);
+    auto carved = graph.add("first carving", carving_after,
+        [this]() { stages_.require(carving_stage_); });
+    return {roads_prepared, carved};
+}
+
+void CulvertPipeline::track_depressions(bool track)
+{
+    if (track && !track_depressions_) {
+        stages_.invalidate(depression_tracking_);
+    }
+    track_depressions_ = track;
+}
+
+void CulvertPipeline::burn()
+{
+    restore(delta_dem_, delta_dem_spill_);
+    delta_dem_.format_written(0, delta_dem_cleared_);
+    delta_dem_cleared_ = delta_dem_.dirty_tiles().version();
+    ICA_.burn_culverts(delta_dem_, culverts_);
+}
+
+void CulvertPipeline::carve()
+{
+    if (lean_) {
+        // the flow accumulation is computed again after the carving, and
+        // the spilled carving is replaced
+        spill_roads();
+        accumulated_.release_data();
+        dem_wrk_spill_.clear();
+    }
+    restore(delta_dem_, delta_dem_spill_);
+    flowdirs_.allocate_data();
+    dem_wrk_.allocate_data();
+    dem_wrk_.copy_written_from(dem_orig_, dem_wrk_restored_);
+    dem_wrk_restored_ = dem_wrk_.dirty_tiles().version();
+
+    if (!track_depressions_) depressions_.reset(0);
+    CarvingAlgorithm_t carving_algorithm;
+    auto carve_into = [&](CarvedCells_t & cells)
+    {
+        carving_algorithm.execute(
+            dem_wrk_,
+            delta_dem_,
+            flowdirs_,
+            cells,
+            culverts_,
+            true,
+            track_depressions_ ? &depressions_ : nullptr);
+    };
+
+    if (lean_) {
+        // a scratch grid, whose array the flow accumulation takes next
+        CarvedCells_t scratch_cells {dem_orig_, "carved_cells", pool_};
+        scratch_cells.no_data_value(0);
+        carve_into(scratch_cells);
+    } else {
+        carved_cells_.format_written(0, carved_cells_cleared_);
+        carved_cells_cleared_ = carved_cells_.dirty_tiles().version();
+        carve_into(carved_cells_);
+    }
+}
+
+void CulvertPipeline::accumulate()
+{
+    if (lean_) {
+        // the carving is read again only by the next culvert placing on
+        // expensive carvings, if the culverts do not change before it
+        spill_roads();
+        spill(dem_wrk_, dem_wrk_spill_, dem_orig_.data());
+        depressions_.spill();
+    }
+
+    FlowAccumulationAlgorithm_t flow_accum_algorithm;
+    if (lean_) flow_accum_algorithm.scratch_pool(&pool_);
+
+    accumulated_.allocate_data();
+    accumulated_.format(0);
+
+    flow_accum_algorithm.execute(
+        flowdirs_,
+        accumulated_);
+}
+
+void CulvertPipeline::prepare_roads()
+{
+    // not ICA_, which the culvert burning may use at the same time
+    InsertCulvertAlgorithm ica;
+    ica.extend_roads_with_buffer_region(
+        roads_,
+        static_cast<road_id_type>(1),
+        static_cast<road_id_type>(2),
+        road_buffer_width_);
+
+    road_index_.build(roads_, static_cast<road_id_type>(1));
+
+    ica.fill_areas_with_unique_id(
+        roads_,
+        road_index_,
+        static_cast<road_id_type>(2),
+        static_cast<road_id_type>(3));
+    road_index_.index_segments(roads_, static_cast<road_id_type>(3));
+
+    road_sides_.allocate_data();
+    ica.label_road_sides(
+        roads_,
+        road_index_,
+        static_cast<road_id_type>(1),
+        road_buffer_width_,
+        road_sides_);
+}
+
+void CulvertPipeline::spill_roads()
+{
+    if (!lean_) return;
+    spill(roads_, roads_spill_);
+    spill(road_sides_, road_sides_spill_);
+}
+
+void CulvertPipeline::restore_roads()
+{
+    restore(roads_, roads_spill_);
+    restore(road_sides_, road_sides_spill_);
+}
+
+void CulvertPipeline::culverts_updated(size_t n_before)
+{
+    // the culverts are only added or removed
+    if (culverts_.size() != n_before) {
+        stages_.invalidate(culverts_changed_);
+    }
+}
+
+HashLog::hash_type CulvertPipeline::inputs_hash(const ParameterSet & ps)
+{
+    // the prepared roads depend only on the road raster and the buffer
+    // width
+    restore_roads();
+    const HashLog::hash_type parameters {HashLog::values(std::vector<double> {
+        culvert_insert_area_.ulx(), culvert_insert_area_.uly(),
+        culvert_insert_area_.lrx(), culvert_insert_area_.lry(),
+        road_buffer_width_,
+        culvert_len_lims_.first, culvert_len_lims_.second,
+        ps.min_carving_cost, ps.min_culvert_saving, ps.min_carving_single,
+        ps.min_flow_accum, ps.ignore_dist_same_iter, ps.ignore_dist})};
+    return HashLog::values(std::vector<HashLog::hash_type> {
+        HashLog::grid(dem_orig_), HashLog::grid(roads_), parameters});
+}
+
+void CulvertPipeline::record_hashes(const std::string & label)
+{
+    if (!hash_log_) return;
+    // the flow accumulation spills the carving in the memory-lean mode
+    const HashLog::hash_type acc {HashLog::grid(accumulated())};
+    const HashLog::hash_type fd {HashLog::grid(flowdirs())};
+    const HashLog::hash_type dem {HashLog::grid(carved_dem())};
+    hash_log_->record(label, {
+        {"dem_wrk", dem},
+        {"flowdirs", fd},
+        {"accumulated", acc},
+        {"culverts", HashLog::culverts(culverts_)}});
+}
+
+cprops CulvertPipeline::culvert_props(const Culvert<DeltaDemDatatype> & c)
+{
+    auto & props = culvert_props_.at(c.id());
+    std::get<1>(props) = accumulated().data()[c.sink()];
+    return props;
+}
+
+const CellGrid<acc_type, ct> & CulvertPipeline::accumulated()
+{
+    stages_.require(accumulation_stage_);
+    return accumulated_;
+}
+
+const FlowDirClass_t & CulvertPipeline::flowdirs()
+{
+    stages_.require(carving_stage_);
+    return flowdirs_;
+}
+
+const DeltaDem_t & CulvertPipeline::delta_dem()
+{
+    stages_.require(burn_stage_);
+    restore(delta_dem_, delta_dem_spill_);
+    return delta_dem_;
+}
+
+const DemClass_t & CulvertPipeline::carved_dem()
+{
+    stages_.require(carving_stage_);
+    restore(dem_wrk_, dem_wrk_spill_, dem_orig_.data());
+    return dem_wrk_;
+}
+
+size_t CulvertPipeline::seed_from_coarse(
+    unsigned int factor,
+    const ParameterSet & ps)
+{
+    if (factor < 2) return 0;
+    stages_.require(road_stage_);
+    restore_roads();
+
+    // the sinks of the culverts placed on the coarse grids
+    std::vector<ct> coarse_sinks;
+    {
+        const geo::RasterArea area {
+            multires::coarse_area(dem_orig_.area(), factor)};
+        DemClass_t dem {area, "coarse DEM", pool_};
+        if (dem_orig_.has_no_data_value()) {
+            dem.no_data_value(dem_orig_.no_data_value());
+        }
+        multires::downsample_dem(dem_orig_, dem, factor);
+        CellGrid<road_id_type, ct> roads {dem, "coarse roads", pool_};
+        roads.no_data_value(0);
+        multires::downsample_roads(roads_, roads,
+            static_cast<road_id_type>(1), factor);
+        DemClass_t dem_wrk {dem, "coarse dem_wrk", pool_, !lean_};
+        CellGrid<acc_type, ct> accumulated {
+            dem, "coarse flow_accum", pool_, !lean_};
+
+        logging::pLog() << "Placing the culverts on the grids downsampled "
+            "by " << factor << ".";
+        logging::LogIndent li;
+        // The road buffer is measured in cells and the longest culvert in
+        // meters, but the shortest culvert is three cells, so the buffer
+        // is not narrowed to leave room for the culverts.
+        CulvertPipeline coarse {dem, roads, dem_wrk, accumulated, pool_,
+            culvert_insert_area_, road_buffer_width_, lean_};
+        coarse.place_culverts(multires::coarse_parameters(ps, factor),
+            "", false);
+        for (const auto & c: coarse.culverts()) {
+            coarse_sinks.push_back(
+                coarse.culverts().to_raster_coordinate(c.sink()));
+        }
+    }
+
+    const size_t n_before {culverts_.size()};
+    const unsigned int nx {dem_orig_.px_width()};
+    const unsigned int ny {dem_orig_.px_height()};
+    const DemDataType * dem_data {dem_orig_.data()};
+    const road_id_type * road_data {roads_.data()};
+    std::unique_ptr<DemDataType> cost_window;
+    ct c_min {0, 0};
+    ct c_max {0, 0};
+    for (const ct & s: coarse_sinks) {
+        // the lowest cell of the road buffer in the block of the sink
+        bool found {false};
+        ct start {0, 0};
+        const unsigned int row1 {std::min((s.row() + 1) * factor, ny)};
+        const unsigned int col1 {std::min((s.col() + 1) * factor, nx)};
+        for (unsigned int row = s.row() * factor; row < row1; ++row) {
+            for (unsigned int col = s.col() * factor; col < col1; ++col) {
+                const size_t ind {static_cast<size_t>(row) * nx + col};
+                if (road_data[ind] <= 1) continue;
+                if (!found || dem_data[ind] <
+                    dem_data[coordinates::to_raster_index(start, nx)])
+                {
+                    start = ct {col, row};
+                    found = true;
+                }
+            }
+        }
+        if (!found) continue;
+
+        auto ret = ICA_.find_alternative_carving_near_roads(
+            dem_orig_,
+            roads_,
+            road_sides_,
+            culvert_insert_area_,
+            start,
+            std::numeric_limits<DemDataType>::max(),
+            culvert_len_lims_,
+            cost_window, c_min, c_max);
+        if (!ret.second) continue;
+
+        Culvert<DeltaDemDatatype> culvert {
+            coordinates::to_raster_index(start, nx),
+            coordinates::to_raster_index(ret.first, nx),
+            next_free_culvert_id_};
+        bool too_close {false};
+        for (const auto & c: culverts_) {
+            if (culverts_.center_distance(culvert, c) < ps.ignore_dist) {
+                too_close = true;
+                break;
+            }
+        }
+        if (too_close) continue;
+
+        culverts_.push_back(culvert);
+        culvert_props_[next_free_culvert_id_] = std::make_tuple(
+            next_free_culvert_id_,
+            std::numeric_limits<acc_type>::max());
+        ++next_free_culvert_id_;
+        search_cache_.invalidate(start);
+        search_cache_.invalidate(ret.first);
+    }
+
+    const size_t n_seeded {culverts_.size() - n_before};
+    logging::pLog() << "Seeded " << n_seeded << " of the "
+        << coarse_sinks.size() << " culverts of the coarse grids.";
+    culverts_updated(n_before);
+    return n_seeded;
+}
+
+void CulvertPipeline::place_culverts(
+    const ParameterSet & ps,
+    const std::string & checkpoint_file,
+    bool resume)
+{
+    stages_.require(road_stage_);
+    track_depressions(ps.min_culvert_saving > 0);
+    unsigned int iter {0};
+    const HashLog::hash_type inputs {checkpoint_file.empty() ?
+        0 : inputs_hash(ps)};
+    if (resume && !checkpoint_file.empty()) {
+        if (checkpoint::read(checkpoint_file, inputs, culverts_, culvert_props_,
+            next_free_culvert_id_, iter))
+        {
+            logging::pLog() << "Resuming from " << checkpoint_file
+                << " at iteration " << iter << " with "
+                << culverts_.size() << " culverts.";
+            stages_.invalidate(culverts_changed_);
+        }
+    }
+    while (true)
+    {
+        logging::pLog() << "Starting iteration " << iter;
+        const size_t n_culverts_before_iter {culverts_.size()};
+
+        stages_.require(carving_stage_);
+        if (lean_) {
+            restore_roads();
+            restore(dem_wrk_, dem_wrk_spill_, dem_orig_.data());
+            depressions_.restore();
+            spill(delta_dem_, delta_dem_spill_);
+            // the scratch arrays of the carving would stay in the pool
+            // through the culvert placing
+            pool_.clear();
+        }
+
+        // start the culvert placing procedure
+        std::list<Culvert<DeltaDemDatatype>> added_this_iter;
+        bool algorithm_exp_carvs_done {false};
+        bool algorithm_intersect_done {false};
+
+        {
+            insert_culverts_to_expensive_carvings(
+                dem_orig_,
+                dem_wrk_,
+                flowdirs_,
+                roads_,
+                road_sides_,
+                track_depressions_ ? &depressions_ : nullptr,
+                culvert_insert_area_,
+                search_cache_,
+                culverts_,
+                culvert_props_,
+                next_free_culvert_id_,
+                algorithm_exp_carvs_done,
+                iter,
+                ps.min_carving_cost,
+                ps.min_culvert_saving,
+                culvert_len_lims_,
+                ps.min_carving_single,
+                ps.ignore_dist_same_iter,
+                ps.ignore_dist);
+            culverts_updated(n_culverts_before_iter);
+        }
+        if (algorithm_exp_carvs_done)
+        {
+            const size_t n_before {culverts_.size()};
+            stages_.require(accumulation_stage_);
+            restore_roads();
+            restore(delta_dem_, delta_dem_spill_);
+            insert_culverts_to_stream_road_intersections(
+                dem_orig_,
+                flowdirs_,
+                delta_dem_,
+                accumulated_,
+                roads_,
+                road_sides_,
+                road_index_,
+                culvert_insert_area_,
+                next_free_culvert_id_,
+                culverts_,
+                culvert_props_,
+                {1, 2},
+                added_this_iter,
+                algorithm_intersect_done,
+                iter,
+                static_cast<acc_type>(ps.min_flow_accum),
+                culvert_len_lims_,
+                ps.ignore_dist_same_iter,
+                ps.ignore_dist);
+            culverts_updated(n_before);
+        }
+
+        for (size_t i = n_culverts_before_iter; i < culverts_.size(); ++i) {
+            search_cache_.invalidate(
+                culverts_.to_raster_coordinate(culverts_[i].sink()));
+            search_cache_.invalidate(
+                culverts_.to_raster_coordinate(culverts_[i].source()));
+        }
+
+        record_hashes("iteration_" + std::to_string(iter));
+
+        if (added_this_iter.size() == 0 &&
+            algorithm_intersect_done &&
+            algorithm_exp_carvs_done)
+        {
+            break;
+        }
+
+        ++iter;
+
+        if (!checkpoint_file.empty()) {
+            checkpoint::write(checkpoint_file, inputs, culverts_, culvert_props_,
+                next_free_culvert_id_, iter);
+        }
+    }
+
+    // Remove the culverts through which no water is flowing.
+    {
+        logging::pLog() << "Removing unused culverts...";
+        stages_.require(accumulation_stage_);
+        CulvertSet<DeltaDemDatatype> proper_culverts {culverts_.area()};
+        for (const auto &c: culverts_)
+        {
+            auto sink = culverts_.to_raster_coordinate(c.sink());
+            auto source = culverts_.to_raster_coordinate(c.source());
+
+            auto fd = flowdirs_.data()[c.sink()];
+            auto source_ = move_coord(sink, {fd.x, fd.y},
+                flowdirs_.px_width(),
+                flowdirs_.px_height());
+            if (source_ != sink && source_ == source) {
+                if (accumulated_.data()[c.sink()] > 0) {
+                    proper_culverts.push_back(c);
+                }
+            } else if (c.two_way()) {
+                fd = flowdirs_.data()[c.source()];
+                source_ = move_coord(source, {fd.x, fd.y},
+                    flowdirs_.px_width(),
+                    flowdirs_.px_height());
+                if (source_ != source && source_ == sink) {
+                    if (accumulated_.data()[c.source()] > 0)
+                    {
+                        proper_culverts.push_back(c);
+                    }
+                }
+            }
+        }
+        auto n_rejected = culverts_.size() - proper_culverts.size();
+        if (n_rejected > 0) {
+            logging::pLog() << " " << n_rejected
+                << " culverts removed.";
+            culverts_.swap(proper_culverts);
+            stages_.invalidate(culverts_changed_);
+        } else {
+            logging::pLog() << "  no unused culverts found.";
+        }
+    }
+
+    logging::pLog() << "The final culvert placing iteration.";
+    std::list<Culvert<DeltaDemDatatype>> added_this_iter_;
+    bool done_ {false};
+    const size_t n_before_final {culverts_.size()};
+    stages_.require(accumulation_stage_);
+    restore_roads();
+    restore(delta_dem_, delta_dem_spill_);
+    insert_culverts_to_stream_road_intersections(
+        dem_orig_,
+        flowdirs_,
+        delta_dem_,
+        accumulated_,
+        roads_,
+        road_sides_,
+        road_index_,
+        culvert_insert_area_,
+        next_free_culvert_id_,
+        culverts_,
+        culvert_props_,
+        {2},
+        added_this_iter_,
+        done_,
+        iter + 1,
+        static_cast<acc_type>(ps.min_flow_accum),
+        culvert_len_lims_,
+        ps.ignore_dist_same_iter,
+        ps.ignore_dist);
+
+    logging::pLog() << "Added " << added_this_iter_.size() << " culverts.";
+    culverts_updated(n_before_final);
+    record_hashes("final");
+}
@@ -0,0 +1,224 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef CULVERT_PIPELINE_H_
+#define CULVERT_PIPELINE_H_
+
+#include <map>
+#include <string>
+#include <utility>
+
+#include "defs.h"
+#include "CulvertSearchCache.h"
+#include "CulvertSet.h"
+#include "DepressionHierarchy.h"
+#include "GridPool.h"
+#include "GridSpill.h"
+#include "hash_log.h"
+#include "InsertCulvertAlgorithm.h"
+#include "ParameterSet.h"
+#include "RoadIndex.h"
+#include "StageRunner.h"
+#include "TaskGraph.h"
+
+/**
+ * \brief The carving and culvert placing pipeline of one area.
+ *
+ * The caller owns the input DEM, the roads and the output grids (the
+ * carved DEM and the flow accumulation), so they can be read from files,
+ * taken from a pool or view the caller's arrays. The other grids are
+ * taken from the pool.
+ *
+ * The roads are prepared (the road buffer, the ids of its segments and
+ * the sides of the roads) and the grids derived from the culverts are
+ * computed lazily: each stage is run only when its result is needed and
+ * the culverts have changed since it was computed. The preparation of the
+ * roads and the first carving can also be run at the same time through
+ * add_preparation().
+ *
+ * In the memory-lean mode, the grids are allocated when a stage first
+ * needs them. Between the stages, the grids that the next stage does not
+ * read are freed if they will be computed again, and spilled into a
+ * run-length form if they will be read again.
+ */
+class CulvertPipeline
+{
+    public:
+        /**
+         * \param roads The roads, non-zero on the road cells. The road
+         * buffer and the ids of its segments are written into it.
+         * \param dem_wrk, accumulated The carved DEM and the flow
+         * accumulation, in the area of the DEM.
+         *
+         * The DEM and the roads are read only by the stages, so they can
+         * be filled after the construction.
+         */
+        CulvertPipeline(
+            const DemClass_t & dem,
+            CellGrid<road_id_type, ct> & roads,
+            DemClass_t & dem_wrk,
+            CellGrid<acc_type, ct> & accumulated,
+            GridPool & pool,
+            const geo::RasterArea & culvert_insert_area,
+            double road_buffer_width,
+            bool memory_lean);
+
+        CulvertPipeline(const CulvertPipeline &) = delete;
+        CulvertPipeline & operator=(const CulvertPipeline &) = delete;
+
+        /**
+         * \brief Add the preparation of the roads and the first carving to
+         * the graph, to run after the tasks that fill the roads and the
+         * DEM. The roads are not read by the carving, so the two run at
+         * the same time except in the memory-lean mode.
+         *
+         * \return The tasks after which the pipeline is prepared.
+         */
+        std::vector<TaskGraph::task_id> add_preparation(
+            TaskGraph & graph,
+            const std::vector<TaskGraph::task_id> & dem_filled,
+            const std::vector<TaskGraph::task_id> & roads_filled);
+
+        /**
+         * \brief Place the culverts first on the DEM and the roads
+         * downsampled by \a factor, and add them as the first culverts of
+         * this pipeline, so that place_culverts() only refines them and
+         * finds the smaller streams.
+         *
+         * Each coarse culvert is placed again from the lowest road buffer
+         * cell of the block of its sink, as on an expensive carving. The
+         * culverts that cannot be placed there or are closer than
+         * ps.ignore_dist to the other culverts are dropped, and the
+         * culverts without flow are removed by place_culverts().
+         *
+         * \return The number of culverts added.
+         */
+        size_t seed_from_coarse(unsigned int factor, const ParameterSet & ps);
+
+        /**
+         * \brief Place the culverts with the thresholds of \a ps, after
+         * the culverts placed so far.
+         *
+         * The state is saved into checkpoint_file (if not empty) after
+         * each iteration, and with \a resume it is first read from the
+         * file if the file exists.
+         */
+        void place_culverts(
+            const ParameterSet & ps,
+            const std::string & checkpoint_file,
+            bool resume);
+
+        /**
+         * \brief Record the depressions while carving, for estimating the
+         * culvert savings (a positive min_culvert_saving). Set before the
+         * first carving: turning it on later carves again. place_culverts()
+         * sets it from its parameters.
+         */
+        void track_depressions(bool track);
+
+        /**
+         * \brief Record the hashes of the carved DEM, the flow directions,
+         * the flow accumulation and the culverts into \a log after each
+         * culvert placing iteration and at the end. The grids are then
+         * computed after each iteration, also when the next iteration
+         * would not need them.
+         */
+        void hash_log(HashLog * log) { hash_log_ = log; }
+
+        const CulvertSet<DeltaDemDatatype> & culverts() const {
+            return culverts_; }
+
+        /**
+         * \brief The properties of the culvert, with the current flow
+         * through it.
+         */
+        cprops culvert_props(const Culvert<DeltaDemDatatype> & c);
+
+        /**
+         * \brief The grids of the current culverts, computed if needed.
+         */
+        const CellGrid<acc_type, ct> & accumulated();
+        const FlowDirClass_t & flowdirs();
+        const DeltaDem_t & delta_dem();
+        const DemClass_t & carved_dem();
+
+    private:
+        const DemClass_t & dem_orig_;
+        CellGrid<road_id_type, ct> & roads_;
+        DemClass_t & dem_wrk_;
+        CellGrid<acc_type, ct> & accumulated_;
+        GridPool & pool_;
+        const geo::RasterArea culvert_insert_area_;
+        const double road_buffer_width_;
+        const std::pair<double, double> culvert_len_lims_;
+        const bool lean_;
+
+        DirtyTiles::version_type dem_wrk_restored_ {0};
+        DeltaDem_t delta_dem_;
+        DirtyTiles::version_type delta_dem_cleared_ {0};
+        FlowDirClass_t flowdirs_;
+        // not used in the memory-lean mode, see the carving stage
+        CarvedCells_t carved_cells_;
+        DirtyTiles::version_type carved_cells_cleared_ {0};
+        CellGrid<road_id_type, ct> road_sides_;
+
+        GridSpill<road_id_type> roads_spill_;
+        GridSpill<road_id_type> road_sides_spill_;
+        GridSpill<DeltaDemDatatype> delta_dem_spill_;
+        GridSpill<DemDataType> dem_wrk_spill_;
+
+        CulvertSet<DeltaDemDatatype> culverts_;
+        DeltaDemDatatype next_free_culvert_id_ {1};
+        std::map<DeltaDemDatatype, cprops> culvert_props_;
+
+        InsertCulvertAlgorithm ICA_;
+        // The depressions met by the latest carving, for estimating the
+        // effect of the culvert candidates. They are recorded only while
+        // the culvert savings are estimated (min_culvert_saving > 0).
+        DepressionHierarchy<DemDataType, ct> depressions_;
+        bool track_depressions_ {false};
+        // The road related scans go through the road cells only.
+        RoadIndex road_index_;
+        // The results of the culvert location searches are kept over the
+        // iterations, and dropped around the culverts inserted in each
+        // iteration.
+        CulvertSearchCache<DemDataType, ct> search_cache_;
+
+        HashLog * hash_log_ {nullptr};
+
+        StageRunner stages_;
+        // roads and road_sides
+        StageRunner::stage_id road_stage_;
+        StageRunner::stage_id culverts_changed_;
+        StageRunner::stage_id depression_tracking_;
+        // delta_dem
+        StageRunner::stage_id burn_stage_;
+        // dem_wrk, flowdirs, carved_cells and depressions
+        StageRunner::stage_id carving_stage_;
+        // accumulated
+        StageRunner::stage_id accumulation_stage_;
+
+        void burn();
+        void carve();
+        void accumulate();
+        void prepare_roads();
+        void spill_roads();
+        void restore_roads();
+
+        // the hash of the inputs and the parameters of the checkpoints
+        HashLog::hash_type inputs_hash(const ParameterSet & ps);
+        void record_hashes(const std::string & label);
+
+        // Tell the stages if the culverts have changed since n_before.
+        void culverts_updated(size_t n_before);
+};
+
+#endif
@@ -26,7 +26,10 @@ using StreamDataType = unsigned short;
 using DeltaDemDatatype = unsigned int;
 using FlowDirDataType = int2;
 using acc_type = unsigned int;
-using road_id_type = unsigned short;
+// The roads are read from an unsigned 16 bit raster, but the road segment
+// ids need a wider type.
+using road_raster_type = unsigned short;
+using road_id_type = unsigned int;
 
 //using cprops = std::tuple<DeltaDemDatatype, double, double, acc_type, unsigned int, unsigned int, std::string>;
 using cprops = std::tuple<DeltaDemDatatype, acc_type>;
@@ -0,0 +1,173 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "hash_log.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+
+#include "parallel.h"
+
+namespace {
+
+    // FNV-1a
+    const HashLog::hash_type fnv_offset {14695981039346656037ull};
+    const HashLog::hash_type fnv_prime {1099511628211ull};
+
+    HashLog::hash_type fnv(
+        const unsigned char * data,
+        size_t n,
+        HashLog::hash_type h = fnv_offset)
+    {
+        for (size_t i = 0; i < n; ++i) {
+            h ^= data[i];
+            h *= fnv_prime;
+        }
+        return h;
+    }
+
+    template<typename T>
+    HashLog::hash_type fnv_value(const T & v, HashLog::hash_type h)
+    {
+        return fnv(reinterpret_cast<const unsigned char *>(&v), sizeof(T), h);
+    }
+
+    /*
+     * The line of the record.
+     */
+    std::string format(
+        const std::string & label,
+        const std::vector<std::pair<std::string, HashLog::hash_type>> & hashes)
+    {
+        std::ostringstream line;
+        line << label;
+        for (const auto & h: hashes) {
+            line << " " << h.first << "=" << std::hex << std::setw(16)
+                << std::setfill('0') << h.second << std::dec;
+        }
+        return line.str();
+    }
+
+    /*
+     * The words of the line.
+     */
+    std::vector<std::string> words(const std::string & line)
+    {
+        std::istringstream in {line};
+        std::vector<std::string> ret;
+        std::string w;
+        while (in >> w) ret.push_back(w);
+        return ret;
+    }
+
+}
+
+HashLog::HashLog(
+    const std::string & write_file,
+    const std::string & verify_file):
+        verify_file_ {verify_file}
+{
+    if (!write_file.empty()) {
+        out_.open(write_file);
+        if (!out_) {
+            throw std::runtime_error("Cannot open the hash log " +
+                write_file + ".");
+        }
+    }
+    if (!verify_file.empty()) {
+        in_.open(verify_file);
+        if (!in_) {
+            throw std::runtime_error("Cannot open the hash log " +
+                verify_file + ".");
+        }
+    }
+}
+
+void HashLog::record(
+    const std::string & label,
+    const std::vector<std::pair<std::string, hash_type>> & hashes)
+{
+    const std::string line {format(label, hashes)};
+    if (out_.is_open()) {
+        out_ << line << std::endl;
+    }
+    if (!in_.is_open()) return;
+
+    std::string expected;
+    if (!std::getline(in_, expected)) {
+        throw std::runtime_error("The record " + label + " is not in the "
+            "hash log " + verify_file_ + ".");
+    }
+    auto got = words(line);
+    auto want = words(expected);
+    if (want.empty() || want.front() != label) {
+        throw std::runtime_error("Expected the record " + label +
+            " in the hash log " + verify_file_ + ", found \"" + expected +
+            "\".");
+    }
+    for (size_t k = 1; k < got.size(); ++k) {
+        if (k >= want.size() || got[k] != want[k]) {
+            throw std::runtime_error("The hashes differ from the hash log " +
+                verify_file_ + " at " + label + ": " + got[k] +
+                (k < want.size() ? " instead of " + want[k] : "") + ".");
+        }
+    }
+}
+
+void HashLog::finish()
+{
+    if (!in_.is_open()) return;
+    std::string extra;
+    while (std::getline(in_, extra)) {
+        if (!extra.empty()) {
+            throw std::runtime_error("The run ended before the record \"" +
+                extra + "\" of the hash log " + verify_file_ + ".");
+        }
+    }
+}
+
+HashLog::hash_type HashLog::bytes(const void * data, size_t n)
+{
+    const size_t block {size_t {1} << 20};
+    const size_t n_blocks {(n + block - 1) / block};
+    const unsigned char * d {static_cast<const unsigned char *>(data)};
+    std::vector<hash_type> block_hashes(n_blocks);
+    parallel::for_each_task(n_blocks, [&](size_t b)
+    {
+        block_hashes[b] = fnv(d + b * block,
+            std::min(block, n - b * block));
+    });
+    hash_type h {fnv_value(n, fnv_offset)};
+    for (auto bh: block_hashes) {
+        h = fnv_value(bh, h);
+    }
+    return h;
+}
+
+HashLog::hash_type HashLog::culverts(const CulvertSet<DeltaDemDatatype> & c)
+{
+    std::vector<std::tuple<size_t, size_t, DeltaDemDatatype>> sorted;
+    sorted.reserve(c.size());
+    for (const auto & culvert: c) {
+        sorted.emplace_back(culvert.sink(), culvert.source(), culvert.id());
+    }
+    std::sort(sorted.begin(), sorted.end());
+    hash_type h {fnv_value(sorted.size(), fnv_offset)};
+    for (const auto & t: sorted) {
+        h = fnv_value(std::get<0>(t), h);
+        h = fnv_value(std::get<1>(t), h);
+        h = fnv_value(std::get<2>(t), h);
+    }
+    return h;
+}
@@ -0,0 +1,94 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef HASH_LOG_H_
+#define HASH_LOG_H_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "defs.h"
+#include "CulvertSet.h"
+
+/**
+ * \brief The content hashes of the state of the culvert placing, for
+ * comparing the runs made e.g. with different numbers of threads.
+ *
+ * Each record is a line "<label> <name>=<hash> ...". The records are
+ * written into a file, compared with the records of an earlier run, or
+ * both.
+ */
+class HashLog
+{
+    public:
+        using hash_type = std::uint64_t;
+
+        /**
+         * \param write_file The file the records are written into, or
+         * empty.
+         * \param verify_file The file of an earlier run the records are
+         * compared with, or empty.
+         */
+        HashLog(
+            const std::string & write_file,
+            const std::string & verify_file);
+
+        /**
+         * \brief Write and compare the record \a label.
+         *
+         * Throws std::runtime_error at the first record that differs from
+         * the earlier run, or is missing from it.
+         */
+        void record(
+            const std::string & label,
+            const std::vector<std::pair<std::string, hash_type>> & hashes);
+
+        /**
+         * \brief Throw std::runtime_error if the earlier run had more
+         * records.
+         */
+        void finish();
+
+        /**
+         * \brief The hash of the bytes of the array of the grid. The
+         * array is hashed in blocks of a fixed size on the worker
+         * threads, so the hash does not depend on their number.
+         */
+        template<typename T>
+        static hash_type grid(const CellGrid<T, ct> & g) {
+            return bytes(g.data(), g.px_size() * sizeof(T)); }
+
+        /**
+         * \brief The hash of the values, e.g. of the hashes and the
+         * parameters of a computation.
+         */
+        template<typename T>
+        static hash_type values(const std::vector<T> & v) {
+            return bytes(v.data(), v.size() * sizeof(T)); }
+
+        /**
+         * \brief The hash of the sinks, sources and ids of the culverts,
+         * in the order of the sinks and the sources.
+         */
+        static hash_type culverts(const CulvertSet<DeltaDemDatatype> & c);
+
+    private:
+        std::ofstream out_;
+        std::ifstream in_;
+        std::string verify_file_;
+
+        static hash_type bytes(const void * data, size_t n);
+};
+
+#endif
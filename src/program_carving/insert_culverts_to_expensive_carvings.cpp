@@ -12,20 +12,145 @@
 #include "insert_culverts_to_expensive_carvings.h"
 
 #include "InsertCulvertAlgorithm.h"
+#include "drainage_basins.h"
+#include "parallel.h"
 //#include "write_to_file.h"
 
+namespace {
+
+    // The state of the culvert placing that the expensive carvings share.
+    struct PlacingState
+    {
+        // upstream points to which a culvert has been tried to insert already
+        std::set<ct> tested_cells;
+        // The endpoints of the inserted culverts
+        std::vector<ct> inserted_endpoints;
+        // the estimated carving cost saved by the inserted culverts
+        double estimated_saving {0.0};
+    };
+
+    enum class PlacingResult { none, inserted, skipped };
+
+    /*
+     * Follow the expensive carving from the upstream point downhill and try
+     * to find better carving route for each point that is close enough to a
+     * road. The route from a point is given by search(upstream, full_cost),
+     * and insert(upstream, location) places the culvert, or returns false if
+     * there is a culvert too close. A route is rejected without inserting if
+     * the depression hierarchy estimates that the culvert saves less than
+     * min_saving of the carving. Without the hierarchy, nothing is
+     * estimated or rejected.
+     */
+    template<typename S, typename I>
+    PlacingResult place_culvert_on_carving(
+        const DemClass_t & dem,
+        const DemClass_t & dem_wrk,
+        const FlowDirClass_t & flowdirs,
+        const CellGrid<road_id_type, ct> & roads,
+        const DepressionHierarchy<DemDataType, ct> * depressions,
+        DemDataType full_cost,
+        ct upstream,
+        const ct & downstream,
+        double min_carving_cost,
+        double min_saving,
+        double ignore_r2,
+        PlacingState & state,
+        S search,
+        I insert)
+    {
+        const DemDataType * dem_data {dem.data()};
+        const DemDataType * carved_data {dem_wrk.data()};
+        double cost {static_cast<double>(full_cost)};
+        const size_t ind_pit {coordinates::to_raster_index(
+            upstream.col(), upstream.row(), dem.px_width())};
+        while (true)
+        {
+            if (upstream == downstream) {
+                break;
+            }
+            size_t ind_upstream {coordinates::to_raster_index(
+                upstream.col(), upstream.row(), roads.px_width())};
+            auto fd = flowdirs.data()[ind_upstream];
+            bool follow_to_next {false};
+            {
+                auto c_next = coordinates::move_coord(upstream, {fd.x, fd.y},
+                    dem.px_width(), dem.px_height());
+                size_t ind_next = coordinates::to_raster_index(
+                    c_next.col(), c_next.row(), dem.px_width());
+                if (dem_data[ind_next] < dem_data[ind_upstream] &&
+                    (cost - static_cast<double>(dem_data[ind_next] - carved_data[ind_next])) >= min_carving_cost) {
+                    follow_to_next = true;
+                }
+            }
+            if (state.tested_cells.count(upstream)) {
+                break;
+            }
+            state.tested_cells.insert(upstream);
+            if (cost < min_carving_cost) {
+                break;
+            }
+            auto road_id = roads.data()[ind_upstream];
+            if (road_id < static_cast<road_id_type>(2)) {
+                follow_to_next = true;
+            }
+            for (const auto &c: state.inserted_endpoints) {
+                if (static_cast<double>((c - upstream).norm_squared()) <= ignore_r2) {
+                    return PlacingResult::skipped;
+                }
+            }
+
+            if (!follow_to_next)
+            {
+                // try to insert a culvert with the sink at the upstream
+                std::pair<ct, bool> ret {search(upstream, full_cost)};
+                double saving {0.0};
+                if (ret.second && depressions) {
+                    size_t ind_target {coordinates::to_raster_index(
+                        ret.first.col(), ret.first.row(), dem.px_width())};
+                    saving = depressions->estimate_saving(ind_pit, ind_target,
+                        dem_data[ind_target], cost);
+                }
+                if (ret.second && (!depressions || saving >= min_saving)) {
+                    if (!insert(upstream, ret.first)) {
+                        continue;
+                    }
+                    state.inserted_endpoints.push_back(upstream);
+                    state.inserted_endpoints.push_back(ret.first);
+                    state.estimated_saving += saving;
+                    return PlacingResult::inserted;
+                }
+            }
+            // the culvert placing failed, follow the flow directions to the
+            // next cell, subtract from the cost the difference and try again.
+
+            upstream = coordinates::move_coord(upstream, {fd.x, fd.y},
+                dem.px_width(), dem.px_height());
+            ind_upstream = coordinates::to_raster_index(
+                upstream.col(), upstream.row(), dem.px_width());
+            cost -= static_cast<double>(
+                dem_data[ind_upstream] - carved_data[ind_upstream]);
+        }
+        return PlacingResult::none;
+    }
+
+}
+
 void insert_culverts_to_expensive_carvings(
-    DemClass_t & dem,
+    const DemClass_t & dem,
     DemClass_t & dem_wrk,
     FlowDirClass_t & flowdirs,
     CellGrid<road_id_type, ct> & roads,
+    const CellGrid<road_id_type, ct> & road_sides,
+    const DepressionHierarchy<DemDataType, ct> * depressions,
     const geo::RasterArea & culvert_insert_area,
-    std::vector<Culvert<DeltaDemDatatype>> & culverts,
+    CulvertSearchCache<DemDataType, ct> & search_cache,
+    CulvertSet<DeltaDemDatatype> & culverts,
     std::map<DeltaDemDatatype, cprops> & culvert_props,
     DeltaDemDatatype & next_free_culvert_id,
     bool & finished,
     unsigned int /*iter*/,
     double min_carving_cost,
+    double min_culvert_saving,
     std::pair<double, double> culvert_length_limits,
     double min_hdiff,
     double ignore_in_same_iter_inside_radius,
@@ -64,171 +189,168 @@ void insert_culverts_to_expensive_carvings(
     //    pr.write_lines(lines, field_names, ss.str());
     //}
 
-    // upstream points to which a culvert has been tried to insert already
-    std::set<ct> tested_cells;
-    // The endpoints of the inserted culverts
-    std::vector<ct> inserted_endpoints;
-    // The endpoints of the inserted culverts in this iteration
-    //std::set<ct> inserted_downstreams_this_iter;
-    // endpoints of the expensive carvings that end up on the border of the grid
-    std::set<ct> used_border_endpoints;
+    double ignore_r2 {pow(ignore_in_same_iter_inside_radius, 2)};
+    using search_key = std::pair<ct, DemDataType>;
+    auto search_alternative = [&](
+        InsertCulvertAlgorithm & ica,
+        const ct & start,
+        DemDataType full_cost)
+    {
+        auto clims = culvert_length_limits;
+        std::unique_ptr<DemDataType> cost_ptr;
+        ct min_c {0, 0};
+        ct max_c {0, 0};
+        return ica.find_alternative_carving_near_roads(
+            dem, roads, road_sides,
+            culvert_insert_area,
+            start,
+            full_cost, clims,
+            cost_ptr, min_c, max_c);
+    };
+    auto too_close = [&](
+        const Culvert<DeltaDemDatatype> & cul,
+        const std::vector<Culvert<DeltaDemDatatype>> & more)
+    {
+        auto close = [&](const Culvert<DeltaDemDatatype> & c) {
+            return culverts.segment_distance(c, cul.source()) < ignore_radius ||
+                culverts.segment_distance(c, cul.sink()) < ignore_radius;
+        };
+        return std::any_of(culverts.begin(), culverts.end(), close) ||
+            std::any_of(more.begin(), more.end(), close);
+    };
+
+    // The carvings of different drainage basins share no cells, so the
+    // basins are first processed in parallel, each as if it were alone.
+    // The alternative carving searches made there are then reused when
+    // the carvings are processed in the original order, which also does
+    // the distance checks between the culverts of different basins.
+    std::map<search_key, std::pair<ct, bool>> speculated;
+    {
+        std::vector<size_t> carving_cells(exp_carvs.size());
+        for (size_t k = 0; k < exp_carvs.size(); ++k) {
+            const ct & c {std::get<0>(exp_carvs[k].second)};
+            carving_cells[k] = coordinates::to_raster_index(
+                c.col(), c.row(), dem.px_width());
+        }
+        auto basins = drainage_basins::group_cells_by_basin(
+            flowdirs, carving_cells);
+        std::vector<std::map<search_key, std::pair<ct, bool>>> searched(
+            basins.size());
+        // the logger is not used from the worker threads
+        std::vector<std::vector<std::string>> errors(basins.size());
+        parallel::for_each_task(basins.size(), [&](size_t b)
+        {
+            InsertCulvertAlgorithm ica;
+            ica.collect_errors(&errors[b]);
+            PlacingState state;
+            std::vector<Culvert<DeltaDemDatatype>> placed;
+            auto search = [&](const ct & start, DemDataType full_cost)
+            {
+                std::pair<ct, bool> ret;
+                if (search_cache.peek(start, full_cost, ret)) return ret;
+                auto it = searched[b].find({start, full_cost});
+                if (it != searched[b].end()) return it->second;
+                ret = search_alternative(ica, start, full_cost);
+                searched[b].insert({{start, full_cost}, ret});
+                return ret;
+            };
+            auto insert = [&](const ct & upstream, const ct & location)
+            {
+                auto cul = culverts.make(upstream, location,
+                    static_cast<DeltaDemDatatype>(0));
+                if (too_close(cul, placed)) return false;
+                placed.push_back(cul);
+                return true;
+            };
+            for (auto it = basins[b].rbegin(); it != basins[b].rend(); ++it) {
+                const auto & carving = exp_carvs[*it];
+                place_culvert_on_carving(dem, dem_wrk, flowdirs, roads,
+                    depressions,
+                    carving.first,
+                    std::get<0>(carving.second),
+                    std::get<1>(carving.second),
+                    min_carving_cost, min_culvert_saving, ignore_r2,
+                    state, search, insert);
+            }
+        });
+        for (auto & m: searched) {
+            speculated.insert(m.begin(), m.end());
+        }
+        for (const auto & basin_errors: errors) {
+            for (const auto & msg: basin_errors) logging::pErr() << msg;
+        }
+    }
+
+    PlacingState state;
+    const std::vector<Culvert<DeltaDemDatatype>> no_culverts;
     unsigned int n_skipped {0};
     unsigned int n_inserted {0};
-    double ignore_r2 {pow(ignore_in_same_iter_inside_radius, 2)};
     unsigned int n {0};
     unsigned int progress {0};
+    auto search = [&](const ct & start, DemDataType full_cost)
+    {
+        std::pair<ct, bool> ret;
+        if (!search_cache.find(start, full_cost, ret)) {
+            auto it = speculated.find({start, full_cost});
+            ret = it != speculated.end() ?
+                it->second : search_alternative(ICA, start, full_cost);
+            search_cache.insert(start, full_cost, ret);
+        }
+        return ret;
+    };
+    auto insert = [&](const ct & upstream, const ct & location)
+    {
+        // The placing algorithm returned a valid location, now check that
+        // there are no culverts too close to the given location.
+        Culvert<DeltaDemDatatype> cul {culverts.make(
+            upstream, location, next_free_culvert_id)};
+        if (too_close(cul, no_culverts)) return false;
+        culverts.push_back(cul);
+        culvert_props[next_free_culvert_id] = std::make_tuple(
+            next_free_culvert_id,
+            //full_cost,
+            //std::get<2>(it->second),
+            std::numeric_limits<acc_type>::max()
+            //iter,
+            //false,
+            //"expensive carving"
+            );
+        ++n_inserted;
+        ++next_free_culvert_id;
+        return true;
+    };
     for (auto it = exp_carvs.rbegin(); it != exp_carvs.rend(); ++it)
     {
-        const DemDataType * dem_data {dem.data()};
-        const DemDataType * carved_data {dem_wrk.data()};
-        const auto full_cost = it->first;
-        double cost {static_cast<double>(full_cost)};
-        auto upstream = std::get<0>(it->second);
-        const auto downstream = std::get<1>(it->second);
-        geo::PixelCenterCoordinate gupstream {dem.to_geocoordinate(upstream)};
         ++n;
         if ((n * 10) / exp_carvs.size() > progress) {
             logging::pLog() << (progress * 10) << " % searched.";
             progress = static_cast<unsigned int>((n * 10) / exp_carvs.size());
         }
-        //logging::pLog();
-        //logging::pLog() << "expensive carving " << n << "/" <<
-        //    exp_carvs.size() << "  " << gupstream << " -> " << gdownstream;
-
-        // Follow the expensive carving from the upstream point
-        // downhill and try to find better carving route for each
-        // point that is close enough to a road.
-        //while (upstream != downstream)
-        while (true)
-        {
-            if (upstream == downstream) {
-                break;
-            }
-            size_t ind_upstream {coordinates::to_raster_index(
-                upstream.col(), upstream.row(), roads.px_width())};
-            auto fd = flowdirs.data()[ind_upstream];
-            bool ignore_point {false};
-            bool follow_to_next {false};
-            {
-                auto c_next = coordinates::move_coord(upstream, {fd.x, fd.y},
-                    dem.px_width(), dem.px_height());
-                size_t ind_next = coordinates::to_raster_index(
-                    c_next.col(), c_next.row(), dem.px_width());
-                if (dem_data[ind_next] < dem_data[ind_upstream] &&
-                    (cost - static_cast<double>(dem_data[ind_next] - carved_data[ind_next])) >= min_carving_cost) {
-                    follow_to_next = true;
-                }
-            }
-            if (tested_cells.count(upstream)) {
-                break;
-            }
-            tested_cells.insert(upstream);
-            if (cost < min_carving_cost) {
-                break;
-            }
-            auto road_id = roads.data()[ind_upstream];
-            if (road_id < static_cast<road_id_type>(2)) {
-                follow_to_next = true;
-            }
+        PlacingResult result {place_culvert_on_carving(
+            dem, dem_wrk, flowdirs, roads,
+            depressions,
+            it->first,
+            std::get<0>(it->second),
+            std::get<1>(it->second),
+            min_carving_cost, min_culvert_saving, ignore_r2,
+            state, search, insert)};
+        if (result == PlacingResult::skipped) {
             // This carving matches the criteria and should be checked.
             // However, there was already a culvert inserted close, so we
             // set finished to false and see if the carving is still
             // present in the next iteration.
-            for (const auto &c: inserted_endpoints) {
-                if (static_cast<double>((c - upstream).norm_squared()) <= ignore_r2) {
-                    ignore_point = true;
-                    finished = false;
-                    ++n_skipped;
-                    break;
-                }
-            }
-
-            if (ignore_point) break;
-            if (!follow_to_next)
-            {
-                auto clims = culvert_length_limits;
-                std::unique_ptr<DemDataType> cost_ptr;
-                ct min_c {0, 0};
-                ct max_c {0, 0};
-                // try to insert a culvert with the sink at the upstream
-                auto ret = ICA.find_alternative_carving_near_roads(
-                    dem, roads,
-                    culvert_insert_area,
-                    upstream,
-                    full_cost, clims,
-                    cost_ptr, min_c, max_c);
-
-                if (ret.second) {
-                    // The placing algorithm returned a valid location, now
-                    // check that there are no culverts too close to the
-                    // given location.
-                    bool ok {true};
-                    auto a = dem.to_geocoordinate(ret.first);
-                    auto b = dem.to_geocoordinate(upstream);
-                    for (const auto &cul: culverts) {
-                        if (distance_from_segment(cul.sink(), cul.source(), a) < ignore_radius ||
-                            distance_from_segment(cul.sink(), cul.source(), b) < ignore_radius) {
-                            ok = false;
-                            break;
-                        }
-                    }
-                    if (!ok) {
-                        continue;
-                    }
-                    Culvert<DeltaDemDatatype> cul {
-                        dem.to_geocoordinate(upstream),
-                        dem.to_geocoordinate(ret.first),
-                        next_free_culvert_id };
-                    culverts.push_back(cul);
-                    culvert_props[next_free_culvert_id] = std::make_tuple(
-                        next_free_culvert_id,
-                        //full_cost,
-                        //std::get<2>(it->second),
-                        std::numeric_limits<acc_type>::max()
-                        //iter,
-                        //false,
-                        //"expensive carving"
-                        );
-                    ++n_inserted;
-                    //    unsigned int nx_ {max_c.col() - min_c.col() + 1};
-                    //    unsigned int ny_ {max_c.row() - min_c.row() + 1};
-                    //    std::fstream file;
-                    //    std::stringstream ss;
-                    //    ss << "window_" << std::setw(3) << std::setfill('_') << next_free_culvert_id;
-                    //    file.open(ss.str() + ".bin", std::ios::out|std::ios::binary|std::ios::trunc);
-                    //    file.write(reinterpret_cast<char*>(cost_ptr.get()), sizeof(DemDataType) * nx_ * ny_);
-                    //    file.close();
-                    //    file.open(ss.str() + ".hdr", std::ios::trunc|std::ios::out);
-                    //    file << std::fixed << std::setprecision(7);
-                    //    auto g = dem->to_geocoordinate(min_c);
-                    //    file << "ulxmap " << g.x() << std::endl;
-                    //    file << "ulymap " << g.y() << std::endl;
-                    //    file << "cellsize 1.0" << std::endl;
-                    //    file << "ncols " << nx_ << std::endl;
-                    //    file << "nrows " << ny_ << std::endl;
-                    //    file << "pixeltype floating" << std::endl;
-                    //    file << "nbits " << (sizeof(DemDataType) * 8) << std::endl;
-                    //    file << "byteorder lsbfirst" << std::endl;
-                    //}
-                    ++next_free_culvert_id;
-                    finished = false;
-                    inserted_endpoints.push_back(upstream);
-                    inserted_endpoints.push_back(ret.first);
-                    break;
-                }
-            }
-            // the culvert placing failed, follow the flow directions to the
-            // next cell, subtract from the cost the difference and try again.
-
-            upstream = coordinates::move_coord(upstream, {fd.x, fd.y},
-                dem.px_width(), dem.px_height());
-            ind_upstream = coordinates::to_raster_index(
-                upstream.col(), upstream.row(), dem.px_width());
-            cost -= static_cast<double>(
-                dem.data()[ind_upstream] - dem_wrk.data()[ind_upstream]);
-            gupstream = dem.to_geocoordinate(upstream);
+            ++n_skipped;
+            finished = false;
+        } else if (result == PlacingResult::inserted) {
+            finished = false;
         }
     }
+    std::ostringstream saving;
+    if (depressions) {
+        saving << ", estimated saving " << state.estimated_saving;
+    }
     logging::pLog() << "100 % searched (inserted " << n_inserted << " culverts, "
-        "skipped " << n_skipped << " possible carvings).";
+        "skipped " << n_skipped << " possible carvings, " <<
+        search_cache.hits() << " cached searches in total" << saving.str() <<
+        ").";
 }
@@ -13,20 +13,32 @@
 #define INSERT_CULVERTS_TO_EXPENSIVE_CARVINGS_H_
 
 #include "defs.h"
-#include "Culvert.h"
+#include "CulvertSet.h"
+#include "CulvertSearchCache.h"
+#include "DepressionHierarchy.h"
 
+/**
+ * \brief Insert culverts on the expensive carvings of dem_wrk.
+ *
+ * The depressions are needed only with a positive min_culvert_saving, and
+ * may otherwise be nullptr.
+ */
 void insert_culverts_to_expensive_carvings(
-    DemClass_t & dem,
+    const DemClass_t & dem,
     DemClass_t & dem_wrk,
     FlowDirClass_t & flowdirs,
     CellGrid<road_id_type, ct> & roads,
+    const CellGrid<road_id_type, ct> & road_sides,
+    const DepressionHierarchy<DemDataType, ct> * depressions,
     const geo::RasterArea & culvert_insert_area,
-    std::vector<Culvert<DeltaDemDatatype>> & culverts,
+    CulvertSearchCache<DemDataType, ct> & search_cache,
+    CulvertSet<DeltaDemDatatype> & culverts,
     std::map<DeltaDemDatatype, cprops> & culvert_props,
     DeltaDemDatatype & next_free_culvert_id,
     bool & finished,
     unsigned int iter,
     double min_carving_cost,
+    double min_culvert_saving,
     std::pair<double, double> culvert_length_limits,
     double min_hdiff,
     double ignore_on_same_iter_radius,
@@ -12,19 +12,22 @@
 #include "insert_culverts_to_road_stream_intersections.h"
 
 #include "InsertCulvertAlgorithm.h"
+#include "drainage_basins.h"
+#include "parallel.h"
 
 #include "global_parameters.h"
 
 void insert_culverts_to_stream_road_intersections(
-    DemClass_t & dem_orig,
+    const DemClass_t & dem_orig,
     FlowDirClass_t & flowdirs,
     DeltaDem_t & delta_dem,
-    DemClass_t & dem_wrk,
     CellGrid<acc_type, ct> & acc, // accumulated
     CellGrid<road_id_type, ct> & roads,
+    const CellGrid<road_id_type, ct> & road_sides,
+    const RoadIndex & road_index,
     const geo::RasterArea & culvert_insert_area,
     DeltaDemDatatype & next_free_culvert_id,
-    std::vector<Culvert<DeltaDemDatatype>> & culverts,
+    CulvertSet<DeltaDemDatatype> & culverts,
     std::map<DeltaDemDatatype, cprops> & culvert_props,
     const std::set<int> & use_algs,
     std::list<Culvert<DeltaDemDatatype>> & added_this_iter,
@@ -41,46 +44,65 @@ void insert_culverts_to_stream_road_intersections(
         finished = true;
 
         // locate where important streams cross roads
-        std::vector<ct> intersections;
-        for (unsigned short j = 0; j < acc.px_height(); ++j)
+        std::vector<size_t> intersections;
+        for (size_t ind: road_index.road_cells())
         {
-            for (unsigned short i = 0; i < acc.px_width(); ++i)
+            if (acc.data()[ind] >= accum_flow_threshold)
             {
-                if (acc.data()[j * acc.px_width() + i] >= accum_flow_threshold &&
-                    roads.data()[j * roads.px_width() + i] == 1)
-                {
-                    ct rc {i, j};
-                    bool skip {false};
-                    auto cn = acc.to_geocoordinate(rc);
-                    for (auto &c: added_this_iter) {
-                        if (distance(cn, c.center()) < ignore_radius_same_iter) {
-                            skip = true;
-                            break;
-                        }
+                bool skip {false};
+                for (auto &c: added_this_iter) {
+                    if (culverts.center_distance(c, ind) < ignore_radius_same_iter) {
+                        skip = true;
+                        break;
                     }
-                    if (skip) continue;
-                    intersections.push_back(rc);
                 }
+                if (skip) continue;
+                intersections.push_back(ind);
             }
         }
+
+        // The pit filling placement depends only on the input rasters, so
+        // it is done for all the intersections in parallel, one drainage
+        // basin at a time. The culverts get their ids below.
+        std::vector<std::pair<Culvert<DeltaDemDatatype>, bool>> pit_filled(
+            intersections.size(), {{0, 0, 0}, false});
+        if (use_algs.find(1) != use_algs.end()) {
+            auto basins = drainage_basins::group_cells_by_basin(
+                flowdirs, intersections);
+            // the logger is not used from the worker threads
+            std::vector<std::vector<std::string>> errors(basins.size());
+            parallel::for_each_task(basins.size(), [&](size_t b)
+            {
+                InsertCulvertAlgorithm ica;
+                ica.collect_errors(&errors[b]);
+                for (size_t k: basins[b]) {
+                    pit_filled[k] = ica.insert_culvert_pit_fill_upstream(
+                        dem_orig,
+                        roads,
+                        road_sides,
+                        flowdirs,
+                        culvert_insert_area,
+                        culvert_len_lims,
+                        static_cast<DeltaDemDatatype>(0),
+                        culverts.to_raster_coordinate(intersections[k]));
+                }
+            });
+            for (const auto & basin_errors: errors) {
+                for (const auto & msg: basin_errors) logging::pErr() << msg;
+            }
+        }
+
         //unsigned int n {0};
-        for (auto & rc: intersections)
+        for (size_t k = 0; k < intersections.size(); ++k)
         {
             //++n;
             //std::string descr("pit_filling");
+            ct rc {culverts.to_raster_coordinate(intersections[k])};
             std::pair<Culvert<DeltaDemDatatype>, bool> ret {
-                {{0, 0}, {0, 0}, 0}, false};
-            if (use_algs.find(1) != use_algs.end()) {
-                ret = ICA.insert_culvert_pit_fill_upstream(
-                    dem_orig,
-                    roads,
-                    flowdirs,
-                    dem_wrk,
-                    culvert_insert_area,
-                    culvert_len_lims,
-                    next_free_culvert_id,
-                    rc);
-            }
+                {pit_filled[k].first.sink(),
+                 pit_filled[k].first.source(),
+                 next_free_culvert_id},
+                pit_filled[k].second};
 
             if (!ret.second && use_algs.find(2) != use_algs.end()) {
                 ret = ICA.insert_culvert_along_flow_route(
@@ -98,7 +120,7 @@ void insert_culverts_to_stream_road_intersections(
                 bool too_close {false};
                 for (auto &c: culverts) {
                     //if (std::get<5>(culvert_props.at(c.id())) > 1) continue;
-                    if (distance(ret.first.center(), c.center()) < ignore_radius_any) {
+                    if (culverts.center_distance(ret.first, c) < ignore_radius_any) {
                         too_close = true;
                         break;
                     }
@@ -116,9 +138,7 @@ void insert_culverts_to_stream_road_intersections(
                     //"road/stream intersection(" + descr + ")"
                     );
                 ++next_free_culvert_id;
-                std::vector<Culvert<DeltaDemDatatype>> tmp;
-                tmp.push_back(ret.first);
-                ICA.burn_culverts(delta_dem, tmp);
+                ICA.burn_culvert(delta_dem, ret.first);
                 added_this_iter.push_back(ret.first);
                 finished = false;
             }
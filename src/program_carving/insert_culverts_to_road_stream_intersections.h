@@ -13,18 +13,20 @@
 #define INSERT_CULVERTS_TO_ROAD_STREAM_INTERSECTIONS_H_
 
 #include "defs.h"
-#include "Culvert.h"
+#include "CulvertSet.h"
+#include "RoadIndex.h"
 
 void insert_culverts_to_stream_road_intersections(
-    DemClass_t & dem_orig,
+    const DemClass_t & dem_orig,
     FlowDirClass_t & flowdirs,
     DeltaDem_t & delta_dem,
-    DemClass_t & dem_wrk,
     CellGrid<acc_type, ct> & accumulated,
     CellGrid<road_id_type, ct> & roads,
+    const CellGrid<road_id_type, ct> & road_sides,
+    const RoadIndex & road_index,
     const geo::RasterArea & culvert_insert_area,
     DeltaDemDatatype & next_free_culvert_id,
-    std::vector<Culvert<DeltaDemDatatype>> & culverts,
+    CulvertSet<DeltaDemDatatype> & culverts,
     std::map<DeltaDemDatatype, cprops> & culvert_props,
     const std::set<int> & use_algs,
     std::list<Culvert<DeltaDemDatatype>> & added_this_iter,
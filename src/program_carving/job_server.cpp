@@ -0,0 +1,84 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "job_server.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+#include "parameter_sets.h"
+
+namespace job_server {
+
+    Job parse(const std::string & line, const ParameterSet & defaults)
+    {
+        std::istringstream words {line};
+        Job job {"", 0.0, 0.0, 0.0, 0.0, defaults};
+        if (!(words >> job.output_prefix >> job.left >> job.bottom >>
+            job.right >> job.top))
+        {
+            throw std::runtime_error("Expected the output prefix and the "
+                "area as \"left bottom right top\".");
+        }
+        if (!(job.left < job.right && job.bottom < job.top)) {
+            throw std::runtime_error("The area of the job is empty.");
+        }
+        std::string word;
+        while (words >> word) {
+            parameter_sets::assign(job.parameters, word);
+        }
+        return job;
+    }
+
+    tiling::Tile window(
+        const geo::RasterArea & region,
+        const Job & job,
+        double halo)
+    {
+        using ct = coordinates::raster_coord_type;
+        const double cs {region.cell_size()};
+        const long nx {static_cast<long>(region.pixel_width())};
+        const long ny {static_cast<long>(region.pixel_height())};
+        auto clip = [](double v, long n) {
+            return std::min(std::max(static_cast<long>(v), 0l), n); };
+
+        // the cells touched by the area of interest
+        const long col0 {clip(std::floor((job.left - region.left()) / cs), nx)};
+        const long col1 {clip(std::ceil((job.right - region.left()) / cs), nx)};
+        const long row0 {clip(std::floor((region.top() - job.top) / cs), ny)};
+        const long row1 {clip(std::ceil((region.top() - job.bottom) / cs), ny)};
+        if (col0 >= col1 || row0 >= row1) {
+            throw std::runtime_error("The area of the job is outside the "
+                "DEM.");
+        }
+        const long halo_px {static_cast<long>(std::ceil(halo / cs))};
+
+        auto sub = [&](long c0, long r0, long c1, long r1)
+        {
+            return region.sub_area(
+                coordinates::RasterCoordinate {
+                    static_cast<ct>(c0), static_cast<ct>(r0)},
+                coordinates::RasterDims::create(
+                    static_cast<size_t>(c1 - c0),
+                    static_cast<size_t>(r1 - r0)));
+        };
+        return {
+            sub(col0, row0, col1, row1),
+            sub(std::max(col0 - halo_px, 0l),
+                std::max(row0 - halo_px, 0l),
+                std::min(col1 + halo_px, nx),
+                std::min(row1 + halo_px, ny)),
+            coordinates::PartitionCoordinate {}};
+    }
+
+}
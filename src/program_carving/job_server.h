@@ -0,0 +1,66 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef JOB_SERVER_H_
+#define JOB_SERVER_H_
+
+#include <string>
+
+#include "ParameterSet.h"
+#include "RasterArea.h"
+#include "tile_scheduler.h"
+
+/**
+ * \brief The jobs of the server mode, which keeps one regional DEM in
+ * memory and computes the culverts and streams of small areas of it.
+ *
+ * The jobs are read one per line from the standard input, and one reply
+ * line is written for each into the standard output.
+ */
+namespace job_server {
+
+    struct Job
+    {
+        // prepended to the names of the output files
+        std::string output_prefix;
+        // the area of interest, in the coordinates of the DEM
+        double left;
+        double bottom;
+        double right;
+        double top;
+        ParameterSet parameters;
+    };
+
+    /**
+     * \brief Parse a job: the output prefix and the area of interest as
+     * "left bottom right top", followed by the thresholds of the job as
+     * key=value pairs (see parameter_sets::assign). The thresholds not
+     * given are taken from \a defaults.
+     *
+     * \throw std::runtime_error if the line is malformed.
+     */
+    Job parse(const std::string & line, const ParameterSet & defaults);
+
+    /**
+     * \brief The cells of the region covering the area of interest of the
+     * job as the core of a tile, with a halo of halo meters.
+     *
+     * \throw std::runtime_error if the area of interest is outside the
+     * region.
+     */
+    tiling::Tile window(
+        const geo::RasterArea & region,
+        const Job & job,
+        double halo);
+
+}
+
+#endif
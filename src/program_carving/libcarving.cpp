@@ -0,0 +1,128 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "libcarving.h"
+#include "libcarving_grids.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include "RasterArea.h"
+#include "culvert_pipeline.h"
+
+static_assert(std::is_same<libcarving::Dem, DemClass_t>::value,
+    "The DEM type of the library differs from the pipeline.");
+static_assert(std::is_same<libcarving::Roads::value_type,
+    road_raster_type>::value,
+    "The road type of the library differs from the pipeline.");
+static_assert(std::is_same<libcarving::Accumulation::value_type,
+    acc_type>::value,
+    "The accumulation type of the library differs from the pipeline.");
+
+namespace libcarving {
+
+    std::vector<Culvert> run(
+        const Dem & dem,
+        const Roads & roads,
+        Accumulation & accumulation,
+        const Parameters & params,
+        Dem * carved_dem)
+    {
+        if (params.road_buffer_width < 0 || params.ignore_dist_same_iter < 0 ||
+            params.ignore_dist_other < 0 || params.min_carving_cost < 0 ||
+            params.min_single_carving < 0 || params.min_flow_accumulation < 0 ||
+            params.min_culvert_saving < 0 || params.halo_width < 0)
+        {
+            throw std::runtime_error("The parameters must be positive.");
+        }
+        if (roads.px_size() != dem.px_size() ||
+            (carved_dem != nullptr && carved_dem->px_size() != dem.px_size()))
+        {
+            throw std::runtime_error("The grids must have the size of the DEM.");
+        }
+
+        GridPool pool;
+
+        CellGrid<road_id_type, ct> road_ids {dem, "roads", pool};
+        road_ids.no_data_value(0);
+        // The pipeline takes the value 1 as a road and numbers the road
+        // segments from 3 up, so any non-zero input is a road.
+        std::transform(roads.data(), roads.data() + roads.px_size(),
+            road_ids.data(), [](unsigned short v) -> road_id_type {
+                return v != 0 ? 1 : 0; });
+
+        // allocated by the pipeline only if the caller does not want it
+        DemClass_t own_dem_wrk {dem, "dem_wrk", pool, false};
+        DemClass_t & dem_wrk = carved_dem != nullptr ? *carved_dem : own_dem_wrk;
+
+        geo::RasterArea culvert_insert_area {dem.area()};
+        culvert_insert_area.add_halo(-params.halo_width);
+
+        CulvertPipeline pipeline {dem, road_ids, dem_wrk, accumulation, pool,
+            culvert_insert_area, params.road_buffer_width, params.memory_lean};
+        pipeline.track_depressions(params.min_culvert_saving > 0);
+        TaskGraph preparation;
+        pipeline.add_preparation(preparation, {}, {});
+        preparation.run();
+        pipeline.place_culverts({
+                "",
+                params.min_carving_cost,
+                params.min_culvert_saving,
+                params.min_single_carving,
+                params.min_flow_accumulation,
+                params.ignore_dist_same_iter,
+                params.ignore_dist_other},
+            "", false);
+
+        pipeline.accumulated();
+        if (carved_dem != nullptr) pipeline.carved_dem();
+
+        std::vector<Culvert> culverts;
+        for (const auto & c: pipeline.culverts()) {
+            culverts.push_back({c.sink(), c.source(), c.id(),
+                std::get<1>(pipeline.culvert_props(c))});
+        }
+        return culverts;
+    }
+
+    std::vector<Culvert> run(
+        const Area & area,
+        const float * dem,
+        const unsigned short * roads,
+        unsigned int * accumulation,
+        const Parameters & params,
+        float * carved_dem)
+    {
+        if (area.width == 0 || area.height == 0 || !(area.cell_size > 0)) {
+            throw std::runtime_error("The area must not be empty.");
+        }
+        const geo::RasterArea raster_area {
+            geo::PixelTopLeftCoordinate {area.ulx, area.uly},
+            coordinates::RasterDims::create(area.width, area.height),
+            area.cell_size,
+            geo::ReferenceSystem()};
+
+        // The inputs are only read through the const grids.
+        const Dem dem_view {raster_area, "DEM", const_cast<float *>(dem)};
+        const Roads roads_view {raster_area, "roads",
+            const_cast<unsigned short *>(roads)};
+        Accumulation accumulation_view {raster_area, "flow_accum",
+            accumulation};
+        if (carved_dem == nullptr) {
+            return run(dem_view, roads_view, accumulation_view, params);
+        }
+        Dem carved_dem_view {raster_area, "dem_carved", carved_dem};
+        return run(dem_view, roads_view, accumulation_view, params,
+            &carved_dem_view);
+    }
+
+}
@@ -0,0 +1,105 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef LIBCARVING_H_
+#define LIBCARVING_H_
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * \brief The carving, the culvert placing and the flow accumulation of
+ * carving.bin as a library, for rasters held in memory by the caller.
+ *
+ * The rasters are row-major arrays of the cells of the area, starting
+ * from the top left corner. No files are read or written, and the
+ * caller's arrays are used in place: the DEM is only read, and the
+ * outputs are written into the caller's arrays. The roads are converted
+ * into a working grid, because the road buffer and its segment ids are
+ * written into it.
+ *
+ * The number of worker threads is global_parameters::n_threads, or the
+ * limit of a parallel::ThreadLimit of the calling thread. The log is
+ * written only if logging::init() has been called.
+ */
+namespace libcarving {
+
+    /**
+     * \brief The extent of the rasters.
+     */
+    struct Area
+    {
+        // the top left corner of the top left cell, in the map units
+        double ulx;
+        double uly;
+        double cell_size;
+        // the number of the columns and of the rows
+        size_t width;
+        size_t height;
+    };
+
+    /**
+     * \brief The parameters of carving.bin with the same names.
+     */
+    struct Parameters
+    {
+        double road_buffer_width;
+        double ignore_dist_same_iter;
+        double ignore_dist_other;
+        double min_carving_cost;
+        double min_single_carving;
+        double min_flow_accumulation;
+        double min_culvert_saving;
+        // the width of the border of the area in which no culverts are
+        // placed
+        double halo_width;
+        // allocate the grids only when needed and free them between the
+        // stages; the allocator is left as the caller has set it up, so
+        // with glibc the freed grids return to the system only below its
+        // mmap threshold (mallopt(M_MMAP_THRESHOLD, ...))
+        bool memory_lean;
+    };
+
+    struct Culvert
+    {
+        // the raster indices of the ends of the culvert
+        size_t sink;
+        size_t source;
+        unsigned int id;
+        // the flow accumulation at the sink
+        unsigned int flow;
+    };
+
+    /**
+     * \brief Carve the DEM, place the culverts and compute the flow
+     * accumulation of the carved DEM with the culverts.
+     *
+     * \param dem, roads, accumulation, carved_dem Arrays of the
+     * width * height cells of \a area.
+     * \param roads The road raster, non-zero on the road cells. The
+     * value of a road cell does not matter.
+     * \param accumulation Receives the flow accumulation.
+     * \param carved_dem Receives the carved DEM, if not null.
+     * \return The culverts.
+     * \throw std::runtime_error if the area is empty or the parameters are
+     * invalid.
+     */
+    std::vector<Culvert> run(
+        const Area & area,
+        const float * dem,
+        const unsigned short * roads,
+        unsigned int * accumulation,
+        const Parameters & params,
+        float * carved_dem = nullptr);
+
+}
+
+#endif
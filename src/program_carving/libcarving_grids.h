@@ -0,0 +1,46 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef LIBCARVING_GRIDS_H_
+#define LIBCARVING_GRIDS_H_
+
+#include <vector>
+
+#include "CellGrid.h"
+#include "coordinates.h"
+#include "libcarving.h"
+
+/**
+ * \brief The library on the grids of the program, for the code built
+ * with it. The public libcarving.h does not include it.
+ */
+namespace libcarving {
+
+    using Dem = CellGrid<float, coordinates::RasterCoordinate>;
+    using Roads = CellGrid<unsigned short, coordinates::RasterCoordinate>;
+    using Accumulation = CellGrid<unsigned int, coordinates::RasterCoordinate>;
+
+    /**
+     * \brief As run() for the arrays, on grids.
+     *
+     * \throw std::runtime_error if the grids are not of the size of the
+     * DEM or the parameters are invalid.
+     */
+    std::vector<Culvert> run(
+        const Dem & dem,
+        const Roads & roads,
+        Accumulation & accumulation,
+        const Parameters & params,
+        Dem * carved_dem = nullptr);
+
+}
+
+#endif
@@ -10,6 +10,9 @@
  */
 
 #include <ogrsf_frmts.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 #include "ProgramCmdOpts.h"
 #include "program.h"
@@ -25,6 +28,13 @@ int main(int argc, char** argv)
 
         opts.parse(argc, argv);
 
+#ifdef __GLIBC__
+        // glibc raises its mmap threshold to the size of a freed block,
+        // after which the grids freed in the memory-lean mode stay in the
+        // heap and count to the resident memory
+        if (opts.memory_lean()) mallopt(M_MMAP_THRESHOLD, 1 << 20);
+#endif
+
         program(opts);
 
         return 0;
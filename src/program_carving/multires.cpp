@@ -0,0 +1,128 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "multires.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "parallel.h"
+
+namespace {
+
+    /*
+     * Call f(coarse index, fine index) for each fine cell of each block,
+     * the rows of the coarse grid in parallel.
+     */
+    template<typename F>
+    void for_each_block_cell(
+        const CellGridFrame & fine,
+        const CellGridFrame & coarse,
+        unsigned int factor,
+        F f)
+    {
+        const size_t nx {fine.px_width()};
+        const size_t ny {fine.px_height()};
+        const size_t cnx {coarse.px_width()};
+        if (cnx * factor < nx || coarse.px_height() * factor < ny) {
+            throw std::runtime_error("The coarse grid does not cover the "
+                "fine grid.");
+        }
+        parallel::for_blocks(coarse.px_height(), [&](size_t begin, size_t end)
+        {
+            for (size_t cr = begin; cr < end; ++cr) {
+                const size_t r1 {std::min((cr + 1) * factor, ny)};
+                for (size_t r = cr * factor; r < r1; ++r) {
+                    for (size_t c = 0; c < nx; ++c) {
+                        f(cr * cnx + c / factor, r * nx + c);
+                    }
+                }
+            }
+        });
+    }
+
+}
+
+namespace multires {
+
+    geo::RasterArea coarse_area(
+        const geo::RasterArea & area,
+        unsigned int factor)
+    {
+        if (factor == 0) {
+            throw std::runtime_error("The downsampling factor must be "
+                "positive.");
+        }
+        return {
+            geo::PixelTopLeftCoordinate {area.left(), area.top()},
+            coordinates::RasterDims::create(
+                (area.pixel_width() + factor - 1) / factor,
+                (area.pixel_height() + factor - 1) / factor),
+            area.cell_size() * factor,
+            area.CRS()};
+    }
+
+    void downsample_dem(
+        const DemClass_t & dem,
+        DemClass_t & coarse,
+        unsigned int factor)
+    {
+        std::vector<double> sums(coarse.px_size(), 0.0);
+        std::vector<unsigned int> counts(coarse.px_size(), 0);
+        const DemDataType * data {dem.data()};
+        const bool has_no_data {dem.has_no_data_value()};
+        const DemDataType no_data {has_no_data ? dem.no_data_value() : 0};
+        for_each_block_cell(dem, coarse, factor, [&](size_t ci, size_t i)
+        {
+            if (has_no_data && data[i] == no_data) return;
+            sums[ci] += static_cast<double>(data[i]);
+            ++counts[ci];
+        });
+
+        DemDataType * out {coarse.data()};
+        const DemDataType out_no_data {coarse.has_no_data_value() ?
+            coarse.no_data_value() : 0};
+        for (size_t ci = 0; ci < coarse.px_size(); ++ci) {
+            out[ci] = counts[ci] > 0 ?
+                static_cast<DemDataType>(sums[ci] / counts[ci]) :
+                out_no_data;
+        }
+    }
+
+    void downsample_roads(
+        const CellGrid<road_id_type, ct> & roads,
+        CellGrid<road_id_type, ct> & coarse,
+        road_id_type road_value,
+        unsigned int factor)
+    {
+        coarse.format(0);
+        const road_id_type * data {roads.data()};
+        road_id_type * out {coarse.data()};
+        // the blocks of a coarse row are written by one thread
+        for_each_block_cell(roads, coarse, factor, [&](size_t ci, size_t i)
+        {
+            if (data[i] == road_value) out[ci] = road_value;
+        });
+    }
+
+    ParameterSet coarse_parameters(
+        const ParameterSet & ps,
+        unsigned int factor)
+    {
+        ParameterSet coarse {ps};
+        const double f {static_cast<double>(factor)};
+        coarse.min_flow_accum = ps.min_flow_accum / (f * f);
+        coarse.min_carving_cost = ps.min_carving_cost / f;
+        coarse.min_culvert_saving = ps.min_culvert_saving / f;
+        return coarse;
+    }
+
+}
@@ -0,0 +1,65 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef MULTIRES_H_
+#define MULTIRES_H_
+
+#include "defs.h"
+#include "ParameterSet.h"
+
+/**
+ * \brief The coarse grids of the coarse-to-fine culvert placing.
+ *
+ * A coarse cell covers a block of factor x factor cells of the fine grid,
+ * starting from its top left corner. The blocks at the right and bottom
+ * edges may be partial.
+ */
+namespace multires {
+
+    /**
+     * \brief The area of the coarse grid covering \a area.
+     */
+    geo::RasterArea coarse_area(
+        const geo::RasterArea & area,
+        unsigned int factor);
+
+    /**
+     * \brief The mean of the cells of each block that are not no data.
+     * A block without such cells gets the no data value of \a coarse.
+     */
+    void downsample_dem(
+        const DemClass_t & dem,
+        DemClass_t & coarse,
+        unsigned int factor);
+
+    /**
+     * \brief Mark the blocks with at least one road cell (the value
+     * road_value) as road cells, so that the narrow roads are not lost.
+     * The other cells of \a coarse are set to zero.
+     */
+    void downsample_roads(
+        const CellGrid<road_id_type, ct> & roads,
+        CellGrid<road_id_type, ct> & coarse,
+        road_id_type road_value,
+        unsigned int factor);
+
+    /**
+     * \brief The thresholds of \a ps for the coarse grid. The flow
+     * accumulation is counted in cells and the carving costs are summed
+     * along the paths, so they are scaled to the coarse cells.
+     */
+    ParameterSet coarse_parameters(
+        const ParameterSet & ps,
+        unsigned int factor);
+
+}
+
+#endif
@@ -0,0 +1,113 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "parameter_sets.h"
+
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+namespace parameter_sets {
+
+    ParameterSet from_options(const ProgramCmdOpts & opts)
+    {
+        return {
+            "",
+            opts.min_carving_cost_path(),
+            opts.min_culvert_saving(),
+            opts.min_carving_single(),
+            opts.min_flow_accum(),
+            opts.ignore_dist_same_iter(),
+            opts.ignore_dist()};
+    }
+
+    void set(ParameterSet & ps, const std::string & key, double value)
+    {
+        if (value < 0) {
+            throw std::runtime_error(
+                "The param \"" + key + "\" must be positive.");
+        }
+        if (key == "min-carving-cost") {
+            ps.min_carving_cost = value;
+        } else if (key == "min-culvert-saving") {
+            ps.min_culvert_saving = value;
+        } else if (key == "min-single-carving") {
+            ps.min_carving_single = value;
+        } else if (key == "min-flow-accumulation") {
+            ps.min_flow_accum = value;
+        } else if (key == "ignore-dist-same-iter") {
+            ps.ignore_dist_same_iter = value;
+        } else if (key == "ignore-dist-other") {
+            ps.ignore_dist = value;
+        } else {
+            throw std::runtime_error(
+                "Unknown parameter \"" + key + "\".");
+        }
+    }
+
+    void assign(ParameterSet & ps, const std::string & assignment)
+    {
+        auto eq = assignment.find('=');
+        if (eq == std::string::npos) {
+            throw std::runtime_error(
+                "Expected key=value, got \"" + assignment + "\".");
+        }
+        std::istringstream value_str {assignment.substr(eq + 1)};
+        double value;
+        if (!(value_str >> value) || !value_str.eof()) {
+            throw std::runtime_error(
+                "Bad value in \"" + assignment + "\".");
+        }
+        set(ps, assignment.substr(0, eq), value);
+    }
+
+    std::vector<ParameterSet> read(
+        const std::string & file,
+        const ParameterSet & defaults)
+    {
+        std::ifstream in(file);
+        if (!in) {
+            throw std::runtime_error("Could not read " + file + ".");
+        }
+
+        std::vector<ParameterSet> sets;
+        std::set<std::string> names;
+        std::string line;
+        for (size_t line_no = 1; std::getline(in, line); ++line_no) {
+            std::istringstream words {line};
+            ParameterSet ps {defaults};
+            if (!(words >> ps.name) || ps.name[0] == '#') continue;
+
+            auto error = [&](const std::string & what) {
+                return std::runtime_error(file + ":" +
+                    std::to_string(line_no) + ": " + what);
+            };
+            if (!names.insert(ps.name).second) {
+                throw error("The name \"" + ps.name + "\" is used twice.");
+            }
+            std::string word;
+            while (words >> word) {
+                try {
+                    assign(ps, word);
+                } catch (std::runtime_error & e) {
+                    throw error(e.what());
+                }
+            }
+            sets.push_back(std::move(ps));
+        }
+        if (sets.empty()) {
+            throw std::runtime_error("No parameter sets in " + file + ".");
+        }
+        return sets;
+    }
+
+}
@@ -0,0 +1,60 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef PARAMETER_SETS_H_
+#define PARAMETER_SETS_H_
+
+#include <string>
+#include <vector>
+
+#include "ParameterSet.h"
+#include "ProgramCmdOpts.h"
+
+namespace parameter_sets {
+
+    /**
+     * \brief The thresholds given on the command line.
+     */
+    ParameterSet from_options(const ProgramCmdOpts & opts);
+
+    /**
+     * \brief Set the threshold named as its command line option (e.g.
+     * "min-carving-cost").
+     *
+     * \throw std::runtime_error if the name is unknown or the value is
+     * negative.
+     */
+    void set(ParameterSet & ps, const std::string & key, double value);
+
+    /**
+     * \brief Set a threshold given as "key=value".
+     *
+     * \throw std::runtime_error if the assignment is malformed.
+     */
+    void assign(ParameterSet & ps, const std::string & assignment);
+
+    /**
+     * \brief Read the parameter sets of a sweep from the file.
+     *
+     * Each non-empty line that does not start with '#' is a set: its name
+     * followed by the thresholds as key=value pairs. The thresholds not
+     * given are taken from \a defaults.
+     *
+     * \throw std::runtime_error if the file cannot be read, a line is
+     * malformed or the names are not unique.
+     */
+    std::vector<ParameterSet> read(
+        const std::string & file,
+        const ParameterSet & defaults);
+
+}
+
+#endif
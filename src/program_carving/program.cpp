@@ -11,133 +11,504 @@
 
 #include "program.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+
 #include "ProgramCmdOpts.h"
 
 #include "defs.h"
 
-#include "InsertCulvertAlgorithm.h"
-#include "insert_culverts_to_road_stream_intersections.h"
-#include "insert_culverts_to_expensive_carvings.h"
+#include "culvert_pipeline.h"
+#include "hash_log.h"
+#include "TaskGraph.h"
 #include "global_parameters.h"
+#include "parallel.h"
+#include "tile_scheduler.h"
+#include "seams.h"
+#include "partitions.h"
+#include "parameter_sets.h"
+#include "batch_manifest.h"
+#include "job_server.h"
+#include "run_planner.h"
 
 #include "import_data.h"
 #include "write_to_file.h"
 #include "vectorize.h"
 
-int program(
-    const ProgramCmdOpts & opts)
-{
-    const std::pair<double, double> culvert_len_lims {
-        3.0, 2 * opts.road_buffer_width()};
-    try
+namespace {
+
+    using CulvertLines = std::vector<std::pair<
+        std::vector<geo::GeoCoordinate>, cprops>>;
+    using StreamLines = std::vector<std::pair<
+        std::vector<geo::GeoCoordinate>, acc_type>>;
+
+    // the flow accumulation of the cells vectorized as streams
+    const acc_type stream_threshold {1000};
+
+    /*
+     * Raise the cells of a horizontal or vertical line from start
+     * (inclusive) to stop (exclusive) to at least h. The part of the line
+     * outside the raster is skipped.
+     */
+    void place_dam(
+        DemClass_t & dem,
+        const geo::PixelCenterCoordinate & start,
+        const geo::PixelCenterCoordinate & stop,
+        DemDataType h)
     {
-        auto dem_data_source = io::create_raster_data_source(
-            {opts.dem_data_str()});
+        const geo::RasterArea pa {dem.area()};
+        auto col = [&](double x) {
+            return static_cast<long>(std::round((x - pa.ulx()) / pa.cell_size())); };
+        auto row = [&](double y) {
+            return static_cast<long>(std::round((pa.uly() - y) / pa.cell_size())); };
+        const long nx {static_cast<long>(dem.px_width())};
+        const long ny {static_cast<long>(dem.px_height())};
+        long i0 {col(start.x())}, i1 {col(stop.x())};
+        long j0 {row(start.y())}, j1 {row(stop.y())};
+        if (j0 == j1) {
+            if (j0 < 0 || j0 >= ny) return;
+            i0 = std::max(i0, 0l);
+            i1 = std::min(i1, nx);
+            j1 = j0 + 1;
+        } else {
+            if (i0 < 0 || i0 >= nx) return;
+            j0 = std::max(j0, 0l);
+            j1 = std::min(j1, ny);
+            i1 = i0 + 1;
+        }
+        for (long j = j0; j < j1; ++j) {
+            for (long i = i0; i < i1; ++i) {
+                auto ind = coordinates::to_raster_index(
+                    static_cast<size_t>(i), static_cast<size_t>(j),
+                    dem.px_width());
+                dem.data()[ind] = std::max(dem.data()[ind], h);
+            }
+        }
+    }
 
-        auto roads_data_source = io::create_raster_data_source(
-            {opts.road_data_str()});
+    /*
+     * Read the DEM of the area of dem from the source, with the artificial
+     * dams placed.
+     */
+    void read_dem(DemClass_t & dem, const io::DataSource & source)
+    {
+        dem.no_data_value(0.0);
+        io::fill_array(dem, source);
+        // place artifical "dam" at the border where a lake is cut off
+        // Velskolan pitkäjärvi
+        place_dam(dem, {369143.5, 6686200.5}, {369374.5, 6686200.5},
+            static_cast<DemDataType>(60.0));
+        // Saarijärvi
+        place_dam(dem, {367400.5, 6690760.5}, {367400.5, 6689070.5},
+            static_cast<DemDataType>(80.0));
+        // Lepsämänjoki wrong direction
+        place_dam(dem, {369161.5, 6694299.5}, {369242.5, 6694299.5},
+            static_cast<DemDataType>(41.0));
+        // Lepsämänjoki wrong direction
+        place_dam(dem, {371212.5, 6694299.5}, {371270.5, 6694299.5},
+            static_cast<DemDataType>(35.0));
+        // Luukinjärvi
+        place_dam(dem, {372799.5, 6688850.5}, {372799.5, 6688450.5},
+            static_cast<DemDataType>(47.0));
+        // Urja
+        place_dam(dem, {367400.5, 6688430.5}, {367400.5, 6687220.5},
+            static_cast<DemDataType>(65));
+    }
 
-        geo::RasterArea calc_area {dem_data_source->raster_area()};
+    struct AreaResult
+    {
+        CulvertLines culverts;
+        StreamLines streams;
+        // the seam cells of the core of a tile
+        std::vector<tiling::SeamCell> seam;
+    };
+
+    /*
+     * The culverts as lines from the sink to the source, with the flow
+     * through them.
+     */
+    CulvertLines culvert_lines(CulvertPipeline & pipeline)
+    {
+        const auto & culverts = pipeline.culverts();
+        CulvertLines lines;
+        for (const auto &c: culverts)
+        {
+            std::vector<geo::GeoCoordinate> line;
+            line.push_back(culverts.to_geocoordinate(c.sink()));
+            line.push_back(culverts.to_geocoordinate(c.source()));
+            lines.push_back({line, pipeline.culvert_props(c)});
+        }
+        return lines;
+    }
 
-        geo::RasterArea culvert_insert_area {calc_area};
-        culvert_insert_area.add_halo(-opts.halo_width());
+    /*
+     * The vectorized flow accumulation
+     */
+    StreamLines stream_lines(CulvertPipeline & pipeline, unsigned int threshold)
+    {
+        const auto & accumulated = pipeline.accumulated();
+        const auto & delta_dem = pipeline.delta_dem();
+        return vectorize::vectorize_stream_like_raster(
+            accumulated,
+            pipeline.flowdirs(),
+            delta_dem,
+            static_cast<acc_type>(threshold));
+    }
 
-        DemClass_t dem_orig {
-            calc_area, "DEM"};
-        dem_orig.no_data_value(0.0);
-        io::fill_array(dem_orig, *dem_data_source);
-        // place artifical "dam" at the border where a lake is cut off
-        {
-            auto pa_ = dem_orig.area();
-            // Velskolan pitkäjärvi
-            auto c_start = pa_.to_raster_coordinate({369143.5, 6686200.5});
-            auto c_stop = pa_.to_raster_coordinate({369374.5, 6686200.5});
-            for (auto i = c_start.col(); i < c_stop.col(); ++i) {
-                auto ind = coordinates::to_raster_index(i, c_start.row(), dem_orig.px_width());
-                dem_orig.data()[ind] = std::max(
-                    dem_orig.data()[ind],
-                    static_cast<DemDataType>(60.0));
-            }
-            // Saarijärvi
-            c_start = pa_.to_raster_coordinate({367400.5, 6690760.5});
-            c_stop = pa_.to_raster_coordinate({367400.5, 6689070.5});
-            for (auto i = c_start.row(); i < c_stop.row(); ++i) {
-                auto ind = coordinates::to_raster_index(c_start.col(), i, dem_orig.px_width());
-                dem_orig.data()[ind] = std::max(
-                    dem_orig.data()[ind],
-                    static_cast<DemDataType>(80.0));
-            }
-            // Lepsämänjoki wrong direction
-            c_start = pa_.to_raster_coordinate({369161.5, 6694299.5});
-            c_stop = pa_.to_raster_coordinate({369242.5, 6694299.5});
-            for (auto i = c_start.col(); i < c_stop.col(); ++i) {
-                auto ind = coordinates::to_raster_index(i, c_start.row(), dem_orig.px_width());
-                dem_orig.data()[ind] = std::max(
-                    dem_orig.data()[ind],
-                    static_cast<DemDataType>(41.0));
-            }
-            // Lepsämänjoki wrong direction
-            c_start = pa_.to_raster_coordinate({371212.5, 6694299.5});
-            c_stop = pa_.to_raster_coordinate({371270.5, 6694299.5});
-            for (auto i = c_start.col(); i < c_stop.col(); ++i) {
-                auto ind = coordinates::to_raster_index(i, c_start.row(), dem_orig.px_width());
-                dem_orig.data()[ind] = std::max(
-                    dem_orig.data()[ind],
-                    static_cast<DemDataType>(35.0));
-            }
-            // Luukinjärvi
-            c_start = pa_.to_raster_coordinate({372799.5, 6688850.5});
-            c_stop = pa_.to_raster_coordinate({372799.5, 6688450.5});
-            for (auto i = c_start.row(); i < c_stop.row(); ++i) {
-                auto ind = coordinates::to_raster_index(c_start.col(), i, dem_orig.px_width());
-                dem_orig.data()[ind] = std::max(
-                    dem_orig.data()[ind],
-                    static_cast<DemDataType>(47.0));
+    /*
+     * The results of the tiles as bytes, for passing them between the
+     * processes.
+     */
+    template<typename V>
+    void put(std::string & out, const V & v)
+    {
+        out.append(reinterpret_cast<const char *>(&v), sizeof(V));
+    }
+
+    template<typename V>
+    V get(const std::string & in, size_t & pos)
+    {
+        if (pos + sizeof(V) > in.size()) {
+            throw std::runtime_error("Truncated tile results.");
+        }
+        V v;
+        std::memcpy(&v, in.data() + pos, sizeof(V));
+        pos += sizeof(V);
+        return v;
+    }
+
+    template<typename L, typename F>
+    void put_lines(std::string & out, const L & lines, F put_value)
+    {
+        put(out, lines.size());
+        for (const auto & l: lines) {
+            put(out, l.first.size());
+            for (const auto & p: l.first) {
+                put(out, p.x());
+                put(out, p.y());
             }
-            // Urja
-            c_start = pa_.to_raster_coordinate({367400.5, 6688430.5});
-            c_stop = pa_.to_raster_coordinate({367400.5, 6687220.5});
-            for (auto i = c_start.row(); i < c_stop.row(); ++i) {
-                auto ind = coordinates::to_raster_index(c_start.col(), i, dem_orig.px_width());
-                dem_orig.data()[ind] = std::max(
-                    dem_orig.data()[ind],
-                    static_cast<DemDataType>(65));
+            put_value(l.second);
+        }
+    }
+
+    template<typename L, typename F>
+    void get_lines(const std::string & in, size_t & pos, L & lines, F get_value)
+    {
+        size_t n_lines {get<size_t>(in, pos)};
+        for (size_t k = 0; k < n_lines; ++k) {
+            typename L::value_type l;
+            size_t n_points {get<size_t>(in, pos)};
+            for (size_t i = 0; i < n_points; ++i) {
+                double x {get<double>(in, pos)};
+                double y {get<double>(in, pos)};
+                l.first.push_back({x, y});
             }
+            l.second = get_value();
+            lines.push_back(std::move(l));
         }
+    }
 
-        DemClass_t dem_wrk {
-            dem_orig, "dem_wrk"};
-        dem_wrk.copy_data_from(dem_orig);
+    std::string serialize(const std::vector<AreaResult> & results)
+    {
+        std::string out;
+        put(out, results.size());
+        for (const auto & r: results) {
+            put_lines(out, r.culverts, [&](const cprops & c) {
+                put(out, std::get<0>(c));
+                put(out, std::get<1>(c));
+            });
+            put_lines(out, r.streams, [&](acc_type a) { put(out, a); });
+            put(out, r.seam.size());
+            for (const auto & c: r.seam) put(out, c);
+        }
+        return out;
+    }
 
-        DeltaDem_t delta_dem {
-            dem_orig, "d-DEM"};
-        delta_dem.no_data_value(0);
-        delta_dem.format(0);
+    std::vector<AreaResult> deserialize(const std::string & in)
+    {
+        size_t pos {0};
+        std::vector<AreaResult> results(get<size_t>(in, pos));
+        for (auto & r: results) {
+            get_lines(in, pos, r.culverts, [&]() {
+                DeltaDemDatatype id {get<DeltaDemDatatype>(in, pos)};
+                acc_type flow {get<acc_type>(in, pos)};
+                return cprops {id, flow};
+            });
+            get_lines(in, pos, r.streams, [&]() {
+                return get<acc_type>(in, pos); });
+            r.seam.resize(get<size_t>(in, pos));
+            for (auto & c: r.seam) c = get<tiling::SeamCell>(in, pos);
+        }
+        return results;
+    }
 
-        FlowDirClass_t flowdirs {
-            dem_orig, "flowdirs"};
+    /*
+     * The name of an output file of the parameter set.
+     */
+    std::string output_file(const std::string & file, const ParameterSet & ps)
+    {
+        if (ps.name.empty()) return file;
+        return io::add_to_stem(file, "_" + ps.name).string();
+    }
 
-        CarvedCells_t carved_cells {
-            dem_orig,
-            "carved_cells"};
-        carved_cells.no_data_value(0);
-        carved_cells.format();
+    /*
+     * Run the carving and culvert placing pipeline on the calc_area of the
+     * input rasters, with the grids taken from the pool, placing the
+     * culverts inside culvert_insert_area, with each of the parameter
+     * sets. The DEM is read from dem_data_source, which the caller has
+     * opened. The state is saved into checkpoint_file (if not empty) after
+     * each iteration. If tile is given, the results have the seam cells of
+     * its core.
+     */
+    std::vector<AreaResult> carve_area(
+        const ProgramCmdOpts & opts,
+        GridPool & pool,
+        io::RasterDataSource & dem_data_source,
+        const std::string & road_data_str,
+        const std::vector<ParameterSet> & sets,
+        const geo::RasterArea & calc_area,
+        const geo::RasterArea & culvert_insert_area,
+        bool write_carved_dem,
+        const std::string & checkpoint_file,
+        const tiling::Tile * tile)
+    {
+        auto roads_data_source = io::create_raster_data_source(
+            {road_data_str});
+
+        DemClass_t dem_orig {
+            calc_area, "DEM", pool};
+        dem_orig.no_data_value(0.0);
 
         CellGrid<road_id_type, ct> roads {
-            dem_orig, "roads"};
+            dem_orig, "roads", pool};
         roads.no_data_value(0);
 
-        io::fill_array(roads, *roads_data_source);
-
+        // In the memory-lean mode, the outputs are allocated when the
+        // pipeline first needs them.
+        const bool lean {opts.memory_lean()};
+        DemClass_t dem_wrk {
+            dem_orig, "dem_wrk", pool, !lean};
         CellGrid<acc_type, ct> accumulated {
             dem_orig,
-            "flow_accum"};
-        accumulated.no_data_value(0);
+            "flow_accum",
+            pool,
+            !lean};
+
+        CulvertPipeline pipeline {dem_orig, roads, dem_wrk, accumulated,
+            pool, culvert_insert_area, opts.road_buffer_width(), lean};
+        std::unique_ptr<HashLog> hashes;
+        if (!opts.hash_log().empty() || !opts.verify_hashes().empty()) {
+            hashes.reset(new HashLog {opts.hash_log(),
+                opts.verify_hashes()});
+            pipeline.hash_log(hashes.get());
+        }
+
+        // The roads do not depend on the DEM, so they are read and
+        // prepared while the DEM is read and carved.
+        TaskGraph preparation;
+        auto dem_read = preparation.add("DEM reading", {}, [&]()
+        {
+            read_dem(dem_orig, dem_data_source);
+        });
+        auto roads_read = preparation.add("road reading", {}, [&]()
+        {
+            CellGrid<road_raster_type, ct> roads_raster {
+                dem_orig, "roads", pool};
+            roads_raster.no_data_value(0);
+            io::fill_array(roads_raster, *roads_data_source);
+            std::copy(
+                roads_raster.data(),
+                roads_raster.data() + roads_raster.px_size(),
+                roads.data());
+        });
+        pipeline.track_depressions(std::any_of(sets.begin(), sets.end(),
+            [](const ParameterSet & ps) { return ps.min_culvert_saving > 0; }));
+        pipeline.add_preparation(preparation, {dem_read}, {roads_read});
+        preparation.run();
+
+        // The culvert placing iterations with the parameter set ps
+        auto place_culverts = [&](
+            const ParameterSet & ps,
+            const std::string & set_checkpoint) -> AreaResult
+        {
+            pipeline.seed_from_coarse(opts.multires_factor(), ps);
+            pipeline.place_culverts(ps, set_checkpoint, opts.resume());
+            if (hashes) hashes->finish();
+            if (write_carved_dem) {
+                // dem_wrk is the carved DEM of the pipeline
+                pipeline.carved_dem();
+                io::write_to_file(dem_wrk,
+                    output_file("dem_carved_final.gtiff", ps), "gtiff");
+            }
+
+            AreaResult r {culvert_lines(pipeline),
+                stream_lines(pipeline, stream_threshold), {}};
+            if (tile) {
+                // the flow directions of the culverts reach as far as the
+                // longest culvert
+                r.seam = tiling::seam_cells(*tile,
+                    dem_data_source.raster_area(), pipeline.flowdirs(),
+                    pipeline.accumulated(), static_cast<unsigned int>(
+                        std::ceil(2 * opts.road_buffer_width() /
+                            calc_area.cell_size())) + 1);
+            }
+            return r;
+        };
+
+        if (sets.size() == 1) {
+            return {place_culverts(sets.front(), checkpoint_file)};
+        }
+
+        // The carving and the flow accumulation before the first culverts
+        // do not depend on the thresholds, so they are computed once. Each
+        // parameter set continues from them in a forked copy of this
+        // process, as many at a time as fit to the memory budget.
+        pipeline.accumulated();
+        const size_t n_parallel {std::min(
+            tiling::max_parallel_copies(
+                static_cast<size_t>(calc_area.pixel_width()) *
+                calc_area.pixel_height(),
+                sets.size(), opts.memory_budget()),
+            static_cast<size_t>(
+                std::numeric_limits<partitions::partition_id>::max()))};
+        logging::pLog() << "Running " << sets.size() << " parameter sets, "
+            << n_parallel << " at a time.";
+        std::vector<AreaResult> results;
+        for (size_t begin = 0; begin < sets.size(); begin += n_parallel) {
+            const size_t n {std::min(n_parallel, sets.size() - begin)};
+            auto batch = partitions::run_in_processes(
+                static_cast<partitions::partition_id>(n),
+                [&](partitions::partition_id p)
+            {
+                const ParameterSet & ps {sets[begin + p]};
+                logging::pLog() << "Parameter set " << ps.name;
+                return serialize({place_culverts(ps, checkpoint_file.empty() ?
+                    checkpoint_file : output_file(checkpoint_file, ps))});
+            });
+            for (const auto & r: batch) {
+                results.push_back(std::move(deserialize(r).front()));
+            }
+        }
+        return results;
+    }
+
+    /*
+     * Carve the tiles [begin, end), n_parallel at a time, and keep the
+     * results of their cores.
+     */
+    std::vector<AreaResult> carve_tiles(
+        const ProgramCmdOpts & opts,
+        const std::vector<tiling::Tile> & tiles,
+        size_t begin,
+        size_t end,
+        size_t n_parallel)
+    {
+        std::vector<AreaResult> tile_results(end - begin);
+        // the tiles after the first ones reuse the grids of the finished
+        // tiles
+        GridPool pool;
+        parallel::for_each_task(end - begin, [&](size_t k)
+        {
+            size_t t {begin + k};
+            parallel::ThreadLimit limit {std::max(1u,
+                parallel::n_threads() / static_cast<unsigned int>(n_parallel))};
+            // A tile narrower than the halo gets no culverts, and its own
+            // area is used as a placeholder.
+            geo::RasterArea insert_area {tiles[t].area};
+            const bool has_insert_area {tiling::insert_area(
+                tiles[t], opts.halo_width(), insert_area)};
+            std::string checkpoint_file;
+            if (!opts.checkpoint().empty()) {
+                checkpoint_file = io::add_to_stem(opts.checkpoint(),
+                    "_tile" + std::to_string(t)).string();
+            }
+            AreaResult r {carve_area(opts, pool,
+                *io::create_raster_data_source({opts.dem_data_str()}),
+                opts.road_data_str(), {parameter_sets::from_options(opts)},
+                tiles[t].area, insert_area, false, checkpoint_file,
+                &tiles[t]).front()};
+            if (!has_insert_area) r.culverts.clear();
+            tiling::keep_owned_culverts(tiles[t].core, r.culverts);
+            tiling::keep_owned_lines(tiles[t].core, r.streams);
+            tile_results[k] = std::move(r);
+            logging::pLog() << "Tile " << (t + 1) << " / " << tiles.size()
+                << " done.";
+        }, n_parallel);
+        return tile_results;
+    }
 
+    /*
+     * Join the results of the tiles of the raster: number the culverts
+     * one after another, pass the flow accumulation across the seams of
+     * the cores, and give the streams the flow from the other tiles.
+     */
+    AreaResult join_tiles(
+        std::vector<AreaResult> & tile_results,
+        const geo::RasterArea & raster)
+    {
+        AreaResult result;
+        std::vector<tiling::SeamCell> seam;
+        DeltaDemDatatype next_id {1};
+        for (auto & r: tile_results) {
+            for (auto & c: r.culverts) {
+                std::get<0>(c.second) = next_id++;
+                result.culverts.push_back(std::move(c));
+            }
+            result.streams.insert(result.streams.end(),
+                r.streams.begin(), r.streams.end());
+            seam.insert(seam.end(), r.seam.begin(), r.seam.end());
+        }
 
-        std::vector<Culvert<DeltaDemDatatype>> culverts;
-        DeltaDemDatatype next_free_culvert_id {1};
-        std::map<DeltaDemDatatype, cprops> culvert_props;
+        const auto flow = tiling::join_seams(std::move(seam));
+        if (flow.n_unresolved > 0) {
+            logging::pLog() << flow.n_unresolved << " of the "
+                << flow.cells.size() << " cells on the seams of the tiles "
+                << "lack some of their flow.";
+        }
+        // The accumulation of a stream is that of its first cell, which
+        // is on a seam if the stream comes from another core.
+        for (auto & l: result.streams) {
+            const auto c = raster.to_raster_coordinate(
+                {l.first.front().x(), l.first.front().y()});
+            const size_t k {tiling::find_seam_cell(flow,
+                coordinates::GlobalDataCoords {c.col(), c.row()})};
+            if (k != flow.cells.size()) l.second = flow.total[k];
+        }
+        // the streams that only the flow of the other cores makes
+        const auto streams = tiling::seam_streams(flow, stream_threshold);
+        for (const auto & s: streams) {
+            std::vector<ct> cells;
+            for (const auto & c: s.first) cells.push_back({c.col(), c.row()});
+            std::vector<geo::GeoCoordinate> line;
+            for (const auto & c: vectorize::simplify_line(cells, 2.0)) {
+                line.push_back(raster.to_geocoordinate(c));
+            }
+            result.streams.push_back({line, s.second});
+        }
+        logging::pLog() << "Passed the flow of " << flow.cells.size()
+            << " cells across the seams of the tiles, " << streams.size()
+            << " new stream lines.";
+        return result;
+    }
+
+    /*
+     * Write the final stream network and culverts.
+     */
+    void write_result(
+        const AreaResult & result,
+        const std::string & flow_accum_file,
+        const std::string & culverts_file)
+    {
         std::vector<std::string> field_names;
         field_names.push_back("id");
         //field_names.push_back("cost");
@@ -147,244 +518,356 @@ int program(
         //field_names.push_back("two_way");
         //field_names.push_back("insertmode");
 
-        FlowRoutingAlgorithm_CPU<FlowDirDataType, DemDataType, ct> flow_routing_algorithm;
-
-        InsertCulvertAlgorithm ICA;
-
-        // A function to execute the needed algorithms to generate the flow
-        // accumulation and vectorize it
-        auto generate_flow_accumulation = [&](const std::string & str)
-        {
-            delta_dem.format(0);
-            ICA.burn_culverts(delta_dem, culverts);
-
-            dem_wrk.copy_data_from(dem_orig);
-
-            carved_cells.format(0);
-
-            CarvingAlgorithm_t carving_algorithm;
-
-            carving_algorithm.execute(
-                dem_wrk,
-                delta_dem,
-                flowdirs,
-                carved_cells,
-                culverts);
-
-            if (str.size() > 0) {
-                io::write_to_file(dem_wrk,
-                    std::string("dem_carved_") + str + ".gtiff", "gtiff");
-            }
+        io::write_to_file(result.streams, flow_accum_file);
 
-            FlowAccumulationAlgorithm_t flow_accum_algorithm;
+        io::ESRI_Shapefile_printer pr;
+        pr.write_lines(result.culverts, field_names, culverts_file);
+    }
 
-            accumulated.format(0);
+    /*
+     * Process the entries of the batch manifest on the worker threads,
+     * and write the outputs of each entry with its prefix and a summary of
+     * the entries into <manifest>.summary.
+     */
+    void run_batch(const ProgramCmdOpts & opts)
+    {
+        const auto entries = batch_manifest::read(
+            opts.batch(), parameter_sets::from_options(opts));
+        const size_t n {entries.size()};
 
-            flow_accum_algorithm.execute(
-                flowdirs,
-                accumulated);
+        struct Outcome
+        {
+            std::string error;
+            size_t n_culverts;
+            size_t n_streams;
+            double seconds;
         };
-
-        // a function to write the culverts into shapefile
-        auto write_culverts = [&](const std::string &filename)
+        std::vector<Outcome> outcomes(n, Outcome {"", 0, 0, 0.0});
+
+        // The largest areas are started first, and the memory budget is
+        // shared by the largest ones. The DEM of each entry is opened once,
+        // here, and closed when the entry is done.
+        std::vector<std::unique_ptr<io::RasterDataSource>> dem_sources(n);
+        std::vector<size_t> n_cells(n, 0);
+        for (size_t k = 0; k < n; ++k) {
+            try {
+                dem_sources[k] = io::create_raster_data_source(
+                    {entries[k].dem_data_str});
+                geo::RasterArea area {dem_sources[k]->raster_area()};
+                n_cells[k] = static_cast<size_t>(area.pixel_width()) *
+                    area.pixel_height();
+            } catch (std::exception & e) {
+                outcomes[k].error = e.what();
+            }
+        }
+        std::vector<size_t> order(n);
+        std::iota(order.begin(), order.end(), static_cast<size_t>(0));
+        std::stable_sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return n_cells[a] > n_cells[b]; });
+        const size_t n_parallel {tiling::max_parallel_copies(
+            n_cells[order.front()], n, opts.memory_budget())};
+        logging::pLog() << "Processing " << n << " batch entries, "
+            << n_parallel << " at a time.";
+
+        // The grids of the finished entries are reused by the next ones,
+        // so they are allocated at most n_parallel times.
+        GridPool pool;
+        std::mutex output_mutex;
+        parallel::for_each_task(n, [&](size_t i)
         {
-            std::vector<std::pair<
-                std::vector<geo::GeoCoordinate>, cprops>> lines;
-
-            for (const auto &c: culverts)
-            {
-                auto co = accumulated.area().to_raster_coordinate(
-                    c.sink());
-                std::vector<geo::GeoCoordinate> line;
-                line.push_back(c.sink());
-                line.push_back(c.source());
-                auto & props = culvert_props.at(c.id());
-                std::get<1>(props) =
-                    accumulated.data()[co.row() * accumulated.px_width() + co.col()];
-                lines.push_back({line, culvert_props.at(c.id())});
+            const size_t k {order[i]};
+            const auto & e = entries[k];
+            Outcome & outcome = outcomes[k];
+            if (!outcome.error.empty()) return;
+            parallel::ThreadLimit limit {std::max(1u,
+                parallel::n_threads() / static_cast<unsigned int>(n_parallel))};
+            auto start = std::chrono::steady_clock::now();
+            std::unique_ptr<io::RasterDataSource> dem_source {
+                std::move(dem_sources[k])};
+            try {
+                geo::RasterArea calc_area {dem_source->raster_area()};
+                geo::RasterArea culvert_insert_area {calc_area};
+                culvert_insert_area.add_halo(-opts.halo_width());
+                std::string checkpoint_file;
+                if (!opts.checkpoint().empty()) {
+                    checkpoint_file = io::add_to_stem(opts.checkpoint(),
+                        "_entry" + std::to_string(k)).string();
+                }
+                AreaResult r {carve_area(opts, pool, *dem_source,
+                    e.road_data_str, {e.parameters}, calc_area,
+                    culvert_insert_area, false, checkpoint_file,
+                    nullptr).front()};
+                outcome.n_culverts = r.culverts.size();
+                outcome.n_streams = r.streams.size();
+                std::lock_guard<std::mutex> lock {output_mutex};
+                write_result(r, e.output_prefix + "flow_accum.shp",
+                    e.output_prefix + "culverts.shp");
+            } catch (std::exception & err) {
+                outcome.error = err.what();
             }
-            io::ESRI_Shapefile_printer pr;
-            pr.write_lines(lines, field_names, filename);
-        };
+            outcome.seconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+            if (outcome.error.empty()) {
+                logging::pLog() << "Batch entry " << e.output_prefix
+                    << " done.";
+            } else {
+                logging::pErr() << "Batch entry " << e.output_prefix
+                    << " failed: " << outcome.error;
+            }
+        }, n_parallel);
+
+        const std::string summary_file {opts.batch() + ".summary"};
+        std::ofstream summary(summary_file);
+        summary << "output_prefix,status,culverts,streams,seconds,error\n";
+        size_t n_failed {0};
+        for (size_t k = 0; k < n; ++k) {
+            const Outcome & o = outcomes[k];
+            if (!o.error.empty()) ++n_failed;
+            std::string error {o.error};
+            std::replace(error.begin(), error.end(), '"', '\'');
+            summary << entries[k].output_prefix << ","
+                << (o.error.empty() ? "ok" : "failed") << ","
+                << o.n_culverts << "," << o.n_streams << ","
+                << o.seconds << ",\"" << error << "\"\n";
+        }
+        if (!summary) {
+            throw std::runtime_error("Could not write " + summary_file + ".");
+        }
+        logging::pLog() << (n - n_failed) << " / " << n
+            << " batch entries done, summary in " << summary_file << ".";
+    }
 
-        // A function to write the vectorized flow accumulation into a shapefile
-        auto write_flow_accum = [&](
-            const std::string &filename,
-            unsigned int threshold = 1000)
-        {
-            delta_dem.format(0);
-            ICA.burn_culverts(delta_dem, culverts);
-
-            auto lines = vectorize::vectorize_stream_like_raster(
-                accumulated,
-                flowdirs,
-                delta_dem,
-                threshold);
-            io::write_to_file(lines, filename);
-        };
+    /*
+     * Copy the cells of the area of to from the grid from, whose area
+     * contains it.
+     */
+    template<typename T, typename U>
+    void copy_window(const CellGrid<T, ct> & from, CellGrid<U, ct> & to)
+    {
+        const auto offset = to.area().pixel_offset_to(from.area());
+        const size_t width {to.px_width()};
+        for (size_t row = 0; row < to.px_height(); ++row) {
+            const T * src {from.data() + coordinates::to_raster_index(
+                static_cast<size_t>(offset.dx()),
+                row + static_cast<size_t>(offset.dy()),
+                from.px_width())};
+            std::copy(src, src + width, to.data() + row * width);
+        }
+    }
 
-        ICA.extend_roads_with_buffer_region(
-            roads,
-            static_cast<road_id_type>(1),
-            static_cast<road_id_type>(2),
-            opts.road_buffer_width());
+    /*
+     * A window of the regional rasters of the server, with its roads
+     * prepared and carved without culverts. The jobs on the same window
+     * continue from it.
+     */
+    struct ServerWindow
+    {
+        // the grids refer to it
+        const geo::RasterArea area;
+        DemClass_t dem;
+        CellGrid<road_id_type, ct> roads;
+        DemClass_t dem_wrk;
+        CellGrid<acc_type, ct> accumulated;
+        std::unique_ptr<CulvertPipeline> pipeline;
+
+        ServerWindow(
+            const ProgramCmdOpts & opts,
+            GridPool & pool,
+            const DemClass_t & region_dem,
+            const CellGrid<road_raster_type, ct> & region_roads,
+            const geo::RasterArea & window_area,
+            const geo::RasterArea & culvert_insert_area):
+                area {window_area},
+                dem {area, "DEM", pool},
+                roads {area, "roads", pool},
+                dem_wrk {dem, "dem_wrk", pool, !opts.memory_lean()},
+                accumulated {dem, "flow_accum", pool, !opts.memory_lean()}
+        {
+            dem.no_data_value(region_dem.no_data_value());
+            copy_window(region_dem, dem);
+            roads.no_data_value(0);
+            copy_window(region_roads, roads);
+            pipeline.reset(new CulvertPipeline {dem, roads, dem_wrk,
+                accumulated, pool, culvert_insert_area,
+                opts.road_buffer_width(), opts.memory_lean()});
+            TaskGraph preparation;
+            pipeline->add_preparation(preparation, {}, {});
+            preparation.run();
+            pipeline->accumulated();
+        }
+    };
+
+    /*
+     * Keep the DEM and the roads in memory and process the jobs read from
+     * stdin (see job_server), replying to stdout. The window of the latest
+     * job is kept carved, and each job runs in a forked copy of this
+     * process, so the jobs on the same window share the carving without
+     * culverts.
+     */
+    void run_server(const ProgramCmdOpts & opts)
+    {
+        const ParameterSet defaults {parameter_sets::from_options(opts)};
+        GridPool pool;
 
-        ICA.fill_areas_with_unique_id(
-            roads,
-            static_cast<road_id_type>(2),
-            static_cast<road_id_type>(3));
+        auto dem_data_source = io::create_raster_data_source(
+            {opts.dem_data_str()});
+        const geo::RasterArea region {dem_data_source->raster_area()};
+        DemClass_t dem {region, "DEM", pool};
+        read_dem(dem, *dem_data_source);
+        CellGrid<road_raster_type, ct> roads {region, "roads", pool};
+        roads.no_data_value(0);
+        io::fill_array(roads, *io::create_raster_data_source(
+            {opts.road_data_str()}));
+
+        logging::pLog() << "Serving the DEM of " << region.pixel_width()
+            << " x " << region.pixel_height() << " cells.";
+        std::cout << "ready" << std::endl;
+
+        std::unique_ptr<ServerWindow> window;
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            std::string prefix;
+            if (!(std::istringstream {line} >> prefix) || prefix[0] == '#') {
+                continue;
+            }
+            if (prefix == "quit") break;
+
+            auto start = std::chrono::steady_clock::now();
+            std::string reply;
+            try {
+                const auto job = job_server::parse(line, defaults);
+                const auto tile = job_server::window(
+                    region, job, opts.tile_halo());
+                // A window narrower than the halo gets no culverts, and its
+                // own area is used as a placeholder.
+                geo::RasterArea insert_area {tile.area};
+                const bool has_insert_area {tiling::insert_area(
+                    tile, opts.halo_width(), insert_area)};
+                if (!window || !(window->area == tile.area)) {
+                    // the grids of the old window are reused
+                    window.reset();
+                    window.reset(new ServerWindow {opts, pool, dem, roads,
+                        tile.area, insert_area});
+                }
 
-        unsigned int iter {0};
-        while (true)
-        {
-            logging::pLog() << "Starting iteration " << iter;
+                CulvertPipeline & pipeline = *window->pipeline;
+                AreaResult r {deserialize(partitions::run_in_processes(1,
+                    [&](partitions::partition_id)
+                {
+                    pipeline.place_culverts(job.parameters, "", false);
+                    return serialize({{culvert_lines(pipeline),
+                        stream_lines(pipeline, stream_threshold), {}}});
+                }).front()).front()};
+                if (!has_insert_area) r.culverts.clear();
+                tiling::keep_owned_culverts(tile.core, r.culverts);
+                tiling::keep_owned_lines(tile.core, r.streams);
+                write_result(r, job.output_prefix + "flow_accum.shp",
+                    job.output_prefix + "culverts.shp");
+
+                std::ostringstream ok;
+                ok << "ok " << job.output_prefix << " " << r.culverts.size()
+                    << " " << r.streams.size() << " "
+                    << std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start).count();
+                reply = ok.str();
+                logging::pLog() << "Job " << job.output_prefix << " done.";
+            } catch (std::exception & err) {
+                std::string error {err.what()};
+                std::replace(error.begin(), error.end(), '\n', ' ');
+                reply = "failed " + prefix + " " + error;
+                logging::pErr() << "Job " << prefix << " failed: " << error;
+            }
+            std::cout << reply << std::endl;
+        }
+    }
 
-            generate_flow_accumulation("");
+}
 
-            //{
-            //std::stringstream ss;
-            //ss << "flow_accum_" << iter << ".shp";
-            //write_flow_accum(ss.str());
-            //}
+int program(
+    const ProgramCmdOpts & opts)
+{
+    try
+    {
+        if (global_parameters::dryRun) {
+            planning::print(planning::plan_run(opts), std::cout);
+            return 0;
+        }
 
-            // start the culvert placing procedure
-            std::list<Culvert<DeltaDemDatatype>> added_this_iter;
-            bool algorithm_exp_carvs_done {false};
-            bool algorithm_intersect_done {false};
+        if (!opts.batch().empty()) {
+            run_batch(opts);
+            return 0;
+        }
 
-            {
-                insert_culverts_to_expensive_carvings(
-                    dem_orig,
-                    dem_wrk,
-                    flowdirs,
-                    roads,
-                    culvert_insert_area,
-                    culverts,
-                    culvert_props,
-                    next_free_culvert_id,
-                    algorithm_exp_carvs_done,
-                    iter,
-                    opts.min_carving_cost_path(),
-                    culvert_len_lims,
-                    opts.min_carving_single(),
-                    opts.ignore_dist_same_iter(),
-                    opts.ignore_dist());
-            }
-            if (algorithm_exp_carvs_done)
-            {
-                insert_culverts_to_stream_road_intersections(
-                    dem_orig,
-                    flowdirs,
-                    delta_dem,
-                    dem_wrk,
-                    accumulated,
-                    roads,
-                    culvert_insert_area,
-                    next_free_culvert_id,
-                    culverts,
-                    culvert_props,
-                    {1, 2},
-                    added_this_iter,
-                    algorithm_intersect_done,
-                    iter,
-                    static_cast<acc_type>(opts.min_flow_accum()),
-                    culvert_len_lims,
-                    opts.ignore_dist_same_iter(),
-                    opts.ignore_dist());
-            }
+        if (opts.serve()) {
+            run_server(opts);
+            return 0;
+        }
 
-            if (added_this_iter.size() == 0 &&
-                algorithm_intersect_done &&
-                algorithm_exp_carvs_done)
-            {
-                break;
-            }
+        auto dem_data_source = io::create_raster_data_source(
+            {opts.dem_data_str()});
+        geo::RasterArea calc_area {dem_data_source->raster_area()};
 
-            // write the culverts from this iteration into shapefile
-            //{
-            //std::stringstream ss;
-            //ss << "culverts_" << iter << ".shp";
-            //write_culverts(ss.str());
-            //}
+        geo::RasterArea culvert_insert_area {calc_area};
+        culvert_insert_area.add_halo(-opts.halo_width());
 
-            ++iter;
+        std::vector<ParameterSet> sets {parameter_sets::from_options(opts)};
+        if (!opts.sweep().empty()) {
+            sets = parameter_sets::read(opts.sweep(), sets.front());
         }
 
-        // Remove the culverts through which no water is flowing.
-        {
-            logging::pLog() << "Removing unused culverts...";
-            std::vector<Culvert<DeltaDemDatatype>> proper_culverts;
-            auto ar = flowdirs.area();
-            for (const auto &c: culverts)
-            {
-                auto gsink = c.sink();
-                auto gsource = c.source();
-                auto sink = ar.to_raster_coordinate(gsink);
-                auto source = ar.to_raster_coordinate(gsource);
-
-                auto fd = flowdirs.value_at(gsink);
-                auto source_ = move_coord(sink, {fd.x, fd.y},
-                    flowdirs.px_width(),
-                    flowdirs.px_height());
-                if (source_ != sink && source_ == source) {
-                    if (accumulated.value_at(gsink) > 0) {
-                        proper_culverts.push_back(c);
-                    }
-                } else if (c.two_way()) {
-                    fd = flowdirs.value_at(gsource);
-                    source_ = move_coord(source, {fd.x, fd.y},
-                        flowdirs.px_width(),
-                        flowdirs.px_height());
-                    if (source_ != source && source_ == sink) {
-                        if (accumulated.value_at(gsource) > 0)
-                        {
-                            proper_culverts.push_back(c);
-                        }
-                    }
+        std::vector<AreaResult> results;
+        if (opts.tile_size() > 0) {
+            // The tiles are carved independently, and each tile keeps the
+            // culverts and streams of its core. The flow accumulation is
+            // then passed across the seams of the cores.
+            auto tiles = tiling::plan_tiles(
+                calc_area, opts.tile_size(), opts.tile_halo());
+            size_t n_parallel {tiling::max_parallel_tiles(
+                tiles, opts.memory_budget())};
+            logging::pLog() << "Processing " << tiles.size() << " tiles, "
+                << n_parallel << " at a time.";
+            std::vector<AreaResult> tile_results;
+            const partitions::partition_id n_processes {static_cast<
+                partitions::partition_id>(std::min(
+                    static_cast<size_t>(opts.processes()), tiles.size()))};
+            if (n_processes > 1) {
+                // Each process gets a contiguous range of the tiles and its
+                // share of the memory budget and of the threads. The
+                // results come back through the shared memory with the
+                // seam cells of the cores.
+                const size_t n_parallel_proc {std::max(static_cast<size_t>(1),
+                    n_parallel / n_processes)};
+                auto results = partitions::run_in_processes(n_processes,
+                    [&](partitions::partition_id p)
+                {
+                    return serialize(carve_tiles(opts, tiles,
+                        (tiles.size() * p) / n_processes,
+                        (tiles.size() * (p + 1)) / n_processes,
+                        n_parallel_proc));
+                });
+                for (const auto & r: results) {
+                    auto part = deserialize(r);
+                    std::move(part.begin(), part.end(),
+                        std::back_inserter(tile_results));
                 }
-            }
-            auto n_rejected = culverts.size() - proper_culverts.size();
-            if (n_rejected > 0) {
-                logging::pLog() << " " << n_rejected
-                    << " culverts removed.";
-                std::swap(proper_culverts, culverts);
-                generate_flow_accumulation("");
             } else {
-                logging::pLog() << "  no unused culverts found.";
+                tile_results = carve_tiles(opts, tiles, 0, tiles.size(),
+                    n_parallel);
             }
+
+            results.push_back(join_tiles(tile_results, calc_area));
+        } else {
+            GridPool pool;
+            results = carve_area(opts, pool, *dem_data_source,
+                opts.road_data_str(), sets, calc_area, culvert_insert_area,
+                true, opts.checkpoint(), nullptr);
         }
 
-        logging::pLog() << "The final culvert placing iteration.";
-        std::list<Culvert<DeltaDemDatatype>> added_this_iter_;
-        bool done_ {false};
-        insert_culverts_to_stream_road_intersections(
-            dem_orig,
-            flowdirs,
-            delta_dem,
-            dem_wrk,
-            accumulated,
-            roads,
-            culvert_insert_area,
-            next_free_culvert_id,
-            culverts,
-            culvert_props,
-            {2},
-            added_this_iter_,
-            done_,
-            iter + 1,
-            static_cast<acc_type>(opts.min_flow_accum()),
-            culvert_len_lims,
-            opts.ignore_dist_same_iter(),
-            opts.ignore_dist());
-
-        logging::pLog() << "Added " << added_this_iter_.size() << " culverts.";
-        generate_flow_accumulation("final");
-
-        // write final stream network
-        write_flow_accum("flow_accum.shp");
-
-        // write final culverts
-        write_culverts("culverts.shp");
+        for (size_t k = 0; k < sets.size(); ++k) {
+            write_result(results[k],
+                output_file("flow_accum.shp", sets[k]),
+                output_file("culverts.shp", sets[k]));
+        }
 
         return 0;
     } catch (...)
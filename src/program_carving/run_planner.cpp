@@ -0,0 +1,442 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "run_planner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+
+#include "defs.h"
+
+#include "carving_help_CPU.h"
+#include "global_parameters.h"
+#include "import_data.h"
+#include "parallel.h"
+#include "parameter_sets.h"
+#include "partitions.h"
+#include "tile_scheduler.h"
+
+namespace planning {
+
+    namespace {
+
+        // The side of the sample windows, and their number per axis.
+        const size_t sample_side {512};
+        const size_t samples_per_axis {3};
+
+        // The costs of the stages that are not timed on the sample, per
+        // cell at one thread and relative to one carving of the same area.
+        // They were measured with --threads 1 on a synthetic 1500 x 1500
+        // cell DEM with 2.4 % road cells and 1795 culverts in eight
+        // iterations: one carving took 817 ns per cell, the road
+        // preprocessing 34, a pass of the culverts on the expensive
+        // carvings 470 and a pass of the road/stream intersections 2. The
+        // two passes search near the roads, so their costs are scaled by
+        // the fraction of the road cells.
+        const double ref_road_fraction {0.024};
+        const double road_preprocessing_per_carving {34.0 / 817.0};
+        const double expensive_per_carving {470.0 / 817.0};
+        const double intersections_per_carving {2.0 / 817.0};
+
+        // The flood front of the carving, in the priority queue, stayed
+        // below 2 % of the cells on the test areas. The queue is a vector
+        // of (height, cell) pairs that grows by doubling.
+        const double queue_fraction {0.02};
+
+        /*
+         * The measured costs of the sample, per cell at one thread.
+         */
+        struct SampleCosts
+        {
+            double carving_ns;
+            double accumulation_ns;
+            // the fraction of the cells that are local minima
+            double minima_fraction;
+        };
+
+        struct StageModel
+        {
+            const char * name;
+            // the grids alive in the stage, in bytes per cell
+            double plain_bytes;
+            double lean_bytes;
+            // the temporary memory of the kernels, in bytes per cell
+            double scratch_bytes;
+            // the time per cell at one thread
+            double ns_per_cell;
+            bool parallel;
+            bool road_scaled;
+            bool per_iteration;
+        };
+
+        /*
+         * The stages of carving an area of n_cells cells, with the costs
+         * of the sample scaled to it. The carving is a priority flood, so
+         * its cost per cell grows with the logarithm of the size.
+         */
+        std::vector<StageModel> stage_models(
+            size_t n_cells,
+            size_t sample_cells,
+            const SampleCosts & sample,
+            double road_index_bytes,
+            bool with_depressions)
+        {
+            const double dem {sizeof(DemDataType)};
+            const double delta {sizeof(DeltaDemDatatype)};
+            const double fd {sizeof(FlowDirDataType)};
+            const double cells {sizeof(char)};
+            const double acc {sizeof(acc_type)};
+            const double road {sizeof(road_id_type)};
+            const double road_raster {sizeof(road_raster_type)};
+            const double label {sizeof(std::uint32_t)};
+            // the depression labels, kept only if the culvert savings
+            // are estimated
+            const double depressions {with_depressions ? label : 0.0};
+            // the grids of carve_area
+            const double all {2 * dem + delta + fd + cells + acc + 2 * road +
+                road_index_bytes + depressions};
+
+            const double carving_ns {sample.carving_ns *
+                std::log2(std::max(2.0, static_cast<double>(n_cells))) /
+                std::log2(std::max(2.0, static_cast<double>(sample_cells)))};
+            // The carving marks the visited cells and the minima in a bit
+            // each, and lists the minima (a std::list node of 32 bytes).
+            const double carving_scratch {2.0 / 8.0 +
+                32.0 * sample.minima_fraction +
+                2 * sizeof(std::pair<DemDataType, ct>) * queue_fraction};
+            // The culvert passes group their cells by drainage basin with
+            // no memory per cell, unless the flow paths are so long that
+            // the whole raster is labelled, as assumed here.
+            const double grouping_scratch {label};
+
+            // The DEM is carved (and the culverts burnt) again after the
+            // culverts on the expensive carvings, before the flow
+            // accumulation, hence twice per iteration. The flow
+            // accumulation counts the upstream neighbours of each cell in a
+            // byte.
+            return {
+                {"input", all - road_index_bytes - depressions + road_raster,
+                    dem + road + road_raster,
+                    0.0, 0.0, false, false, false},
+                {"road preprocessing", all, dem + 2 * road + road_index_bytes,
+                    0.0, road_preprocessing_per_carving * carving_ns,
+                    true, false, false},
+                {"carving", all,
+                    2 * dem + delta + fd + cells + road_index_bytes +
+                        depressions,
+                    carving_scratch, 2 * carving_ns, false, false, true},
+                {"expensive carvings", all,
+                    2 * dem + fd + 2 * road + road_index_bytes + depressions,
+                    grouping_scratch, expensive_per_carving * carving_ns,
+                    true, true, true},
+                {"flow accumulation", all,
+                    dem + delta + fd + acc + road_index_bytes,
+                    cells, sample.accumulation_ns, false, false, true},
+                {"intersections", all,
+                    dem + delta + fd + acc + 2 * road + road_index_bytes,
+                    grouping_scratch, intersections_per_carving * carving_ns,
+                    true, true, true}};
+        }
+
+        /*
+         * Up to samples_per_axis^2 windows spread evenly over the area.
+         */
+        std::vector<geo::RasterArea> sample_windows(const geo::RasterArea & area)
+        {
+            using ct = coordinates::raster_coord_type;
+            const size_t nx {area.pixel_width()};
+            const size_t ny {area.pixel_height()};
+            const size_t w {std::min(nx, sample_side)};
+            const size_t h {std::min(ny, sample_side)};
+            const size_t n_i {nx > w ? samples_per_axis : 1};
+            const size_t n_j {ny > h ? samples_per_axis : 1};
+            std::vector<geo::RasterArea> windows;
+            for (size_t j = 0; j < n_j; ++j) {
+                for (size_t i = 0; i < n_i; ++i) {
+                    size_t col {n_i > 1 ? (nx - w) * i / (n_i - 1) : 0};
+                    size_t row {n_j > 1 ? (ny - h) * j / (n_j - 1) : 0};
+                    windows.push_back(area.sub_area(
+                        coordinates::RasterCoordinate {
+                            static_cast<ct>(col), static_cast<ct>(row)},
+                        coordinates::RasterDims::create(w, h)));
+                }
+            }
+            return windows;
+        }
+
+        /*
+         * The flow routing skips its work in the dry-run mode, so the mode
+         * is turned off while the sample is carved.
+         */
+        class DryRunOff
+        {
+            public:
+                DryRunOff(): saved_ {global_parameters::dryRun}
+                {
+                    global_parameters::dryRun = false;
+                }
+                ~DryRunOff() { global_parameters::dryRun = saved_; }
+            private:
+                bool saved_;
+        };
+
+        /*
+         * Time the carving and the flow accumulation of the window. The
+         * depressions are recorded only if the culvert savings are
+         * estimated.
+         */
+        SampleCosts time_sample(const DemClass_t & dem, bool with_depressions)
+        {
+            DryRunOff dry_run_off;
+            DemClass_t dem_wrk {dem, "dem_wrk"};
+            dem_wrk.copy_data_from(dem);
+            DeltaDem_t delta_dem {dem, "d-DEM"};
+            delta_dem.format(0);
+            FlowDirClass_t flowdirs {dem, "flowdirs"};
+            CarvedCells_t carved_cells {dem, "carved_cells"};
+            carved_cells.no_data_value(0);
+            carved_cells.format(0);
+            CellGrid<acc_type, ct> accumulated {dem, "flow_accum"};
+            accumulated.format(0);
+            CulvertSet<DeltaDemDatatype> culverts {dem.area()};
+            DepressionHierarchy<DemDataType, ct> depressions;
+            const double n {static_cast<double>(dem.px_size())};
+
+            SampleCosts costs;
+            costs.minima_fraction =
+                static_cast<double>(find_minima(dem).size()) / n;
+
+            auto start = std::chrono::steady_clock::now();
+            CarvingAlgorithm_t carving_algorithm;
+            carving_algorithm.execute(dem_wrk, delta_dem, flowdirs,
+                carved_cells, culverts, true,
+                with_depressions ? &depressions : nullptr);
+            auto carved = std::chrono::steady_clock::now();
+            FlowAccumulationAlgorithm_t flow_accum_algorithm;
+            flow_accum_algorithm.execute(flowdirs, accumulated);
+            auto accumulated_at = std::chrono::steady_clock::now();
+
+            costs.carving_ns = 1e9 * std::chrono::duration<double>(
+                carved - start).count() / n;
+            costs.accumulation_ns = 1e9 * std::chrono::duration<double>(
+                accumulated_at - carved).count() / n;
+            return costs;
+        }
+
+    }
+
+    double Plan::peak_bytes() const
+    {
+        double peak {0.0};
+        for (const auto & s: stages) peak = std::max(peak, s.peak_bytes);
+        return peak;
+    }
+
+    double Plan::seconds_before_iterations() const
+    {
+        double seconds {0.0};
+        for (const auto & s: stages) {
+            if (!s.per_iteration) seconds += s.seconds;
+        }
+        return seconds;
+    }
+
+    double Plan::seconds_per_iteration() const
+    {
+        double seconds {0.0};
+        for (const auto & s: stages) {
+            if (s.per_iteration) seconds += s.seconds;
+        }
+        return seconds;
+    }
+
+    Plan plan_run(const ProgramCmdOpts & opts)
+    {
+        auto dem_data_source = io::create_raster_data_source(
+            {opts.dem_data_str()});
+        auto roads_data_source = io::create_raster_data_source(
+            {opts.road_data_str()});
+        const geo::RasterArea calc_area {dem_data_source->raster_area()};
+        const size_t n_cells {static_cast<size_t>(calc_area.pixel_width()) *
+            calc_area.pixel_height()};
+
+        Plan plan;
+
+        // The areas carved separately, and how many at a time.
+        std::vector<size_t> area_cells;
+        size_t n_sets {1};
+        const bool tiled {opts.tile_size() > 0};
+        plan.n_processes = 1;
+        if (tiled) {
+            auto tiles = tiling::plan_tiles(
+                calc_area, opts.tile_size(), opts.tile_halo());
+            for (const auto & t: tiles) {
+                area_cells.push_back(static_cast<size_t>(
+                    t.area.pixel_width()) * t.area.pixel_height());
+            }
+            plan.n_parallel = tiling::max_parallel_tiles(
+                tiles, opts.memory_budget());
+            // As in program(): each process gets a contiguous range of the
+            // tiles and its share of the tiles at a time, at least one.
+            plan.n_processes = std::min(
+                static_cast<size_t>(opts.processes()), tiles.size());
+            if (plan.n_processes > 1) {
+                plan.n_parallel = plan.n_processes * std::max(
+                    static_cast<size_t>(1), plan.n_parallel / plan.n_processes);
+            }
+        } else {
+            area_cells.push_back(n_cells);
+            if (!opts.sweep().empty()) {
+                n_sets = parameter_sets::read(opts.sweep(),
+                    parameter_sets::from_options(opts)).size();
+            }
+            plan.n_parallel = n_sets > 1 ? std::min(
+                tiling::max_parallel_copies(n_cells, n_sets,
+                    opts.memory_budget()),
+                static_cast<size_t>(
+                    std::numeric_limits<partitions::partition_id>::max())) : 1;
+        }
+        plan.n_areas = area_cells.size();
+        plan.max_area_cells = *std::max_element(
+            area_cells.begin(), area_cells.end());
+        // The threads are divided between the processes, and then between
+        // the areas of each process.
+        const size_t parallel_per_process {plan.n_parallel / plan.n_processes};
+        plan.threads_per_area = std::max(1u,
+            std::max(1u, parallel::n_threads() /
+                static_cast<unsigned int>(plan.n_processes)) /
+            static_cast<unsigned int>(parallel_per_process));
+        const double total_cells {static_cast<double>(std::accumulate(
+            area_cells.begin(), area_cells.end(), static_cast<size_t>(0)))};
+        // The run takes as long as the process with the most cells.
+        double busiest_cells {0.0};
+        for (size_t p = 0; p < plan.n_processes; ++p) {
+            busiest_cells = std::max(busiest_cells, static_cast<double>(
+                std::accumulate(
+                    area_cells.begin() +
+                        static_cast<long>(area_cells.size() * p / plan.n_processes),
+                    area_cells.begin() + static_cast<long>(
+                        area_cells.size() * (p + 1) / plan.n_processes),
+                    static_cast<size_t>(0))));
+        }
+
+        // The samples
+        size_t n_sampled {0};
+        size_t n_nodata {0};
+        size_t n_road {0};
+        SampleCosts sample_costs {0.0, 0.0, 0.0};
+        size_t timed_cells {0};
+        for (const auto & window: sample_windows(calc_area)) {
+            DemClass_t dem {window, "DEM sample"};
+            dem.no_data_value(0.0);
+            io::fill_array(dem, *dem_data_source);
+            CellGrid<road_raster_type, ct> roads {window, "roads sample"};
+            roads.no_data_value(0);
+            io::fill_array(roads, *roads_data_source);
+            const size_t n {dem.px_size()};
+            n_sampled += n;
+            n_nodata += static_cast<size_t>(std::count(
+                dem.data(), dem.data() + n, static_cast<DemDataType>(0.0)));
+            n_road += n - static_cast<size_t>(std::count(
+                roads.data(), roads.data() + n, static_cast<road_raster_type>(0)));
+            // one window is enough for the timing
+            if (timed_cells == 0) {
+                sample_costs = time_sample(dem,
+                    opts.min_culvert_saving() > 0);
+                timed_cells = n;
+            }
+        }
+        plan.nodata_fraction = static_cast<double>(n_nodata) /
+            static_cast<double>(n_sampled);
+        plan.road_fraction = static_cast<double>(n_road) /
+            static_cast<double>(n_sampled);
+
+        plan.carving_ns = sample_costs.carving_ns;
+        plan.accumulation_ns = sample_costs.accumulation_ns;
+
+        // The road index lists the road cells and their buffers, which
+        // reach road_buffer_width to both sides of the roads.
+        const double road_index_bytes {sizeof(size_t) * plan.road_fraction *
+            (1.0 + 2.0 * opts.road_buffer_width() / calc_area.cell_size())};
+
+        // The stages
+        const double road_scale {plan.road_fraction / ref_road_fraction};
+        for (const auto & m: stage_models(plan.max_area_cells, timed_cells,
+            sample_costs, road_index_bytes, opts.min_culvert_saving() > 0))
+        {
+            // The tiles are all carved separately, while the parameter
+            // sets share the stages before the iterations.
+            // The processes of the tiles run side by side, each with its
+            // share of the tiles at a time.
+            const size_t copies {tiled || m.per_iteration ? plan.n_parallel : 1};
+            const double runs {tiled || !m.per_iteration ?
+                1.0 : static_cast<double>(n_sets)};
+            const double concurrency {tiled ?
+                static_cast<double>(parallel_per_process) :
+                m.per_iteration ? static_cast<double>(plan.n_parallel) : 1.0};
+            const double cells {tiled ? busiest_cells : total_cells};
+            double ns {m.ns_per_cell * (m.road_scaled ? road_scale : 1.0)};
+            if (m.parallel) ns /= plan.threads_per_area;
+            plan.stages.push_back({
+                m.name,
+                (opts.memory_lean() ? m.lean_bytes : m.plain_bytes) +
+                    m.scratch_bytes,
+                1e-9 * ns * cells * runs / concurrency,
+                m.per_iteration});
+            plan.stages.back().peak_bytes *= static_cast<double>(
+                plan.max_area_cells * copies);
+        }
+
+        // The I/O: the DEM and the roads of each area are read, and the
+        // carved DEM of each parameter set is written when the DEM is
+        // processed at once. The vector outputs are not included.
+        plan.read_bytes = total_cells * (
+            GDALGetDataTypeSizeBytes(dem_data_source->data_type()) +
+            GDALGetDataTypeSizeBytes(roads_data_source->data_type()));
+        plan.write_bytes = tiled ? 0.0 : static_cast<double>(
+            n_cells * sizeof(DemDataType) * n_sets);
+
+        return plan;
+    }
+
+    void print(const Plan & plan, std::ostream & out)
+    {
+        const double mb {1024.0 * 1024.0};
+        out << "areas: " << plan.n_areas << "\n"
+            << "largest area cells: " << plan.max_area_cells << "\n"
+            << "areas at a time: " << plan.n_parallel << "\n"
+            << "processes: " << plan.n_processes << "\n"
+            << "threads per area: " << plan.threads_per_area << "\n"
+            << "sampled no-data fraction: " << plan.nodata_fraction << "\n"
+            << "sampled road fraction: " << plan.road_fraction << "\n"
+            << "sampled carving ns per cell: " << plan.carving_ns << "\n"
+            << "sampled flow accumulation ns per cell: "
+                << plan.accumulation_ns << "\n";
+        for (const auto & s: plan.stages) {
+            out << "stage " << s.name << " peak MB: "
+                << s.peak_bytes / mb << "\n"
+                << "stage " << s.name << " seconds: " << s.seconds
+                << (s.per_iteration ? " per iteration" : "") << "\n";
+        }
+        out << "peak MB: " << plan.peak_bytes() / mb << "\n"
+            << "read MB: " << plan.read_bytes / mb << "\n"
+            << "written MB: " << plan.write_bytes / mb << "\n"
+            << "seconds before iterations: "
+                << plan.seconds_before_iterations() << "\n"
+            << "seconds per iteration: " << plan.seconds_per_iteration()
+                << "\n";
+    }
+
+}
@@ -0,0 +1,84 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef RUN_PLANNER_H_
+#define RUN_PLANNER_H_
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "ProgramCmdOpts.h"
+
+/**
+ * \brief Estimates of the memory, I/O and runtime of a run, made without
+ * running it (--dry-run).
+ *
+ * Only the raster metadata and a few sample windows of the DEM and the
+ * roads are read. The memory of each stage is computed from the grids
+ * alive in it. The carving and the flow accumulation are timed on a
+ * sample window, and the runtimes of the other stages are estimated
+ * relative to the carving.
+ */
+namespace planning {
+
+    struct StageEstimate
+    {
+        std::string name;
+        // the peak of the stage in bytes, for all the areas processed at
+        // the same time
+        double peak_bytes;
+        // the wall time of the stage for the whole run, in seconds
+        double seconds;
+        // the stage is run in every culvert placing iteration
+        bool per_iteration;
+    };
+
+    struct Plan
+    {
+        size_t n_areas;
+        size_t max_area_cells;
+        // the areas at a time, in all the processes together
+        size_t n_parallel;
+        size_t n_processes;
+        unsigned int threads_per_area;
+        // the fractions of the no-data and the road cells in the samples
+        double nodata_fraction;
+        double road_fraction;
+        // the measured times of the sample per cell at one thread, which
+        // the other stages are scaled by
+        double carving_ns;
+        double accumulation_ns;
+        std::vector<StageEstimate> stages;
+        double read_bytes;
+        double write_bytes;
+
+        double peak_bytes() const;
+        double seconds_before_iterations() const;
+        double seconds_per_iteration() const;
+    };
+
+    /**
+     * \brief Plan the run given by the options (the whole DEM, the tiles of
+     * --tile-size or the parameter sets of --sweep).
+     *
+     * \throw std::runtime_error if the inputs cannot be read.
+     */
+    Plan plan_run(const ProgramCmdOpts & opts);
+
+    /**
+     * \brief Print the plan as "key: value" lines.
+     */
+    void print(const Plan & plan, std::ostream & out);
+
+}
+
+#endif
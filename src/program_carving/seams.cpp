@@ -0,0 +1,149 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "seams.h"
+
+#include <algorithm>
+
+namespace tiling {
+
+    namespace {
+
+        /*
+         * The index of the seam cell each seam cell flows to, or the
+         * number of the cells if the flow ends or goes to a cell that is
+         * not a seam cell.
+         */
+        std::vector<size_t> next_cells(const SeamFlow & flow)
+        {
+            const size_t n {flow.cells.size()};
+            std::vector<size_t> next(n, n);
+            for (size_t k = 0; k < n; ++k) {
+                const auto & c = flow.cells[k];
+                if (c.next != c.cell) next[k] = find_seam_cell(flow, c.next);
+            }
+            return next;
+        }
+
+    }
+
+    SeamFlow join_seams(std::vector<SeamCell> cells)
+    {
+        SeamFlow flow;
+        flow.cells = std::move(cells);
+        std::sort(flow.cells.begin(), flow.cells.end(),
+            [](const SeamCell & a, const SeamCell & b) {
+                return a.cell < b.cell; });
+        flow.n_unresolved = 0;
+
+        const size_t n {flow.cells.size()};
+        const auto next = next_cells(flow);
+        std::vector<unsigned int> n_upstream(n, 0);
+        for (size_t k = 0; k < n; ++k) {
+            const auto & c = flow.cells[k];
+            if (next[k] != n) {
+                ++n_upstream[next[k]];
+            } else if (c.next != c.cell) {
+                ++flow.n_unresolved;
+            }
+        }
+
+        // The flow from the other cores, passed down in the order of the
+        // flow. Within a core, the flow accumulation of the core already
+        // has the flow of the upstream cells.
+        std::vector<unsigned int> extra(n, 0);
+        std::vector<char> done(n, 0);
+        for (size_t k = 0; k < n; ++k) {
+            size_t c {k};
+            while (!done[c] && n_upstream[c] == 0) {
+                done[c] = 1;
+                const size_t t {next[c]};
+                if (t == n) break;
+                extra[t] += extra[c];
+                if (flow.cells[t].partition != flow.cells[c].partition) {
+                    extra[t] += flow.cells[c].core_acc;
+                }
+                if (--n_upstream[t] != 0) break;
+                c = t;
+            }
+        }
+
+        flow.total.resize(n);
+        for (size_t k = 0; k < n; ++k) {
+            if (!done[k]) ++flow.n_unresolved;
+            flow.total[k] = flow.cells[k].core_acc + extra[k];
+        }
+        return flow;
+    }
+
+    size_t find_seam_cell(
+        const SeamFlow & flow,
+        const coordinates::GlobalDataCoords & cell)
+    {
+        auto it = std::lower_bound(flow.cells.begin(), flow.cells.end(), cell,
+            [](const SeamCell & a, const coordinates::GlobalDataCoords & b) {
+                return a.cell < b; });
+        if (it == flow.cells.end() || it->cell != cell) {
+            return flow.cells.size();
+        }
+        return static_cast<size_t>(it - flow.cells.begin());
+    }
+
+    std::vector<std::pair<std::vector<coordinates::GlobalDataCoords>,
+        unsigned int>> seam_streams(
+        const SeamFlow & flow,
+        unsigned int threshold)
+    {
+        const size_t n {flow.cells.size()};
+        const auto next = next_cells(flow);
+        std::vector<char> missing(n, 0);
+        for (size_t k = 0; k < n; ++k) {
+            missing[k] = flow.cells[k].tile_acc < threshold &&
+                flow.total[k] >= threshold;
+        }
+        std::vector<unsigned int> n_upstream(n, 0);
+        for (size_t k = 0; k < n; ++k) {
+            if (missing[k] && next[k] != n) ++n_upstream[next[k]];
+        }
+
+        // A chain starts where a missing stream starts or two of them
+        // join, as in the streams of the tiles.
+        auto starts = [&](size_t k) {
+            return missing[k] && n_upstream[k] != 1; };
+        // Only the flow directions to a neighbouring cell are followed,
+        // the longer ones are culverts.
+        auto adjacent = [](const SeamCell & c) {
+            return std::abs(static_cast<long>(c.next.col()) -
+                    static_cast<long>(c.cell.col())) <= 1 &&
+                std::abs(static_cast<long>(c.next.row()) -
+                    static_cast<long>(c.cell.row())) <= 1;
+        };
+
+        std::vector<std::pair<std::vector<coordinates::GlobalDataCoords>,
+            unsigned int>> lines;
+        for (size_t k = 0; k < n; ++k) {
+            if (!starts(k)) continue;
+            std::vector<coordinates::GlobalDataCoords> line {flow.cells[k].cell};
+            size_t c {k};
+            // the steps are bounded, as the flow may loop
+            for (size_t step = 0; step < n; ++step) {
+                const auto & cell = flow.cells[c];
+                if (cell.next == cell.cell || !adjacent(cell)) break;
+                line.push_back(cell.next);
+                c = next[c];
+                if (c == n || !missing[c] || starts(c)) break;
+            }
+            if (line.size() > 1) lines.push_back({line, flow.total[k]});
+        }
+        return lines;
+    }
+
+}
@@ -0,0 +1,222 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef SEAMS_H_
+#define SEAMS_H_
+
+#include <utility>
+#include <vector>
+
+#include "CellGrid.h"
+#include "coordinates.h"
+#include "tile_scheduler.h"
+
+/**
+ * \brief Joining the flow accumulations of the tiles across the seams
+ * between their cores.
+ *
+ * A tile sees the cells upstream of its core only as far as its halo
+ * reaches. Each tile reports the cells of its core on the flow paths that
+ * may enter or leave the core, with the flow accumulation of the core
+ * alone, and the flow is passed from core to core along those cells.
+ */
+namespace tiling {
+
+    /**
+     * \brief A cell of a core on a flow path that starts near the
+     * boundary of the core.
+     */
+    struct SeamCell
+    {
+        // the cell in the whole raster
+        coordinates::GlobalDataCoords cell;
+        // the cell the flow continues to, or the cell itself where the
+        // flow ends or leaves the raster
+        coordinates::GlobalDataCoords next;
+        // the tile whose core has the cell
+        coordinates::PartitionCoordinate partition;
+        // the flow accumulation from the cells of the core only
+        unsigned int core_acc;
+        // the flow accumulation in the tile, halo included
+        unsigned int tile_acc;
+    };
+
+    /**
+     * \brief The flow accumulation of the seam cells of all the tiles.
+     */
+    struct SeamFlow
+    {
+        // the seam cells in the order of the cells
+        std::vector<SeamCell> cells;
+        // the flow accumulation of each cell over all the cores
+        std::vector<unsigned int> total;
+        // the number of cells on a loop of the flow or whose flow goes to
+        // a cell no tile reported, and so lack some of their flow
+        size_t n_unresolved;
+    };
+
+    /**
+     * \brief The seam cells of the core of the tile, from the flow
+     * directions and the flow accumulation of the tile. The flow
+     * directions move at most reach cells at a time, and only the flow
+     * paths starting that close to a side of the core that has other
+     * cores behind it are reported. The raster is the area of all the
+     * tiles.
+     */
+    template<typename D, typename A, typename C>
+    std::vector<SeamCell> seam_cells(
+        const Tile & tile,
+        const geo::RasterArea & raster,
+        const CellGrid<D, C> & flowdirs,
+        const CellGrid<A, C> & accumulated,
+        unsigned int reach);
+
+    /**
+     * \brief Pass the flow between the cores along the seam cells of all
+     * the tiles.
+     */
+    SeamFlow join_seams(std::vector<SeamCell> cells);
+
+    /**
+     * \brief The index of the cell in the seam flow, or the number of the
+     * cells if it is not a seam cell.
+     */
+    size_t find_seam_cell(
+        const SeamFlow & flow,
+        const coordinates::GlobalDataCoords & cell);
+
+    /**
+     * \brief The streams (the cells with a flow accumulation of at least
+     * threshold) that only exist over the seams: the chains of the seam
+     * cells that reach the threshold with the flow of the other cores but
+     * not in their own tile. Each chain ends at the cell it flows to, so
+     * it joins the streams of the tiles. The accumulation of a chain is
+     * that of its first cell.
+     */
+    std::vector<std::pair<std::vector<coordinates::GlobalDataCoords>,
+        unsigned int>> seam_streams(
+        const SeamFlow & flow,
+        unsigned int threshold);
+
+    /* implementation */
+
+    template<typename D, typename A, typename C>
+    std::vector<SeamCell> seam_cells(
+        const Tile & tile,
+        const geo::RasterArea & raster,
+        const CellGrid<D, C> & flowdirs,
+        const CellGrid<A, C> & accumulated,
+        unsigned int reach)
+    {
+        using coordinates::GlobalDataCoords;
+        const auto local = tile.core.pixel_offset_to(flowdirs.area());
+        const auto global = tile.core.pixel_offset_to(raster);
+        const long nx {static_cast<long>(flowdirs.px_width())};
+        const long cw {static_cast<long>(tile.core.pixel_width())};
+        const long ch {static_cast<long>(tile.core.pixel_height())};
+        const long gw {static_cast<long>(raster.pixel_width())};
+        const long gh {static_cast<long>(raster.pixel_height())};
+        const long r {static_cast<long>(reach)};
+        const size_t n {static_cast<size_t>(cw * ch)};
+        const D * fd_data {flowdirs.data()};
+
+        // The cell of the core the flow of the core cell k goes to, or n
+        // if the flow leaves the core or ends.
+        auto core_next = [&](size_t k) -> size_t
+        {
+            const long i {static_cast<long>(k) % cw};
+            const long j {static_cast<long>(k) / cw};
+            const D fd {fd_data[coordinates::to_raster_index(
+                static_cast<size_t>(i + local.dx()),
+                static_cast<size_t>(j + local.dy()),
+                static_cast<size_t>(nx))]};
+            const long ni {i + fd.x};
+            const long nj {j + fd.y};
+            if ((fd.x == 0 && fd.y == 0) ||
+                ni < 0 || nj < 0 || ni >= cw || nj >= ch)
+            {
+                return n;
+            }
+            return static_cast<size_t>(nj * cw + ni);
+        };
+
+        // the flow accumulation of the core alone, in the order of the
+        // flow
+        std::vector<unsigned int> core_acc(n, 1);
+        std::vector<unsigned int> n_upstream(n, 0);
+        for (size_t k = 0; k < n; ++k) {
+            const size_t next {core_next(k)};
+            if (next != n) ++n_upstream[next];
+        }
+        for (size_t k = 0; k < n; ++k) {
+            size_t c {k};
+            while (n_upstream[c] == 0) {
+                // mark the cell done
+                n_upstream[c] = 1;
+                const size_t next {core_next(c)};
+                if (next == n) break;
+                core_acc[next] += core_acc[c];
+                if (--n_upstream[next] != 0) break;
+                c = next;
+            }
+        }
+
+        // the cells downstream of the cells near the sides of the core
+        // with other cores behind them
+        const bool left {global.dx() > 0};
+        const bool top {global.dy() > 0};
+        const bool right {global.dx() + cw < gw};
+        const bool bottom {global.dy() + ch < gh};
+        std::vector<char> on_seam(n, 0);
+        for (size_t k = 0; k < n; ++k) {
+            const long i {static_cast<long>(k) % cw};
+            const long j {static_cast<long>(k) / cw};
+            if (!((left && i < r) || (right && i >= cw - r) ||
+                  (top && j < r) || (bottom && j >= ch - r)))
+            {
+                continue;
+            }
+            for (size_t c = k; c != n && !on_seam[c]; c = core_next(c)) {
+                on_seam[c] = 1;
+            }
+        }
+
+        std::vector<SeamCell> cells;
+        for (size_t k = 0; k < n; ++k) {
+            if (!on_seam[k]) continue;
+            const long i {static_cast<long>(k) % cw};
+            const long j {static_cast<long>(k) / cw};
+            const size_t ind {coordinates::to_raster_index(
+                static_cast<size_t>(i + local.dx()),
+                static_cast<size_t>(j + local.dy()),
+                static_cast<size_t>(nx))};
+            const D fd {fd_data[ind]};
+            const long gi {i + global.dx()};
+            const long gj {j + global.dy()};
+            const GlobalDataCoords cell {GlobalDataCoords::create(
+                static_cast<size_t>(gi), static_cast<size_t>(gj))};
+            GlobalDataCoords next {cell};
+            if (gi + fd.x >= 0 && gj + fd.y >= 0 &&
+                gi + fd.x < gw && gj + fd.y < gh)
+            {
+                next = GlobalDataCoords::create(
+                    static_cast<size_t>(gi + fd.x),
+                    static_cast<size_t>(gj + fd.y));
+            }
+            cells.push_back({cell, next, tile.position, core_acc[k],
+                static_cast<unsigned int>(accumulated.data()[ind])});
+        }
+        return cells;
+    }
+
+}
+
+#endif
@@ -0,0 +1,122 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "tile_scheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace tiling {
+
+    namespace {
+        // A rough upper bound of the memory used by the carving pipeline
+        // per cell: the DEM twice, the delta DEM, the flow directions, the
+        // road rasters, the flow accumulation and the bookkeeping of the
+        // carving.
+        const double bytes_per_cell {48.0};
+    }
+
+    std::vector<Tile> plan_tiles(
+        const geo::RasterArea & area,
+        double tile_size,
+        double halo)
+    {
+        if (tile_size <= 0) {
+            throw std::runtime_error("The size of the tiles must be positive.");
+        }
+        if (halo < 0) {
+            throw std::runtime_error("The halo of the tiles must be positive.");
+        }
+        using ct = coordinates::raster_coord_type;
+        const double cs {area.cell_size()};
+        const size_t nx {area.pixel_width()};
+        const size_t ny {area.pixel_height()};
+        const size_t tile_px {std::max(static_cast<size_t>(1),
+            static_cast<size_t>(std::round(tile_size / cs)))};
+        const size_t halo_px {static_cast<size_t>(std::ceil(halo / cs))};
+
+        auto sub = [&](size_t col0, size_t row0, size_t col1, size_t row1)
+        {
+            return area.sub_area(
+                coordinates::RasterCoordinate {
+                    static_cast<ct>(col0), static_cast<ct>(row0)},
+                coordinates::RasterDims::create(col1 - col0, row1 - row0));
+        };
+
+        std::vector<Tile> tiles;
+        for (size_t row = 0; row < ny; row += tile_px) {
+            for (size_t col = 0; col < nx; col += tile_px) {
+                size_t col_end {std::min(nx, col + tile_px)};
+                size_t row_end {std::min(ny, row + tile_px)};
+                tiles.push_back({
+                    sub(col, row, col_end, row_end),
+                    sub(col > halo_px ? col - halo_px : 0,
+                        row > halo_px ? row - halo_px : 0,
+                        std::min(nx, col_end + halo_px),
+                        std::min(ny, row_end + halo_px)),
+                    coordinates::PartitionCoordinate::create(
+                        col / tile_px, row / tile_px)});
+            }
+        }
+        return tiles;
+    }
+
+    bool insert_area(
+        const Tile & tile,
+        double halo,
+        geo::RasterArea & area)
+    {
+        const size_t halo_px {static_cast<size_t>(
+            std::ceil(halo / tile.area.cell_size()))};
+        if (tile.area.pixel_width() <= 2 * halo_px ||
+            tile.area.pixel_height() <= 2 * halo_px)
+        {
+            return false;
+        }
+        area = tile.area;
+        area.add_halo(-halo);
+        return true;
+    }
+
+    size_t max_parallel_tiles(
+        const std::vector<Tile> & tiles,
+        double memory_budget)
+    {
+        size_t max_cells {0};
+        for (const auto & t: tiles) {
+            max_cells = std::max(max_cells,
+                static_cast<size_t>(t.area.pixel_width()) *
+                t.area.pixel_height());
+        }
+        return max_parallel_copies(max_cells, tiles.size(), memory_budget);
+    }
+
+    size_t max_parallel_copies(
+        size_t n_cells,
+        size_t n,
+        double memory_budget)
+    {
+        if (n == 0) return 1;
+        if (memory_budget <= 0 || n_cells == 0) return n;
+        double fit {memory_budget * 1024 * 1024 /
+            (bytes_per_cell * static_cast<double>(n_cells))};
+        return std::max(static_cast<size_t>(1),
+            std::min(n, static_cast<size_t>(fit)));
+    }
+
+    bool owns(const geo::RasterArea & core, const geo::GeoCoordinate & p)
+    {
+        return p.x() >= core.left() && p.x() < core.right() &&
+            p.y() > core.bottom() && p.y() <= core.top();
+    }
+
+}
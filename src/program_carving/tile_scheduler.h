@@ -0,0 +1,144 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef TILE_SCHEDULER_H_
+#define TILE_SCHEDULER_H_
+
+#include <vector>
+
+#include "RasterArea.h"
+#include "coordinates.h"
+#include "geo.h"
+
+/**
+ * \brief Splitting of a large raster into overlapping tiles that are
+ * processed independently.
+ *
+ * Each tile has a core, and the cores cover the raster without overlap.
+ * The tile is processed with a halo around the core, so that the flow
+ * routing near the core boundary sees the terrain on the other side, and
+ * only the results inside the core are kept.
+ */
+namespace tiling {
+
+    struct Tile
+    {
+        // the cells owned by the tile
+        geo::RasterArea core;
+        // the core with the halo, clipped to the raster
+        geo::RasterArea area;
+        // the column and the row of the tile in the grid of the tiles
+        coordinates::PartitionCoordinate position;
+    };
+
+    /**
+     * \brief Split the area into square tiles of tile_size meters with a
+     * halo of halo meters, in the row-major order.
+     */
+    std::vector<Tile> plan_tiles(
+        const geo::RasterArea & area,
+        double tile_size,
+        double halo);
+
+    /**
+     * \brief The area of the tile in which the culverts are placed: its
+     * area without the outermost halo meters, as the culvert searches look
+     * at the cells around them. False if nothing is left of the tile.
+     */
+    bool insert_area(
+        const Tile & tile,
+        double halo,
+        geo::RasterArea & area);
+
+    /**
+     * \brief The number of tiles that fit to the memory budget (in
+     * megabytes) at the same time, at least one. Zero budget means no
+     * limit.
+     */
+    size_t max_parallel_tiles(
+        const std::vector<Tile> & tiles,
+        double memory_budget);
+
+    /**
+     * \brief The number of copies of the pipeline state of an area of
+     * n_cells cells that fit to the memory budget at the same time,
+     * between one and n.
+     */
+    size_t max_parallel_copies(
+        size_t n_cells,
+        size_t n,
+        double memory_budget);
+
+    /**
+     * \brief True if the point belongs to the core. The cores are
+     * half-open, so a point on the boundary of two cores belongs to one of
+     * them only.
+     */
+    bool owns(const geo::RasterArea & core, const geo::GeoCoordinate & p);
+
+    /**
+     * \brief Keep the line features (culverts) whose midpoint between the
+     * first and the last point belongs to the core.
+     */
+    template<typename L>
+    void keep_owned_culverts(const geo::RasterArea & core, L & lines);
+
+    /**
+     * \brief Keep the parts of the lines (streams) that belong to the
+     * core. A line segment belongs to the core of its midpoint, so the
+     * lines of the neighbouring tiles meet at the core boundaries.
+     */
+    template<typename L>
+    void keep_owned_lines(const geo::RasterArea & core, L & lines);
+
+    /* implementation */
+
+    template<typename L>
+    void keep_owned_culverts(const geo::RasterArea & core, L & lines)
+    {
+        L kept;
+        for (auto & l: lines) {
+            const auto & a = l.first.front();
+            const auto & b = l.first.back();
+            if (owns(core, {(a.x() + b.x()) / 2, (a.y() + b.y()) / 2})) {
+                kept.push_back(std::move(l));
+            }
+        }
+        lines.swap(kept);
+    }
+
+    template<typename L>
+    void keep_owned_lines(const geo::RasterArea & core, L & lines)
+    {
+        L kept;
+        for (auto & l: lines) {
+            const auto & pts = l.first;
+            auto part = l;
+            part.first.clear();
+            for (size_t k = 1; k < pts.size(); ++k) {
+                bool owned {owns(core, {(pts[k - 1].x() + pts[k].x()) / 2,
+                                        (pts[k - 1].y() + pts[k].y()) / 2})};
+                if (owned) {
+                    if (part.first.empty()) part.first.push_back(pts[k - 1]);
+                    part.first.push_back(pts[k]);
+                } else if (!part.first.empty()) {
+                    kept.push_back(part);
+                    part.first.clear();
+                }
+            }
+            if (!part.first.empty()) kept.push_back(std::move(part));
+        }
+        lines.swap(kept);
+    }
+
+}
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "StageRunner.h"
+
+#include <stdexcept>
+
+#include "logging.h"
+
+StageRunner::stage_id StageRunner::add_source(const std::string & name)
+{
+    stages_.push_back({name, {}, {}, 1, {}, 0});
+    return stages_.size() - 1;
+}
+
+StageRunner::stage_id StageRunner::add_stage(
+    const std::string & name,
+    const std::vector<stage_id> & depends_on,
+    std::function<void()> compute)
+{
+    // The stages can only depend on the earlier ones, so there are no
+    // cycles.
+    for (auto d: depends_on) {
+        if (d >= stages_.size()) {
+            throw std::runtime_error(
+                "Stage " + name + " depends on an unknown stage.");
+        }
+    }
+    stages_.push_back({name, depends_on, std::move(compute), 0,
+        std::vector<version_type>(depends_on.size(), 0), 0});
+    return stages_.size() - 1;
+}
+
+void StageRunner::invalidate(stage_id s)
+{
+    ++stages_.at(s).version;
+}
+
+bool StageRunner::up_to_date(stage_id s) const
+{
+    const Stage & stage {stages_.at(s)};
+    if (!stage.compute) return true;
+    if (stage.version == 0) return false;
+    for (size_t k = 0; k < stage.depends_on.size(); ++k) {
+        stage_id d {stage.depends_on[k]};
+        if (!up_to_date(d) || stages_[d].version != stage.computed_from[k]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+StageRunner::version_type StageRunner::require(stage_id s)
+{
+    Stage & stage {stages_.at(s)};
+    if (!stage.compute) return stage.version;
+
+    std::vector<version_type> from(stage.depends_on.size());
+    for (size_t k = 0; k < stage.depends_on.size(); ++k) {
+        from[k] = require(stage.depends_on[k]);
+    }
+    if (stage.version == 0 || from != stage.computed_from) {
+        logging::pLog() << "Computing " << stage.name << ".";
+        stage.compute();
+        // Recorded only after a successful computation, so that a half
+        // computed result is never taken as up to date.
+        stage.computed_from.swap(from);
+        ++stage.version;
+        ++stage.n_computed;
+    }
+    return stage.version;
+}
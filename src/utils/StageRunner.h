@@ -0,0 +1,98 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef STAGE_RUNNER_H_
+#define STAGE_RUNNER_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * \brief Lazy evaluation of the processing stages of a program.
+ *
+ * Each stage produces some data (usually grids) from the data of the stages
+ * it depends on, and each computation gives the data of the stage a new
+ * version. A stage is computed only when its data is requested
+ * (require()) and some of the stages it depends on has a newer version than
+ * the one it was computed from. The sources are stages without a
+ * computation, whose version is increased by invalidate() whenever the
+ * data they represent changes.
+ */
+class StageRunner
+{
+    public:
+        using stage_id = size_t;
+        using version_type = unsigned long;
+
+        /**
+         * \brief Add a source, i.e. data that changes outside the runner.
+         */
+        stage_id add_source(const std::string & name);
+
+        /**
+         * \brief Add a stage that is computed with \a compute from the data
+         * of the stages \a depends_on.
+         */
+        stage_id add_stage(
+            const std::string & name,
+            const std::vector<stage_id> & depends_on,
+            std::function<void()> compute);
+
+        /**
+         * \brief Tell that the data of the source (or the stage) has
+         * changed.
+         */
+        void invalidate(stage_id s);
+
+        /**
+         * \brief Compute the stage and the stages it depends on, if they
+         * are not up to date.
+         *
+         * The runner is not thread safe, but the stages that share none of
+         * the stages they depend on can be required from different threads
+         * at the same time.
+         *
+         * \return The version of the data of the stage.
+         */
+        version_type require(stage_id s);
+
+        /**
+         * \brief True if the data of the stage is up to date, i.e.
+         * require() would compute nothing.
+         */
+        bool up_to_date(stage_id s) const;
+
+        version_type version(stage_id s) const { return stages_[s].version; }
+
+        /**
+         * \brief The number of times the stage has been computed.
+         */
+        unsigned int n_computed(stage_id s) const {
+            return stages_[s].n_computed; }
+
+    private:
+        struct Stage
+        {
+            std::string name;
+            std::vector<stage_id> depends_on;
+            std::function<void()> compute;
+            // zero means that the data has never been computed
+            version_type version;
+            // the versions of depends_on in the latest computation
+            std::vector<version_type> computed_from;
+            unsigned int n_computed;
+        };
+
+        std::vector<Stage> stages_;
+};
+
+#endif
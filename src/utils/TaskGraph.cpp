@@ -0,0 +1,112 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "TaskGraph.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+
+#include "logging.h"
+#include "parallel.h"
+
+TaskGraph::task_id TaskGraph::add(
+    const std::string & name,
+    const std::vector<task_id> & depends_on,
+    std::function<void()> f)
+{
+    // The tasks can only depend on the earlier ones, so there are no
+    // cycles.
+    for (auto d: depends_on) {
+        if (d >= tasks_.size()) {
+            throw std::runtime_error(
+                "Task " + name + " depends on an unknown task.");
+        }
+    }
+    tasks_.push_back({name, depends_on, std::move(f)});
+    return tasks_.size() - 1;
+}
+
+void TaskGraph::run(size_t max_workers)
+{
+    const size_t n {tasks_.size()};
+    if (n == 0) return;
+
+    // the number of unfinished tasks each task depends on
+    std::vector<size_t> n_waiting(n, 0);
+    std::vector<std::vector<task_id>> dependents(n);
+    std::set<task_id> ready;
+    for (task_id t = 0; t < n; ++t) {
+        for (auto d: tasks_[t].depends_on) {
+            ++n_waiting[t];
+            dependents[d].push_back(t);
+        }
+        if (n_waiting[t] == 0) ready.insert(t);
+    }
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t n_running {0};
+    std::exception_ptr error;
+    // the tasks see the thread limit of the calling thread
+    const unsigned int limit {parallel::n_threads()};
+    auto work = [&]()
+    {
+        parallel::ThreadLimit thread_limit {limit};
+        std::unique_lock<std::mutex> lock {mutex};
+        while (!error) {
+            if (ready.empty()) {
+                // all the tasks are done, as there are no cycles
+                if (n_running == 0) break;
+                changed.wait(lock);
+                continue;
+            }
+            const task_id t {*ready.begin()};
+            ready.erase(ready.begin());
+            ++n_running;
+            lock.unlock();
+            std::exception_ptr task_error;
+            try {
+                logging::pLog() << "Running " << tasks_[t].name << ".";
+                tasks_[t].f();
+            } catch (...) {
+                task_error = std::current_exception();
+            }
+            lock.lock();
+            --n_running;
+            if (task_error) {
+                if (!error) error = task_error;
+            } else {
+                for (auto d: dependents[t]) {
+                    if (--n_waiting[d] == 0) ready.insert(d);
+                }
+            }
+            changed.notify_all();
+        }
+    };
+
+    size_t n_workers {std::min(static_cast<size_t>(parallel::n_threads()), n)};
+    if (max_workers > 0) n_workers = std::min(n_workers, max_workers);
+    std::vector<std::thread> threads;
+    threads.reserve(n_workers - 1);
+    for (size_t w = 1; w < n_workers; ++w) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto & t: threads) {
+        t.join();
+    }
+    if (error) std::rethrow_exception(error);
+}
@@ -0,0 +1,70 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef TASK_GRAPH_H_
+#define TASK_GRAPH_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * \brief Tasks run on the worker threads as soon as the tasks they depend
+ * on have finished.
+ *
+ * Unlike the stages of a StageRunner, which are computed one at a time
+ * when their data is needed, all the tasks of the graph are run once by
+ * run(), and the tasks that do not depend on each other run at the same
+ * time. Thus the length of a run is that of its longest chain of
+ * dependent tasks.
+ */
+class TaskGraph
+{
+    public:
+        using task_id = size_t;
+
+        /**
+         * \brief Add a task that runs \a f after the tasks \a depends_on.
+         */
+        task_id add(
+            const std::string & name,
+            const std::vector<task_id> & depends_on,
+            std::function<void()> f);
+
+        /**
+         * \brief Run the tasks, at most max_workers at the same time (zero
+         * means parallel::n_threads()). The calling thread is one of the
+         * workers. The ready tasks are started in the order they were
+         * added.
+         *
+         * The other workers are new threads, started by each call and
+         * joined before it returns. They get the parallel::ThreadLimit of
+         * the calling thread, so the tasks see the same n_threads().
+         *
+         * An exception thrown by a task stops the starting of new tasks and
+         * is rethrown after the running ones have finished.
+         */
+        void run(size_t max_workers = 0);
+
+        size_t size() const { return tasks_.size(); }
+
+    private:
+        struct Task
+        {
+            std::string name;
+            std::vector<task_id> depends_on;
+            std::function<void()> f;
+        };
+
+        std::vector<Task> tasks_;
+};
+
+#endif
@@ -0,0 +1,312 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef CONNECTED_COMPONENTS_H_
+#define CONNECTED_COMPONENTS_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "parallel.h"
+
+/**
+ * \brief Connected component labelling of a raster.
+ */
+namespace connected_components {
+
+    /**
+     * \brief Label the 4-connected components of the member cells.
+     *
+     * The raster is split into horizontal strips that are labelled in
+     * parallel with a union-find structure. The equivalences at the strip
+     * seams are then merged, and the components are numbered in the order
+     * of their first cell in the row-major order.
+     *
+     * \param is_member A functor returning true for the raster index of a
+     * cell that belongs to some component. It is called concurrently from
+     * several threads.
+     * \param labels The output, nx * ny values. The cells of the n:th
+     * component get the value n (starting from 1) and the other cells zero.
+     * \return The number of components.
+     */
+    template<typename F>
+    size_t label_4_connected(
+        F is_member,
+        size_t nx,
+        size_t ny,
+        std::vector<std::uint32_t> & labels);
+
+    /**
+     * \brief Label the 4-connected components of a sparse set of cells.
+     *
+     * \param cells The raster indices of the cells in the ascending order.
+     * \param is_member A functor returning true for the position (in
+     * \a cells) of a cell that belongs to some component.
+     * \param labels The output, one value per cell as in label_4_connected.
+     * \param n_strips The number of the parallel strips, zero means the
+     * number of threads.
+     * \return The number of components.
+     */
+    template<typename F>
+    size_t label_4_connected_sparse(
+        const size_t * cells,
+        size_t n_cells,
+        size_t nx,
+        F is_member,
+        std::vector<std::uint32_t> & labels,
+        size_t n_strips = 0);
+
+    /* implementation */
+
+    namespace detail {
+
+        template<typename L>
+        L find_root(std::vector<L> & parent, L l)
+        {
+            L root {l};
+            while (parent[root] != root) root = parent[root];
+            while (parent[l] != root) {
+                L next {parent[l]};
+                parent[l] = root;
+                l = next;
+            }
+            return root;
+        }
+
+        // Join the sets of a and b so that the smaller label becomes the
+        // root.
+        template<typename L>
+        void join(std::vector<L> & parent, L a, L b)
+        {
+            a = find_root(parent, a);
+            b = find_root(parent, b);
+            if (a < b) {
+                parent[b] = a;
+            } else if (b < a) {
+                parent[a] = b;
+            }
+        }
+
+    }
+
+    template<typename F>
+    size_t label_4_connected(
+        F is_member,
+        size_t nx,
+        size_t ny,
+        std::vector<std::uint32_t> & labels)
+    {
+        using label_t = std::uint32_t;
+        const size_t max_labels {std::numeric_limits<label_t>::max() - 1};
+        labels.assign(nx * ny, 0);
+        if (nx == 0 || ny == 0) return 0;
+
+        // The strips must be small enough for the local labels.
+        size_t n_strips {std::max(
+            static_cast<size_t>(parallel::n_threads()),
+            (nx * ny + max_labels - 1) / max_labels)};
+        n_strips = std::min(n_strips, ny);
+        auto strip_begin = [&](size_t s) { return (ny * s) / n_strips; };
+
+        // Pass 1: label each strip with local labels 1, 2, ... and record
+        // the local equivalences. The label of the first cell of a component
+        // is created first, so it ends up as the root.
+        std::vector<std::vector<label_t>> local_parents(n_strips);
+        parallel::for_blocks(n_strips, [&](size_t s_begin, size_t s_end)
+        {
+            for (size_t s = s_begin; s < s_end; ++s) {
+                std::vector<label_t> & parent {local_parents[s]};
+                parent.push_back(0);
+                size_t j0 {strip_begin(s)};
+                size_t j1 {strip_begin(s + 1)};
+                for (size_t j = j0; j < j1; ++j) {
+                    for (size_t i = 0; i < nx; ++i) {
+                        size_t ind {j * nx + i};
+                        if (!is_member(ind)) continue;
+                        label_t left {i > 0 ? labels[ind - 1] : 0};
+                        label_t up {j > j0 ? labels[ind - nx] : 0};
+                        if (left == 0 && up == 0) {
+                            label_t l {static_cast<label_t>(parent.size())};
+                            parent.push_back(l);
+                            labels[ind] = l;
+                        } else if (up == 0) {
+                            labels[ind] = left;
+                        } else if (left == 0) {
+                            labels[ind] = up;
+                        } else {
+                            labels[ind] = std::min(left, up);
+                            if (left != up) detail::join(parent, left, up);
+                        }
+                    }
+                }
+            }
+        });
+
+        // Move the local labels into the global label space.
+        std::vector<size_t> offsets(n_strips + 1, 0);
+        for (size_t s = 0; s < n_strips; ++s) {
+            offsets[s + 1] = offsets[s] + local_parents[s].size() - 1;
+        }
+        std::vector<size_t> parent(offsets[n_strips]);
+        for (size_t s = 0; s < n_strips; ++s) {
+            auto & local = local_parents[s];
+            for (label_t l = 1; l < local.size(); ++l) {
+                parent[offsets[s] + l - 1] =
+                    offsets[s] + detail::find_root(local, l) - 1;
+            }
+            std::vector<label_t>().swap(local);
+        }
+
+        // Merge the components over the strip seams.
+        for (size_t s = 1; s < n_strips; ++s) {
+            size_t j {strip_begin(s)};
+            for (size_t i = 0; i < nx; ++i) {
+                label_t a {labels[(j - 1) * nx + i]};
+                label_t b {labels[j * nx + i]};
+                if (a != 0 && b != 0) {
+                    detail::join(parent,
+                        offsets[s - 1] + a - 1,
+                        offsets[s] + b - 1);
+                }
+            }
+        }
+
+        // Number the components in the order of the roots, which is the
+        // order of their first cells.
+        size_t n_components {0};
+        std::vector<label_t> ids(parent.size());
+        for (size_t l = 0; l < parent.size(); ++l) {
+            size_t root {detail::find_root(parent, l)};
+            if (root == l) {
+                if (n_components == max_labels) {
+                    throw std::runtime_error(
+                        "Too many connected components.");
+                }
+                ids[l] = static_cast<label_t>(++n_components);
+            } else {
+                // the root has a smaller label and has been numbered already
+                ids[l] = ids[root];
+            }
+        }
+        std::vector<size_t>().swap(parent);
+
+        parallel::for_blocks(n_strips, [&](size_t s_begin, size_t s_end)
+        {
+            for (size_t s = s_begin; s < s_end; ++s) {
+                for (size_t ind = strip_begin(s) * nx;
+                     ind < strip_begin(s + 1) * nx; ++ind)
+                {
+                    if (labels[ind] != 0) {
+                        labels[ind] = ids[offsets[s] + labels[ind] - 1];
+                    }
+                }
+            }
+        });
+        return n_components;
+    }
+
+    template<typename F>
+    size_t label_4_connected_sparse(
+        const size_t * cells,
+        size_t n_cells,
+        size_t nx,
+        F is_member,
+        std::vector<std::uint32_t> & labels,
+        size_t n_strips)
+    {
+        using label_t = std::uint32_t;
+        labels.assign(n_cells, 0);
+        if (n_cells == 0) return 0;
+        if (n_strips == 0) n_strips = parallel::n_threads();
+
+        // Split the cells into strips of whole rows.
+        std::vector<size_t> bounds {0};
+        for (size_t s = 1; s < n_strips; ++s) {
+            size_t k {std::max((n_cells * s) / n_strips, bounds.back())};
+            while (k > 0 && k < n_cells && cells[k] / nx == cells[k - 1] / nx) {
+                ++k;
+            }
+            bounds.push_back(k);
+        }
+        bounds.push_back(n_cells);
+        n_strips = bounds.size() - 1;
+
+        // Pass 1: join each member cell with its left and upper neighbours
+        // inside the same strip. The union-find structure works directly on
+        // the cell positions, and each strip only touches its own positions.
+        // The cells above are found with a second cursor that advances
+        // together with the current cell.
+        std::vector<size_t> parent(n_cells);
+        parallel::for_blocks(n_strips, [&](size_t s_begin, size_t s_end)
+        {
+            for (size_t s = s_begin; s < s_end; ++s) {
+                size_t p {bounds[s]};
+                for (size_t k = bounds[s]; k < bounds[s + 1]; ++k) {
+                    parent[k] = k;
+                    if (!is_member(k)) continue;
+                    labels[k] = 1;
+                    size_t ind {cells[k]};
+                    if (k > bounds[s] && cells[k - 1] + 1 == ind &&
+                        ind % nx != 0 && labels[k - 1])
+                    {
+                        detail::join(parent, k - 1, k);
+                    }
+                    if (ind < nx) continue;
+                    while (p < k && cells[p] < ind - nx) ++p;
+                    if (p < k && cells[p] == ind - nx && labels[p]) {
+                        detail::join(parent, p, k);
+                    }
+                }
+            }
+        });
+
+        // Merge the components over the strip seams.
+        for (size_t s = 1; s < n_strips; ++s) {
+            size_t b {bounds[s]};
+            if (b == n_cells) break;
+            size_t row {cells[b] / nx};
+            for (size_t k = b; k < bounds[s + 1] && cells[k] / nx == row; ++k) {
+                if (!labels[k] || cells[k] < nx) continue;
+                const size_t * up {
+                    std::lower_bound(cells, cells + b, cells[k] - nx)};
+                size_t p {static_cast<size_t>(up - cells)};
+                if (p < b && cells[p] == cells[k] - nx && labels[p]) {
+                    detail::join(parent, p, k);
+                }
+            }
+        }
+
+        // Number the components in the order of their first cells, which
+        // are the roots.
+        const size_t max_labels {std::numeric_limits<label_t>::max() - 1};
+        size_t n_components {0};
+        for (size_t k = 0; k < n_cells; ++k) {
+            if (!labels[k]) continue;
+            size_t root {detail::find_root(parent, k)};
+            if (root == k) {
+                if (n_components == max_labels) {
+                    throw std::runtime_error(
+                        "Too many connected components.");
+                }
+                labels[k] = static_cast<label_t>(++n_components);
+            } else {
+                labels[k] = labels[root];
+            }
+        }
+        return n_components;
+    }
+
+}
+
+#endif
@@ -0,0 +1,146 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef DISTANCE_TRANSFORM_H_
+#define DISTANCE_TRANSFORM_H_
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "parallel.h"
+
+/**
+ * \brief The Euclidean distance transform of a raster.
+ */
+namespace distance_transform {
+
+    const std::uint32_t infinity {std::numeric_limits<std::uint32_t>::max()};
+
+    /**
+     * \brief Compute the squared Euclidean distance (in cells) from each
+     * cell to the closest feature cell.
+     *
+     * The transform is computed exactly in linear time with two separable
+     * passes (Felzenszwalb & Huttenlocher, Distance Transforms of Sampled
+     * Functions, 2012): first the distance to the closest feature in the same
+     * column, then the lower envelope of parabolas along each row. Both
+     * passes are run on several threads.
+     *
+     * \param is_feature A functor returning true for the raster index of a
+     * feature cell. It is called concurrently from several threads.
+     * \param max_d2 The distances larger than this are set to infinity.
+     * \param d2 The output, nx * ny values.
+     */
+    template<typename F>
+    void squared_edt(
+        F is_feature,
+        size_t nx,
+        size_t ny,
+        std::uint32_t max_d2,
+        std::vector<std::uint32_t> & d2);
+
+    /* implementation */
+
+    template<typename F>
+    void squared_edt(
+        F is_feature,
+        size_t nx,
+        size_t ny,
+        std::uint32_t max_d2,
+        std::vector<std::uint32_t> & d2)
+    {
+        if (max_d2 == infinity) --max_d2;
+        d2.resize(nx * ny);
+        // the upward sweep below starts from the row ny - 1
+        if (nx == 0 || ny == 0) return;
+        std::uint32_t max_d {0};
+        while (static_cast<std::uint64_t>(max_d + 1) * (max_d + 1) <= max_d2) {
+            ++max_d;
+        }
+
+        // The distance to the closest feature in the same column. The
+        // columns are split between the threads and each thread sweeps the
+        // rows down and up.
+        parallel::for_blocks(nx, [&](size_t i_begin, size_t i_end)
+        {
+            for (size_t j = 0; j < ny; ++j) {
+                for (size_t i = i_begin; i < i_end; ++i) {
+                    size_t ind {j * nx + i};
+                    if (is_feature(ind)) {
+                        d2[ind] = 0;
+                    } else if (j > 0 && d2[ind - nx] < max_d) {
+                        d2[ind] = d2[ind - nx] + 1;
+                    } else {
+                        d2[ind] = infinity;
+                    }
+                }
+            }
+            for (size_t j = ny - 1; j-- > 0; ) {
+                for (size_t i = i_begin; i < i_end; ++i) {
+                    size_t ind {j * nx + i};
+                    std::uint32_t below {d2[ind + nx]};
+                    if (below < max_d && below + 1 < d2[ind]) {
+                        d2[ind] = below + 1;
+                    }
+                }
+            }
+        }, 64);
+
+        // The lower envelope of the parabolas (i - k)^2 + f(k) on each row.
+        parallel::for_blocks(ny, [&](size_t j_begin, size_t j_end)
+        {
+            std::vector<std::uint32_t> f(nx);
+            std::vector<size_t> v(nx);
+            std::vector<double> z(nx + 1);
+            for (size_t j = j_begin; j < j_end; ++j) {
+                std::uint32_t * row {d2.data() + j * nx};
+                for (size_t i = 0; i < nx; ++i) {
+                    f[i] = row[i] == infinity ? infinity : row[i] * row[i];
+                }
+                size_t k {0};
+                for (size_t q = 0; q < nx; ++q) {
+                    if (f[q] == infinity) continue;
+                    double s {0};
+                    while (k > 0) {
+                        size_t p {v[k - 1]};
+                        s = ((static_cast<double>(f[q]) + static_cast<double>(q * q)) -
+                             (static_cast<double>(f[p]) + static_cast<double>(p * p))) /
+                            static_cast<double>(2 * (q - p));
+                        if (s > z[k - 1]) break;
+                        --k;
+                    }
+                    if (k == 0) {
+                        z[0] = -std::numeric_limits<double>::infinity();
+                    } else {
+                        z[k] = s;
+                    }
+                    v[k] = q;
+                    ++k;
+                    z[k] = std::numeric_limits<double>::infinity();
+                }
+                if (k == 0) continue;
+                size_t l {0};
+                for (size_t q = 0; q < nx; ++q) {
+                    while (z[l + 1] < static_cast<double>(q)) ++l;
+                    size_t p {v[l]};
+                    size_t di {q > p ? q - p : p - q};
+                    std::uint64_t val {static_cast<std::uint64_t>(di) * di + f[p]};
+                    row[q] = val > max_d2 ? infinity :
+                        static_cast<std::uint32_t>(val);
+                }
+            }
+        });
+    }
+
+}
+
+#endif
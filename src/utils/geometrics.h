@@ -25,6 +25,25 @@ C rotate(const C &c, double angle)
             sin(angle) * c.x() + cos(angle) * c.y()};
 }
 
+/**
+ * \brief Return twice the area of the triangle (a, b, p), i.e. the distance
+ * of the point p to the line defined by the points a and b multiplied by the
+ * distance between a and b.
+ */
+template<typename C>
+long long twice_area(const C &a, const C &b, const C &p)
+{
+    long long x1 {static_cast<long long>(a.col())};
+    long long y1 {static_cast<long long>(a.row())};
+    long long x2 {static_cast<long long>(b.col())};
+    long long y2 {static_cast<long long>(b.row())};
+    long long x0 {static_cast<long long>(p.col())};
+    long long y0 {static_cast<long long>(p.row())};
+
+    long long ret {(y2 - y1) * x0 - (x2 - x1) * y0 + x2 * y1 - y2 * x1};
+    return ret < 0 ? -ret : ret;
+}
+
 /**
  * \brief Return the distance of the point p to the line defined by the points
  * a and b.
@@ -12,6 +12,7 @@
 
 #include "logging.h"
 #include <iomanip>
+#include <mutex>
 #include <sstream>
 
 #include "global_parameters.h"
@@ -20,12 +21,16 @@
 namespace {
 
     std::string output_identifier;
-    std::ostream *o;
     std::ofstream outFileStream;
     std::ofstream nullOutStream;
+    // no output before init(), e.g. when used as a library
+    std::ostream *o {&nullOutStream};
     std::string prefix;
-    int indent;
+    // each thread indents its own lines
+    thread_local int indent {0};
     bool timed;
+    // the lines of the different threads are written one at a time
+    std::mutex write_mutex;
 
 }
 
@@ -49,20 +54,16 @@ namespace logging {
 
     LogWriter::~LogWriter()
     {
-        #ifdef USE_OMP
-        #pragma omp critical(print)
-        #endif
         if (ss) {
+            std::lock_guard<std::mutex> lock {write_mutex};
             *stream_ << ss->str() << std::endl;
         }
     }
 
     void LogWriter::flush()
     {
-        #ifdef USE_OMP
-        #pragma omp critical(print)
-        #endif
         if (ss) {
+            std::lock_guard<std::mutex> lock {write_mutex};
             *stream_ << ss->str() << std::flush;
             ss.reset(new std::stringstream());
         }
@@ -193,7 +194,7 @@ namespace logging {
     std::string current_time() {
         time_t t = std::time(0);
         struct tm now;
-        now = *std::localtime(&t);
+        localtime_r(&t, &now);
         std::stringstream ss;
         ss << std::setfill('0') << std::setw(2) << now.tm_hour << ":"
             << std::setw(2) << now.tm_min << ":"
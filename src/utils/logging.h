@@ -26,6 +26,8 @@ namespace logging {
      * \brief The indentation of the log lines is increased by a specific
      * amount. The indentation is decreased by the same amount when the object
      * is destroyed.
+     *
+     * The indentation is per thread, and a new thread starts without it.
      */
     class LogIndent {
         public:
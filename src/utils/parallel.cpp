@@ -0,0 +1,43 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "parallel.h"
+
+#include "global_parameters.h"
+
+namespace parallel {
+
+    namespace {
+        // zero means no limit
+        thread_local unsigned int thread_limit {0};
+    }
+
+    unsigned int n_threads()
+    {
+        unsigned int n {global_parameters::n_threads > 0 ?
+            global_parameters::n_threads :
+            std::max(std::thread::hardware_concurrency(), 1u)};
+        if (thread_limit > 0) n = std::min(n, thread_limit);
+        return n;
+    }
+
+    ThreadLimit::ThreadLimit(unsigned int n):
+        previous_ {thread_limit}
+    {
+        thread_limit = std::max(n, 1u);
+    }
+
+    ThreadLimit::~ThreadLimit()
+    {
+        thread_limit = previous_;
+    }
+
+}
@@ -0,0 +1,163 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+/**
+ * \brief Helpers for running loops on several threads.
+ */
+namespace parallel {
+
+    /**
+     * \brief The number of worker threads to use.
+     *
+     * The value is read from global_parameters::n_threads. If it is zero,
+     * the number of hardware threads is used. A ThreadLimit on the calling
+     * thread lowers the value.
+     */
+    unsigned int n_threads();
+
+    /**
+     * \brief Limit the number of worker threads seen by n_threads() on the
+     * current thread while the object lives.
+     *
+     * Used when several parallel jobs run at the same time, each on its
+     * own share of the threads. The worker threads of for_blocks() and
+     * for_each_task() get the limit of the calling thread.
+     */
+    class ThreadLimit
+    {
+        public:
+            explicit ThreadLimit(unsigned int n);
+            ~ThreadLimit();
+            ThreadLimit(const ThreadLimit &) = delete;
+            ThreadLimit & operator=(const ThreadLimit &) = delete;
+
+        private:
+            unsigned int previous_;
+    };
+
+    /**
+     * \brief Split the range [0, n) into contiguous blocks and call
+     * f(begin, end) for each block on its own thread.
+     *
+     * The blocks contain at least \a min_block items. The first block is
+     * processed on the calling thread. An exception thrown by \a f is
+     * rethrown after all the threads have finished.
+     */
+    template<typename F>
+    void for_blocks(size_t n, F f, size_t min_block = 1);
+
+    /**
+     * \brief Call f(i) for each task i in [0, n) on the worker threads.
+     *
+     * The threads take the next task from a shared counter whenever they
+     * are idle, so the tasks are started in the order 0, 1, ... and the
+     * long tasks should come first. An exception thrown by \a f stops the
+     * taking of new tasks and is rethrown after all the threads have
+     * finished.
+     *
+     * \param max_workers The maximum number of the tasks run at the same
+     * time, zero means n_threads().
+     */
+    template<typename F>
+    void for_each_task(size_t n, F f, size_t max_workers = 0);
+
+    /* implementation */
+
+    template<typename F>
+    void for_blocks(size_t n, F f, size_t min_block)
+    {
+        if (n == 0) return;
+        if (min_block == 0) min_block = 1;
+        size_t n_blocks {std::min(
+            static_cast<size_t>(n_threads()),
+            (n + min_block - 1) / min_block)};
+        if (n_blocks <= 1) {
+            f(static_cast<size_t>(0), n);
+            return;
+        }
+        std::vector<std::exception_ptr> errors(n_blocks);
+        const unsigned int limit {n_threads()};
+        auto run = [&](size_t b)
+        {
+            ThreadLimit thread_limit {limit};
+            size_t begin {(n * b) / n_blocks};
+            size_t end {(n * (b + 1)) / n_blocks};
+            try {
+                f(begin, end);
+            } catch (...) {
+                errors[b] = std::current_exception();
+            }
+        };
+        std::vector<std::thread> threads;
+        threads.reserve(n_blocks - 1);
+        for (size_t b = 1; b < n_blocks; ++b) {
+            threads.emplace_back(run, b);
+        }
+        run(0);
+        for (auto & t: threads) {
+            t.join();
+        }
+        for (auto & e: errors) {
+            if (e) std::rethrow_exception(e);
+        }
+    }
+
+    template<typename F>
+    void for_each_task(size_t n, F f, size_t max_workers)
+    {
+        if (n == 0) return;
+        size_t n_workers {std::min(static_cast<size_t>(n_threads()), n)};
+        if (max_workers > 0) n_workers = std::min(n_workers, max_workers);
+        std::atomic<size_t> next {0};
+        std::atomic<bool> failed {false};
+        std::vector<std::exception_ptr> errors(n_workers);
+        const unsigned int limit {n_threads()};
+        auto run = [&](size_t w)
+        {
+            ThreadLimit thread_limit {limit};
+            try {
+                while (!failed) {
+                    size_t i {next++};
+                    if (i >= n) break;
+                    f(i);
+                }
+            } catch (...) {
+                errors[w] = std::current_exception();
+                failed = true;
+            }
+        };
+        std::vector<std::thread> threads;
+        threads.reserve(n_workers - 1);
+        for (size_t w = 1; w < n_workers; ++w) {
+            threads.emplace_back(run, w);
+        }
+        run(0);
+        for (auto & t: threads) {
+            t.join();
+        }
+        for (auto & e: errors) {
+            if (e) std::rethrow_exception(e);
+        }
+    }
+
+}
+
+#endif
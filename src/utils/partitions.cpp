@@ -0,0 +1,163 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#include "partitions.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+namespace partitions {
+
+    namespace {
+
+        std::string shm_name(pid_t parent, partition_id p)
+        {
+            return "/carving_" + std::to_string(parent) + "_" +
+                std::to_string(p);
+        }
+
+        // Write the data to a new shared memory object, or return false.
+        bool write_shm(const std::string & name, const std::string & data)
+        {
+            int fd {shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600)};
+            if (fd < 0) return false;
+            bool ok {ftruncate(fd, static_cast<off_t>(data.size())) == 0};
+            if (ok && !data.empty()) {
+                void * p {mmap(nullptr, data.size(), PROT_WRITE, MAP_SHARED,
+                    fd, 0)};
+                if (p == MAP_FAILED) {
+                    ok = false;
+                } else {
+                    std::memcpy(p, data.data(), data.size());
+                    munmap(p, data.size());
+                }
+            }
+            close(fd);
+            return ok;
+        }
+
+        // the exit statuses of a worker that failed
+        const int exit_failed {1};
+        const int exit_error_passed {2};
+
+        // Read and remove the shared memory object.
+        std::string read_shm(const std::string & name)
+        {
+            int fd {shm_open(name.c_str(), O_RDONLY, 0)};
+            if (fd < 0) {
+                throw std::runtime_error(
+                    "Could not open the shared memory " + name + ".");
+            }
+            struct stat st;
+            std::string data;
+            if (fstat(fd, &st) == 0 && st.st_size > 0) {
+                size_t size {static_cast<size_t>(st.st_size)};
+                void * p {mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0)};
+                if (p != MAP_FAILED) {
+                    data.assign(static_cast<const char *>(p), size);
+                    munmap(p, size);
+                }
+            }
+            close(fd);
+            shm_unlink(name.c_str());
+            return data;
+        }
+
+    }
+
+    std::vector<std::string> run_in_processes(
+        partition_id n,
+        const std::function<std::string(partition_id)> & f)
+    {
+        const pid_t parent {getpid()};
+        std::vector<pid_t> workers;
+        for (partition_id p = 0; p < n; ++p) {
+            pid_t pid {fork()};
+            if (pid < 0) {
+                for (auto w: workers) waitpid(w, nullptr, 0);
+                throw std::runtime_error("Could not start a worker process.");
+            }
+            if (pid == 0) {
+                // the workers share the threads of the calling process
+                parallel::ThreadLimit limit {std::max(1u,
+                    parallel::n_threads() / static_cast<unsigned int>(n))};
+                // the error of a failed worker is passed back in place of
+                // its result
+                int status {exit_failed};
+                try {
+                    if (write_shm(shm_name(parent, p), f(p))) status = 0;
+                } catch (std::exception & e) {
+                    if (write_shm(shm_name(parent, p), e.what())) {
+                        status = exit_error_passed;
+                    }
+                } catch (...) {
+                    if (write_shm(shm_name(parent, p), "unknown error")) {
+                        status = exit_error_passed;
+                    }
+                }
+                // the parent owns the resources shared with the worker
+                _exit(status);
+            }
+            workers.push_back(pid);
+        }
+
+        std::vector<std::string> results(n);
+        std::string errors;
+        for (partition_id p = 0; p < n; ++p) {
+            int status {0};
+            std::string error;
+            // all the workers are waited for before throwing
+            try {
+                if (waitpid(workers[p], &status, 0) < 0) {
+                    error = "could not wait for the worker";
+                } else if (WIFSIGNALED(status)) {
+                    error = "killed by signal " +
+                        std::to_string(WTERMSIG(status));
+                } else if (!WIFEXITED(status) ||
+                    WEXITSTATUS(status) == exit_failed)
+                {
+                    error = "could not pass the result";
+                } else if (WEXITSTATUS(status) == exit_error_passed) {
+                    error = read_shm(shm_name(parent, p));
+                    if (error.empty()) error = "unknown error";
+                } else if (WEXITSTATUS(status) != 0) {
+                    error = "exited with status " +
+                        std::to_string(WEXITSTATUS(status));
+                } else {
+                    results[p] = read_shm(shm_name(parent, p));
+                }
+            } catch (std::exception & e) {
+                error = e.what();
+            }
+            if (!error.empty()) {
+                shm_unlink(shm_name(parent, p).c_str());
+                errors += (errors.empty() ? "" : "; ") +
+                    std::string("partition ") + std::to_string(p) + ": " +
+                    error;
+            }
+        }
+        if (!errors.empty()) {
+            throw std::runtime_error("A worker process failed: " + errors);
+        }
+        return results;
+    }
+
+}
@@ -0,0 +1,51 @@
+/**
+ * Copyright
+ *   2015-     Finnish Geospatial Research Institute,
+ *             National Land Survey of Finland
+ *
+ * Programmers: Ville Mäkinen
+ *
+ * This file is released under the GNU Lesser General Public
+ * Licence version 2.1.
+ */
+
+#ifndef PARTITIONS_H_
+#define PARTITIONS_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "coordinates.h"
+
+/**
+ * \brief Running the partitions of a computation in separate processes.
+ */
+namespace partitions {
+
+    using partition_id = coordinates::partition_coord_type;
+
+    /**
+     * \brief Run f(p) for each partition p in [0, n) in its own worker
+     * process, forked from the calling process.
+     *
+     * The workers share nothing with each other, so the operating system is
+     * free to place each of them on its own memory node. The result of
+     * each worker is passed back to the calling process through a POSIX
+     * shared memory object, or the error if the worker fails. Each worker
+     * runs f with its share of the threads, n_threads() / n.
+     *
+     * Must be called when the calling process has no other threads
+     * running.
+     *
+     * \return The results of the partitions, in the partition order.
+     * \throw std::runtime_error if a worker fails, with the error of each
+     * failed partition, e.g. the message of the exception thrown by f.
+     */
+    std::vector<std::string> run_in_processes(
+        partition_id n,
+        const std::function<std::string(partition_id)> & f);
+
+}
+
+#endif